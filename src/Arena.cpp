@@ -0,0 +1,53 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <cstring>
+
+#include "Arena.h"
+
+uint64_t Arena::Add(const void *data, size_t len)
+{
+  bytes += len;
+
+  // Large values get a chunk of their own so they don't waste the rest of
+  // the current one. The current chunk stays open for small values.
+  if (len > chunkSize / 4) {
+    chunks.emplace_back(new char[len]);
+    memcpy(chunks.back().get(), data, len);
+    return static_cast<uint64_t>(chunks.size() - 1) << 32;
+  }
+
+  if (!open || used + len > chunkSize) {
+    chunks.emplace_back(new char[chunkSize]);
+    current = chunks.size() - 1;
+    used = 0;
+    open = true;
+  }
+
+  uint64_t pos = (static_cast<uint64_t>(current) << 32) | used;
+  memcpy(chunks[current].get() + used, data, len);
+  used += len;
+  return pos;
+}
+
+void Arena::Clear()
+{
+  chunks.clear();
+  current = 0;
+  used = 0;
+  bytes = 0;
+  open = false;
+}
@@ -0,0 +1,58 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Append-only byte storage made of large chunks. Values are addressed by a
+// 64-bit position (chunk index in the upper half, offset in the lower half)
+// that stays valid for the life of the arena, so callers can keep compact
+// offset arrays instead of pointers.
+class Arena {
+public:
+  explicit Arena(size_t chunkSize = 1024 * 1024) : chunkSize{chunkSize} {}
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Copies len bytes into the arena and returns their position.
+  uint64_t Add(const void *data, size_t len);
+
+  const char *at(uint64_t pos) const
+  {
+    return chunks[pos >> 32].get() + (pos & 0xffffffffu);
+  }
+
+  // Number of bytes stored, not counting unused chunk space.
+  size_t size() const { return bytes; }
+
+  void Clear();
+
+private:
+  std::vector<std::unique_ptr<char[]>> chunks;
+  size_t chunkSize;
+  size_t current{0};
+  size_t used{0};
+  size_t bytes{0};
+  bool open{false};
+};
+
+#endif // ARENA_H
@@ -0,0 +1,707 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "ArrowSink.h"
+#include "freetds/convert.h"
+#include "freetds/iconv.h"
+
+// Rows per record batch, and the amount of character and binary data that
+// ends a batch early. Offsets into the data are 32 bits.
+static constexpr int kBatchRows = 65536;
+static constexpr size_t kBatchBytes = 64 << 20;
+
+// Arrow IPC constants, see Schema.fbs and Message.fbs in the Arrow format
+// specification.
+static constexpr uint32_t kContinuation = 0xffffffff;
+static constexpr int16_t kMetadataV5 = 4;
+static constexpr uint8_t kHeaderSchema = 1;
+static constexpr uint8_t kHeaderRecordBatch = 3;
+
+static constexpr uint8_t kTypeInt = 2;
+static constexpr uint8_t kTypeFloatingPoint = 3;
+static constexpr uint8_t kTypeBinary = 4;
+static constexpr uint8_t kTypeUtf8 = 5;
+static constexpr uint8_t kTypeBool = 6;
+static constexpr uint8_t kTypeDecimal = 7;
+static constexpr uint8_t kTypeDate = 8;
+static constexpr uint8_t kTypeTime = 9;
+static constexpr uint8_t kTypeTimestamp = 10;
+static constexpr uint8_t kTypeFixedSizeBinary = 15;
+
+static constexpr int16_t kPrecisionSingle = 1;
+static constexpr int16_t kPrecisionDouble = 2;
+static constexpr int16_t kDateUnitDay = 0;
+static constexpr int16_t kTimeUnitMicro = 2;
+static constexpr int16_t kTimeUnitNano = 3;
+
+// Server dates count days from 1900-01-01.
+static constexpr int kDays1900To1970 = 25567;
+static constexpr int64_t kMicrosPerDay = 86400LL * 1000000;
+
+static size_t Padded(size_t len)
+{
+  return (len + 7) & ~static_cast<size_t>(7);
+}
+
+namespace {
+
+// Fields of a FlatBuffers table, collected before the table is written.
+class FlatTable {
+public:
+  explicit FlatTable(int numFields) : slots(numFields) { }
+
+  template <typename T>
+  void Add(int id, T value)
+  {
+    slots[id].size = sizeof(T);
+    memcpy(slots[id].bytes, &value, sizeof(T));
+  }
+
+  // A string, vector or table, written after this table and linked to the
+  // field with FlatBuilder::Link.
+  void AddOffset(int id) { Add<uint32_t>(id, 0); }
+
+  // Position of a field in the buffer, once the table is written.
+  size_t at(int id) const { return slots[id].pos; }
+
+private:
+  friend class FlatBuilder;
+
+  struct Slot {
+    size_t size{0};
+    unsigned char bytes[8];
+    size_t pos{0};
+  };
+  std::vector<Slot> slots;
+};
+
+// Just enough of a FlatBuffers encoder for the Arrow message headers.
+// Objects are laid out front to back, so a table comes before the strings,
+// vectors and tables it refers to and every offset points forward, as the
+// format requires. Scalars are aligned to their size from the start of the
+// buffer, which itself is written at an 8 byte boundary.
+class FlatBuilder {
+public:
+  // Leaves room for the offset of the root table.
+  FlatBuilder() : buf(4) { }
+
+  const std::vector<uint8_t>& data() const { return buf; }
+
+  void Root(size_t table) { Link(0, table); }
+
+  // Point the offset field at position at to target.
+  void Link(size_t at, size_t target) { Set<uint32_t>(at, static_cast<uint32_t>(target - at)); }
+
+  // Writes the vtable followed by the table and returns the table position.
+  size_t AddTable(FlatTable& table)
+  {
+    size_t count = table.slots.size();
+
+    Align(2);
+    size_t vtable = buf.size();
+    buf.resize(vtable + 4 + 2 * count);
+    Set<uint16_t>(vtable, static_cast<uint16_t>(4 + 2 * count));
+
+    Align(8);
+    size_t start = buf.size();
+    Put<int32_t>(static_cast<int32_t>(start - vtable));
+    for (size_t i = 0; i < count; i++) {
+      FlatTable::Slot& slot = table.slots[i];
+      if (slot.size == 0)
+        continue;
+      Align(slot.size);
+      slot.pos = buf.size();
+      buf.insert(buf.end(), slot.bytes, slot.bytes + slot.size);
+      Set<uint16_t>(vtable + 4 + 2 * i, static_cast<uint16_t>(slot.pos - start));
+    }
+    Set<uint16_t>(vtable + 2, static_cast<uint16_t>(buf.size() - start));
+    return start;
+  }
+
+  size_t AddString(const std::string& s)
+  {
+    size_t pos = Put<uint32_t>(static_cast<uint32_t>(s.size()));
+    buf.insert(buf.end(), s.begin(), s.end());
+    buf.push_back(0);
+    return pos;
+  }
+
+  // Writes the length of a vector and reserves its zeroed elements, which
+  // start 4 bytes after the returned position.
+  size_t AddVector(size_t count, size_t size, size_t align)
+  {
+    Align(4);
+    while ((buf.size() + 4) % align != 0) {
+      buf.push_back(0);
+    }
+    size_t pos = Put<uint32_t>(static_cast<uint32_t>(count));
+    buf.resize(buf.size() + count * size);
+    return pos;
+  }
+
+  template <typename T>
+  void Set(size_t at, T value) { memcpy(&buf[at], &value, sizeof(T)); }
+
+private:
+  template <typename T>
+  size_t Put(T value)
+  {
+    Align(sizeof(T));
+    size_t pos = buf.size();
+    buf.resize(pos + sizeof(T));
+    Set<T>(pos, value);
+    return pos;
+  }
+
+  void Align(size_t n)
+  {
+    while (buf.size() % n != 0) {
+      buf.push_back(0);
+    }
+  }
+
+  std::vector<uint8_t> buf;
+};
+
+} // namespace
+
+// Starts a Message holding header and returns the field to link the header
+// table to.
+static size_t AddMessage(FlatBuilder& fb, uint8_t header, int64_t bodyLength)
+{
+  FlatTable message(4);
+  message.Add<int16_t>(0, kMetadataV5);
+  message.Add<uint8_t>(1, header);
+  message.AddOffset(2);
+  message.Add<int64_t>(3, bodyLength);
+  fb.Root(fb.AddTable(message));
+  return message.at(2);
+}
+
+// TDS_NUMERIC keeps a sign byte and a big endian magnitude, decimal128 is a
+// little endian two's complement integer.
+static void NumericToDecimal(const TDS_NUMERIC *num, unsigned char *dst)
+{
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+
+  int bytes = tds_numeric_bytes_per_prec[num->precision];
+  for (int i = 1; i < bytes; i++) {
+    hi = (hi << 8) | (lo >> 56);
+    lo = (lo << 8) | num->array[i];
+  }
+  if (num->array[0] != 0) {
+    lo = ~lo + 1;
+    hi = ~hi + (lo == 0 ? 1 : 0);
+  }
+  memcpy(dst, &lo, 8);
+  memcpy(dst + 8, &hi, 8);
+}
+
+static void PutDecimal(unsigned char *dst, int64_t value)
+{
+  int64_t hi = value < 0 ? -1 : 0;
+  memcpy(dst, &value, 8);
+  memcpy(dst + 8, &hi, 8);
+}
+
+template <typename T>
+static void PutValue(unsigned char *dst, T value)
+{
+  memcpy(dst, &value, sizeof(T));
+}
+
+static void PutBigEndian(unsigned char *dst, uint32_t value, int bytes)
+{
+  for (int i = bytes - 1; i >= 0; i--) {
+    dst[i] = static_cast<unsigned char>(value);
+    value >>= 8;
+  }
+}
+
+ArrowSink::~ArrowSink()
+{
+  Close();
+  if (toUtf8 != reinterpret_cast<iconv_t>(-1)) {
+    iconv_close(toUtf8);
+  }
+}
+
+bool ArrowSink::Open(const char *path)
+{
+  Close();
+
+  file = fopen(path, "wb");
+  if (file == nullptr)
+    return false;
+
+  failed = false;
+  columns.clear();
+  resultSets = 0;
+  rows = 0;
+  batchRows = 0;
+  batchBytes = 0;
+  return true;
+}
+
+bool ArrowSink::Close()
+{
+  if (file == nullptr)
+    return !failed;
+
+  if (batchRows > 0) {
+    WriteBatch();
+  }
+
+  // End of stream
+  uint32_t eos[2] = { kContinuation, 0 };
+  Write(eos, sizeof(eos));
+
+  if (fclose(file) != 0) {
+    failed = true;
+  }
+  file = nullptr;
+  return !failed;
+}
+
+void ArrowSink::Write(const void *data, size_t len)
+{
+  if (len > 0 && fwrite(data, 1, len, file) != len) {
+    failed = true;
+  }
+}
+
+void ArrowSink::Pad(size_t len)
+{
+  static const char zeros[8] = { 0 };
+  Write(zeros, Padded(len) - len);
+}
+
+void ArrowSink::WriteMessage(const std::vector<uint8_t>& metadata)
+{
+  // The length includes the padding, so the body that follows starts at an
+  // 8 byte boundary.
+  uint32_t prefix[2] = { kContinuation, static_cast<uint32_t>(Padded(metadata.size())) };
+  Write(prefix, sizeof(prefix));
+  Write(metadata.data(), metadata.size());
+  Pad(metadata.size());
+}
+
+void ArrowSink::onResultFormat(const TDSCONTEXT *ctx, const TDSRESULTINFO *info)
+{
+  if (resultSets++ > 0)
+    return;
+
+  context = ctx;
+
+  columns.resize(info->num_cols);
+  for (int c = 0; c < info->num_cols; c++) {
+    TDSCOLUMN *col = info->columns[c];
+    Column& column = columns[c];
+
+    column.name = tds_dstr_cstr(&col->column_name);
+    column.type = tds_get_conversion_type(col->column_type, col->column_size);
+    column.blob = is_blob_col(col);
+    column.nullable = col->column_nullable;
+    column.precision = col->column_prec;
+    column.scale = col->column_scale;
+
+    switch (column.type) {
+      case SYBINT1: column.kind = Kind::UInt8; column.width = 1; break;
+      case SYBINT2: column.kind = Kind::Int16; column.width = 2; break;
+      case SYBINT4: column.kind = Kind::Int32; column.width = 4; break;
+      case SYBINT8: column.kind = Kind::Int64; column.width = 8; break;
+      case SYBREAL: column.kind = Kind::Float32; column.width = 4; break;
+      case SYBFLT8: column.kind = Kind::Float64; column.width = 8; break;
+      case SYBBIT: column.kind = Kind::Bool; column.width = 0; break;
+      case SYBMONEY: column.kind = Kind::Money; column.width = 16; break;
+      case SYBMONEY4: column.kind = Kind::SmallMoney; column.width = 16; break;
+      case SYBNUMERIC:
+      case SYBDECIMAL: column.kind = Kind::Decimal; column.width = 16; break;
+      case SYBDATETIME: column.kind = Kind::DateTime; column.width = 8; break;
+      case SYBDATETIME4: column.kind = Kind::SmallDateTime; column.width = 8; break;
+      case SYBMSDATE: column.kind = Kind::Date; column.width = 4; break;
+      case SYBMSTIME: column.kind = Kind::Time; column.width = 8; break;
+      case SYBMSDATETIME2: column.kind = Kind::DateTime2; column.width = 8; break;
+      case SYBMSDATETIMEOFFSET: column.kind = Kind::DateTimeOffset; column.width = 8; break;
+      case SYBUNIQUE: column.kind = Kind::Guid; column.width = 16; break;
+      default:
+        column.width = 0;
+        if (is_char_type(column.type)) {
+          column.kind = Kind::Utf8;
+        } else if (is_binary_type(column.type)) {
+          column.kind = Kind::Binary;
+        } else {
+          column.kind = Kind::Text;
+        }
+        break;
+    }
+    if (col->column_type == SYBVARIANT || (column.kind == Kind::Decimal && column.precision > 38)) {
+      column.kind = Kind::Text;
+      column.width = 0;
+    }
+
+    column.validity.clear();
+    column.values.clear();
+    column.offsets.clear();
+    column.nulls = 0;
+    if (column.width == 0 && column.kind != Kind::Bool) {
+      column.offsets.push_back(0);
+    }
+
+    // Character data arrives in the client charset.
+    if (column.kind == Kind::Utf8 && col->char_conv != nullptr &&
+        toUtf8 == reinterpret_cast<iconv_t>(-1)) {
+      const char *charset = col->char_conv->from.charset.name;
+      if (strcmp(charset, "UTF-8") != 0) {
+        toUtf8 = iconv_open("UTF-8", charset);
+      }
+    }
+  }
+
+  WriteSchema();
+}
+
+void ArrowSink::WriteSchema()
+{
+  FlatBuilder fb;
+  size_t header = AddMessage(fb, kHeaderSchema, 0);
+
+  FlatTable schema(2);
+  schema.Add<int16_t>(0, 0); // little endian
+  schema.AddOffset(1);
+  fb.Link(header, fb.AddTable(schema));
+
+  size_t fields = fb.AddVector(columns.size(), 4, 4);
+  fb.Link(schema.at(1), fields);
+
+  for (size_t i = 0; i < columns.size(); i++) {
+    const Column& column = columns[i];
+
+    FlatTable type(3);
+    uint8_t typeId = kTypeUtf8;
+    const char *timezone = nullptr;
+    switch (column.kind) {
+      case Kind::UInt8:
+        typeId = kTypeInt;
+        type.Add<int32_t>(0, 8);
+        type.Add<uint8_t>(1, 0);
+        break;
+      case Kind::Int16:
+      case Kind::Int32:
+      case Kind::Int64:
+        typeId = kTypeInt;
+        type.Add<int32_t>(0, column.width * 8);
+        type.Add<uint8_t>(1, 1);
+        break;
+      case Kind::Float32:
+        typeId = kTypeFloatingPoint;
+        type.Add<int16_t>(0, kPrecisionSingle);
+        break;
+      case Kind::Float64:
+        typeId = kTypeFloatingPoint;
+        type.Add<int16_t>(0, kPrecisionDouble);
+        break;
+      case Kind::Bool:
+        typeId = kTypeBool;
+        break;
+      case Kind::Money:
+      case Kind::SmallMoney:
+      case Kind::Decimal:
+        typeId = kTypeDecimal;
+        type.Add<int32_t>(0, column.kind == Kind::Money ? 19 : column.kind == Kind::SmallMoney ? 10 : column.precision);
+        type.Add<int32_t>(1, column.kind == Kind::Decimal ? column.scale : 4);
+        type.Add<int32_t>(2, 128);
+        break;
+      case Kind::DateTime:
+      case Kind::SmallDateTime:
+      case Kind::DateTime2:
+        typeId = kTypeTimestamp;
+        type.Add<int16_t>(0, kTimeUnitMicro);
+        break;
+      case Kind::DateTimeOffset:
+        typeId = kTypeTimestamp;
+        type.Add<int16_t>(0, kTimeUnitMicro);
+        type.AddOffset(1);
+        timezone = "UTC";
+        break;
+      case Kind::Date:
+        typeId = kTypeDate;
+        type.Add<int16_t>(0, kDateUnitDay);
+        break;
+      case Kind::Time:
+        typeId = kTypeTime;
+        type.Add<int16_t>(0, kTimeUnitNano);
+        type.Add<int32_t>(1, 64);
+        break;
+      case Kind::Guid:
+        typeId = kTypeFixedSizeBinary;
+        type.Add<int32_t>(0, 16);
+        break;
+      case Kind::Binary:
+        typeId = kTypeBinary;
+        break;
+      case Kind::Utf8:
+      case Kind::Text:
+        break;
+    }
+
+    // name, nullable, type_type, type, dictionary, children
+    FlatTable field(6);
+    field.AddOffset(0);
+    field.Add<uint8_t>(1, column.nullable ? 1 : 0);
+    field.Add<uint8_t>(2, typeId);
+    field.AddOffset(3);
+    field.AddOffset(5);
+    fb.Link(fields + 4 + 4 * i, fb.AddTable(field));
+
+    fb.Link(field.at(0), fb.AddString(column.name));
+    fb.Link(field.at(3), fb.AddTable(type));
+    if (timezone != nullptr) {
+      fb.Link(type.at(1), fb.AddString(timezone));
+    }
+    fb.Link(field.at(5), fb.AddVector(0, 4, 4));
+  }
+
+  WriteMessage(fb.data());
+}
+
+void ArrowSink::WriteBatch()
+{
+  // Every column has a validity bitmap, offsets if its values are variable
+  // length, and its values, each starting at an 8 byte boundary of the body.
+  struct Buffer {
+    const void *data;
+    size_t len;
+    int64_t offset;
+  };
+  std::vector<Buffer> buffers;
+  int64_t bodyLength = 0;
+
+  auto add = [&](const void *data, size_t len) {
+    buffers.push_back({data, len, bodyLength});
+    bodyLength += Padded(len);
+  };
+  for (const Column& column : columns) {
+    // The bitmap may be left out when nothing is NULL.
+    add(column.validity.data(), column.nulls > 0 ? column.validity.size() : 0);
+    if (!column.offsets.empty()) {
+      add(column.offsets.data(), column.offsets.size() * sizeof(int32_t));
+    }
+    add(column.values.data(), column.values.size());
+  }
+
+  FlatBuilder fb;
+  size_t header = AddMessage(fb, kHeaderRecordBatch, bodyLength);
+
+  // length, nodes, buffers
+  FlatTable batch(3);
+  batch.Add<int64_t>(0, batchRows);
+  batch.AddOffset(1);
+  batch.AddOffset(2);
+  fb.Link(header, fb.AddTable(batch));
+
+  size_t nodes = fb.AddVector(columns.size(), 16, 8);
+  fb.Link(batch.at(1), nodes);
+  for (size_t i = 0; i < columns.size(); i++) {
+    fb.Set<int64_t>(nodes + 4 + 16 * i, batchRows);
+    fb.Set<int64_t>(nodes + 12 + 16 * i, columns[i].nulls);
+  }
+
+  size_t layout = fb.AddVector(buffers.size(), 16, 8);
+  fb.Link(batch.at(2), layout);
+  for (size_t i = 0; i < buffers.size(); i++) {
+    fb.Set<int64_t>(layout + 4 + 16 * i, buffers[i].offset);
+    fb.Set<int64_t>(layout + 12 + 16 * i, static_cast<int64_t>(buffers[i].len));
+  }
+
+  WriteMessage(fb.data());
+  for (const Buffer& buffer : buffers) {
+    Write(buffer.data, buffer.len);
+    Pad(buffer.len);
+  }
+
+  for (Column& column : columns) {
+    column.validity.clear();
+    column.values.clear();
+    if (!column.offsets.empty()) {
+      column.offsets.resize(1);
+    }
+    column.nulls = 0;
+  }
+  batchRows = 0;
+  batchBytes = 0;
+}
+
+void ArrowSink::onRow(const TDSRESULTINFO *info)
+{
+  // Rows of later result sets have nowhere to go.
+  if (resultSets > 1)
+    return;
+
+  for (int c = 0; c < info->num_cols; c++) {
+    AddValue(columns[c], info->columns[c]);
+  }
+  rows++;
+
+  if (++batchRows == kBatchRows || batchBytes >= kBatchBytes) {
+    WriteBatch();
+  }
+}
+
+void ArrowSink::AddValue(Column& column, const TDSCOLUMN *col)
+{
+  int bit = batchRows % 8;
+  if (bit == 0) {
+    column.validity.push_back(0);
+    if (column.kind == Kind::Bool) {
+      column.values.push_back(0);
+    }
+  }
+
+  // NULLs still take up their slot in fixed width values.
+  size_t pos = column.values.size();
+  if (column.width > 0) {
+    column.values.resize(pos + column.width);
+  }
+
+  if (col->column_cur_size < 0) {
+    column.nulls++;
+    if (!column.offsets.empty()) {
+      column.offsets.push_back(column.offsets.back());
+    }
+    return;
+  }
+  column.validity.back() |= 1 << bit;
+
+  const unsigned char *src = col->column_data;
+  if (column.blob) {
+    src = reinterpret_cast<const unsigned char *>(reinterpret_cast<const TDSBLOB *>(src)->textvalue);
+  }
+  unsigned char *dst = column.values.data() + pos;
+
+  switch (column.kind) {
+    case Kind::UInt8:
+    case Kind::Int16:
+    case Kind::Int32:
+    case Kind::Int64:
+    case Kind::Float32:
+    case Kind::Float64:
+      memcpy(dst, src, column.width);
+      break;
+    case Kind::Bool:
+      if (*src != 0) {
+        column.values.back() |= 1 << bit;
+      }
+      break;
+    case Kind::Money: {
+      const TDS_MONEY *money = reinterpret_cast<const TDS_MONEY *>(src);
+      PutDecimal(dst, static_cast<int64_t>((static_cast<uint64_t>(money->tdsoldmoney.mnyhigh) << 32) |
+          money->tdsoldmoney.mnylow));
+      break;
+    }
+    case Kind::SmallMoney:
+      PutDecimal(dst, reinterpret_cast<const TDS_MONEY4 *>(src)->mny4);
+      break;
+    case Kind::Decimal:
+      NumericToDecimal(reinterpret_cast<const TDS_NUMERIC *>(src), dst);
+      break;
+    case Kind::DateTime: {
+      // The time is in 1/300 seconds.
+      const TDS_DATETIME *dt = reinterpret_cast<const TDS_DATETIME *>(src);
+      PutValue<int64_t>(dst, (static_cast<int64_t>(dt->dtdays) - kDays1900To1970) * kMicrosPerDay +
+          (static_cast<int64_t>(dt->dttime) * 10000 + 1) / 3);
+      break;
+    }
+    case Kind::SmallDateTime: {
+      const TDS_DATETIME4 *dt = reinterpret_cast<const TDS_DATETIME4 *>(src);
+      PutValue<int64_t>(dst, (static_cast<int64_t>(dt->days) - kDays1900To1970) * kMicrosPerDay +
+          static_cast<int64_t>(dt->minutes) * 60000000);
+      break;
+    }
+    case Kind::Date:
+      PutValue<int32_t>(dst, reinterpret_cast<const TDS_DATETIMEALL *>(src)->date - kDays1900To1970);
+      break;
+    case Kind::Time:
+      // The time is in 100 nanoseconds.
+      PutValue<int64_t>(dst, static_cast<int64_t>(reinterpret_cast<const TDS_DATETIMEALL *>(src)->time) * 100);
+      break;
+    case Kind::DateTime2:
+    case Kind::DateTimeOffset: {
+      // datetimeoffset values are kept in UTC, with the offset on the side.
+      const TDS_DATETIMEALL *dt = reinterpret_cast<const TDS_DATETIMEALL *>(src);
+      PutValue<int64_t>(dst, (static_cast<int64_t>(dt->date) - kDays1900To1970) * kMicrosPerDay +
+          static_cast<int64_t>(dt->time / 10));
+      break;
+    }
+    case Kind::Guid: {
+      const TDS_UNIQUE *guid = reinterpret_cast<const TDS_UNIQUE *>(src);
+      PutBigEndian(dst, guid->Data1, 4);
+      PutBigEndian(dst + 4, guid->Data2, 2);
+      PutBigEndian(dst + 6, guid->Data3, 2);
+      memcpy(dst + 8, guid->Data4, 8);
+      break;
+    }
+    case Kind::Utf8:
+    case Kind::Binary:
+      AddText(column, reinterpret_cast<const char *>(src), col->column_cur_size);
+      break;
+    case Kind::Text: {
+      CONV_RESULT cr;
+      TDS_INT len = tds_convert(context, column.type, src, col->column_cur_size, SYBVARCHAR, &cr);
+      if (len < 0) {
+        AddText(column, "", 0);
+        break;
+      }
+      AddText(column, cr.c, len);
+      free(cr.c);
+      break;
+    }
+  }
+}
+
+void ArrowSink::AddText(Column& column, const char *s, size_t len)
+{
+  if (column.kind != Kind::Binary && toUtf8 != reinterpret_cast<iconv_t>(-1) && len > 0) {
+    scratch.resize(len * 4);
+    char *in = const_cast<char *>(s);
+    size_t inLeft = len;
+    char *out = &scratch[0];
+    size_t outLeft = scratch.size();
+
+    iconv(toUtf8, nullptr, nullptr, nullptr, nullptr);
+    while (inLeft > 0 && iconv(toUtf8, &in, &inLeft, &out, &outLeft) == static_cast<size_t>(-1)) {
+      // Replace what can't be converted rather than losing the rest.
+      if ((errno != EILSEQ && errno != EINVAL) || outLeft == 0)
+        break;
+      *out++ = '?';
+      outLeft--;
+      in++;
+      inLeft--;
+    }
+    s = scratch.data();
+    len = out - scratch.data();
+  }
+
+  column.values.insert(column.values.end(), s, s + len);
+  column.offsets.push_back(static_cast<int32_t>(column.values.size()));
+  batchBytes += len;
+}
@@ -0,0 +1,127 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef ARROWSINK_H
+#define ARROWSINK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <iconv.h>
+
+#include "FileSink.h"
+
+// Writes results to a file in the Arrow IPC streaming format, for loading
+// into analysis tools without going through text.
+//
+// Values are taken from the decoded row buffers in their binary form:
+// integers, floats and bits are copied as they are, money and numerics
+// become decimal128, datetimes become timestamps counted from 1970, and
+// uniqueidentifier becomes a 16 byte fixed size binary in RFC 4122 order.
+// Character data is copied as UTF-8 (converted once if the client charset
+// is something else) and binary data as is. Only types without an Arrow
+// equivalent, such as sql_variant, are formatted as text.
+//
+// An Arrow stream has a single schema, so only the first result set is
+// written. Rows are collected per column and written as a record batch
+// every kBatchRows rows.
+class ArrowSink : public FileSink {
+public:
+  ArrowSink() = default;
+  ~ArrowSink();
+
+  ArrowSink(const ArrowSink&) = delete;
+  ArrowSink& operator=(const ArrowSink&) = delete;
+
+  bool Open(const char *path) override;
+  bool Close() override;
+  int64_t rowCount() const override { return rows; }
+
+  void onResultFormat(const TDSCONTEXT *context, const TDSRESULTINFO *info) override;
+  void onRow(const TDSRESULTINFO *info) override;
+
+private:
+  // How a column is stored, and the Arrow type it is written as.
+  enum class Kind {
+    UInt8,          // tinyint
+    Int16,
+    Int32,
+    Int64,
+    Float32,
+    Float64,
+    Bool,           // bit, one bit per value
+    Money,          // decimal128(19, 4)
+    SmallMoney,     // decimal128(10, 4)
+    Decimal,        // decimal128(precision, scale)
+    DateTime,       // timestamp[us]
+    SmallDateTime,  // timestamp[us]
+    Date,           // date32
+    Time,           // time64[ns]
+    DateTime2,      // timestamp[us]
+    DateTimeOffset, // timestamp[us, UTC]
+    Guid,           // fixed_size_binary(16)
+    Utf8,           // character data
+    Binary,         // binary data
+    Text            // anything else, formatted as utf8
+  };
+
+  struct Column {
+    std::string name;
+    Kind kind;
+    int type;        // conversion type
+    bool blob;       // value is held in a TDSBLOB
+    bool nullable;
+    int precision;
+    int scale;
+    int width;       // bytes per value in values, 0 for bits and variable data
+
+    std::vector<uint8_t> validity;
+    std::vector<uint8_t> values;
+    std::vector<int32_t> offsets;
+    int64_t nulls{0};
+  };
+
+  void AddValue(Column& column, const TDSCOLUMN *col);
+  void AddText(Column& column, const char *s, size_t len);
+
+  void WriteSchema();
+  void WriteBatch();
+  void WriteMessage(const std::vector<uint8_t>& metadata);
+  void Write(const void *data, size_t len);
+  void Pad(size_t len);
+
+  FILE *file{nullptr};
+  bool failed{false};
+
+  const TDSCONTEXT *context{nullptr};
+  std::vector<Column> columns;
+  int resultSets{0};
+  int64_t rows{0};
+
+  // Rows collected for the next record batch, and the size of their
+  // variable length data.
+  int batchRows{0};
+  size_t batchBytes{0};
+
+  // Client charset to UTF-8, if the client charset isn't UTF-8 already.
+  iconv_t toUtf8{reinterpret_cast<iconv_t>(-1)};
+  std::string scratch;
+};
+
+#endif // ARROWSINK_H
@@ -0,0 +1,48 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef TDS_BULKROWSOURCE_H
+#define TDS_BULKROWSOURCE_H
+
+#include <cstddef>
+
+namespace tds {
+
+// Supplies the rows of SqlConnection::BulkInsert. Values are handed over as
+// text and converted to the type of their destination column, the same way
+// a literal in a query would be. The methods are called on whichever thread
+// runs BulkInsert.
+class BulkRowSource {
+public:
+  virtual ~BulkRowSource() = default;
+
+  // Move to the next row. Returns false when there are no more rows.
+  virtual bool nextRow() = 0;
+
+  // Value for table column col (0 based, in table order) of the current
+  // row, or nullptr for NULL. The text is in the client charset and only
+  // needs to stay valid until the next call.
+  virtual const char *value(int col, size_t *len) = 0;
+
+  // The current row, row (0 based), was not copied because the value of
+  // column col could not be converted or was NULL for a NOT NULL column.
+  virtual void onRejected(int row, int col) { }
+};
+
+} // namespace tds
+
+#endif // TDS_BULKROWSOURCE_H
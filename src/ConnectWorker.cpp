@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include "ConnectionPool.h"
+#include "ConnectWorker.h"
+
+ConnectWorker::ConnectWorker(FXApp *app, FXObject *target, FXSelector sel)
+{
+  signal = new FXGUISignal(app, target, sel);
+}
+
+ConnectWorker::~ConnectWorker()
+{
+  if (busy) {
+    join();
+    ConnectionPool::instance().Release(conn);
+  }
+  delete signal;
+}
+
+bool ConnectWorker::Connect(Server *server)
+{
+  if (busy)
+    return false;
+
+  srv = server;
+  conn = nullptr;
+  busy = true;
+  if (!start()) {
+    busy = false;
+    return false;
+  }
+  return true;
+}
+
+tds::SqlConnection *ConnectWorker::takeConnection()
+{
+  if (!busy)
+    return nullptr;
+
+  join();
+  busy = false;
+
+  tds::SqlConnection *result = conn;
+  conn = nullptr;
+  return result;
+}
+
+FXint ConnectWorker::run()
+{
+  conn = ConnectionPool::instance().Acquire(*srv);
+  signal->signal();
+  return 0;
+}
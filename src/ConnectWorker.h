@@ -0,0 +1,55 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef CONNECTWORKER_H
+#define CONNECTWORKER_H
+
+#include <fx.h>
+
+#include "Server.h"
+#include "SqlConnection.h"
+
+// Acquires a connection from the ConnectionPool on a background thread, so
+// that name resolution, instance lookup and the login handshake never block
+// the GUI. The target is sent SEL_IO_READ once the attempt has finished and
+// picks up the connection with takeConnection().
+class ConnectWorker : public FXThread {
+public:
+  ConnectWorker(FXApp *app, FXObject *target, FXSelector sel);
+  virtual ~ConnectWorker();
+
+  // Start connecting to server. Returns false if a connection attempt is
+  // still in progress.
+  bool Connect(Server *server);
+  bool isBusy() const { return busy; }
+
+  // Called from the GUI thread when signaled. Returns the connection, or
+  // nullptr if the attempt failed.
+  tds::SqlConnection *takeConnection();
+
+  // Server of the last attempt.
+  Server *server() const { return srv; }
+protected:
+  virtual FXint run();
+private:
+  FXGUISignal *signal{nullptr};
+  Server *srv{nullptr};
+  tds::SqlConnection *conn{nullptr};
+  bool busy{false};
+};
+
+#endif // CONNECTWORKER_H
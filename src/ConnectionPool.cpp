@@ -0,0 +1,269 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include "ConnectionPool.h"
+
+ConnectionPool::Entry& ConnectionPool::entryFor(const Server& server)
+{
+  auto it = servers.find(&server);
+  if (it == servers.end()) {
+    it = servers.emplace(&server, Entry()).first;
+    it->second.created = it->second.generation = ++lastGeneration;
+  }
+  return it->second;
+}
+
+ConnectionPool::Entry *ConnectionPool::entryOf(const tds::SqlConnection& conn)
+{
+  auto it = servers.find(&conn.serverInfo());
+  if (it == servers.end() || conn.poolGeneration() < it->second.created)
+    return nullptr;
+  return &it->second;
+}
+
+tds::SqlConnection *ConnectionPool::Acquire(const Server& server)
+{
+  std::unique_ptr<tds::SqlConnection> conn;
+  std::vector<std::unique_ptr<tds::SqlConnection>> dropped;
+
+  mutex.lock();
+  Entry& entry = entryFor(server);
+  if (entry.inUse >= maxSize) {
+    mutex.unlock();
+    fprintf(stderr, "Connection pool for %s is full (%zu in use)\n", server.name.text(), entry.inUse);
+    return nullptr;
+  }
+
+  // Take the most recently used connection first, it is the least likely
+  // to have been dropped by the server in the meantime.
+  while (!entry.idle.empty()) {
+    std::unique_ptr<tds::SqlConnection> idle = std::move(entry.idle.back().conn);
+    entry.idle.pop_back();
+    if (idle->isAlive()) {
+      conn = std::move(idle);
+      break;
+    }
+    dropped.push_back(std::move(idle));
+  }
+  entry.inUse++;
+  unsigned generation = entry.generation;
+  mutex.unlock();
+
+  // Dead connections are closed outside of the lock.
+  dropped.clear();
+
+  if (!conn) {
+    conn.reset(new tds::SqlConnection(server));
+    conn->setPoolGeneration(generation);
+    if (!conn->Connect()) {
+      mutex.lock();
+      if (Entry *current = entryOf(*conn)) {
+        current->inUse--;
+      }
+      mutex.unlock();
+      return nullptr;
+    }
+  }
+  conn->setPoolGeneration(generation);
+  return conn.release();
+}
+
+tds::SqlConnection *ConnectionPool::AcquireSession(const Server& server)
+{
+  std::unique_ptr<tds::SqlConnection> dropped;
+  tds::SqlConnection *session = nullptr;
+
+  mutex.lock();
+  Entry& entry = entryFor(server);
+  if (entry.noMars) {
+    mutex.unlock();
+    return Acquire(server);
+  }
+  if (entry.shared && !entry.shared->isAlive()) {
+    dropped = std::move(entry.shared);
+  }
+  if (entry.shared) {
+    session = entry.shared->OpenSession();
+    entry.sharedUsed = clock::now();
+  }
+  unsigned generation = entry.generation;
+  if (session != nullptr) {
+    session->setPoolGeneration(generation);
+    entry.sessions++;
+  }
+  mutex.unlock();
+
+  dropped.reset();
+  if (session != nullptr) {
+    return session;
+  }
+
+  // Log in outside of the lock. If another thread got there first, its
+  // login is used and this one is closed.
+  auto login = std::make_unique<tds::SqlConnection>(server);
+  login->setPoolGeneration(generation);
+  if (!login->Connect()) {
+    return nullptr;
+  }
+
+  mutex.lock();
+  Entry *current = entryOf(*login);
+  if (current == nullptr) {
+    // The server was forgotten while logging in.
+    mutex.unlock();
+    return nullptr;
+  }
+  if (!login->isMars()) {
+    // The server can't multiplex, hand the login out as Acquire would.
+    current->noMars = true;
+    current->inUse++;
+    mutex.unlock();
+    return login.release();
+  }
+  // A login made with settings that changed meanwhile only serves this
+  // session and is closed with it.
+  tds::SqlConnection *primary = login.get();
+  if (current->generation == generation && (!current->shared || !current->shared->isAlive())) {
+    dropped = std::move(current->shared);
+    current->shared = std::move(login);
+  }
+  if (current->generation == generation) {
+    primary = current->shared.get();
+    current->sharedUsed = clock::now();
+  }
+  session = primary->OpenSession();
+  if (session != nullptr) {
+    session->setPoolGeneration(generation);
+    current->sessions++;
+  }
+  mutex.unlock();
+
+  return session;
+}
+
+void ConnectionPool::Release(tds::SqlConnection *conn)
+{
+  std::unique_ptr<tds::SqlConnection> owned(conn);
+  if (!owned)
+    return;
+
+  mutex.lock();
+  Entry *entry = entryOf(*owned);
+  if (entry == nullptr) {
+    // The server was deleted, its settings may be gone already.
+    mutex.unlock();
+    return;
+  }
+
+  // A session is not counted against the pool, closing it just tells the
+  // server the session ended.
+  if (owned->isSession()) {
+    if (entry->sessions > 0) {
+      entry->sessions--;
+    }
+    mutex.unlock();
+    return;
+  }
+
+  if (entry->inUse > 0) {
+    entry->inUse--;
+  }
+  if (owned->isAlive() && owned->poolGeneration() == entry->generation &&
+      entry->idle.size() < maxIdle) {
+    // Whatever the last user left behind is cleared by the server when the
+    // next request arrives.
+    owned->ResetOnNextRequest();
+    entry->idle.push_back({std::move(owned), clock::now()});
+  }
+  mutex.unlock();
+
+  // A connection that wasn't kept is closed here, outside of the lock.
+}
+
+void ConnectionPool::EvictIdle()
+{
+  std::vector<std::unique_ptr<tds::SqlConnection>> expired;
+  clock::time_point now = clock::now();
+
+  mutex.lock();
+  for (auto& server : servers) {
+    // Sessions still open keep the login alive on their own.
+    Entry& entry = server.second;
+    if (entry.shared && (now - entry.sharedUsed >= idleTimeout || !entry.shared->isAlive())) {
+      expired.push_back(std::move(entry.shared));
+    }
+
+    std::vector<IdleConnection>& idle = server.second.idle;
+    for (auto it = idle.begin(); it != idle.end(); ) {
+      if (now - it->since >= idleTimeout || !it->conn->isAlive()) {
+        expired.push_back(std::move(it->conn));
+        it = idle.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  mutex.unlock();
+
+  // Expired connections are closed here, outside of the lock.
+}
+
+void ConnectionPool::CloseIdle(const Server& server)
+{
+  std::vector<IdleConnection> idle;
+  std::unique_ptr<tds::SqlConnection> shared;
+
+  mutex.lock();
+  auto it = servers.find(&server);
+  if (it != servers.end()) {
+    idle.swap(it->second.idle);
+    shared = std::move(it->second.shared);
+    it->second.noMars = false;
+    it->second.generation = ++lastGeneration;
+  }
+  mutex.unlock();
+}
+
+bool ConnectionPool::hasConnections(const Server& server)
+{
+  FXMutexLock lock(mutex);
+  auto it = servers.find(&server);
+  return it != servers.end() && (it->second.inUse > 0 || it->second.sessions > 0);
+}
+
+void ConnectionPool::Forget(const Server& server)
+{
+  Entry entry;
+
+  mutex.lock();
+  auto it = servers.find(&server);
+  if (it != servers.end()) {
+    entry = std::move(it->second);
+    servers.erase(it);
+  }
+  mutex.unlock();
+
+  // Its connections are closed here, outside of the lock.
+}
+
+void ConnectionPool::setLimits(size_t newMaxSize, size_t newMaxIdle, int idleSeconds)
+{
+  mutex.lock();
+  maxSize = newMaxSize;
+  maxIdle = newMaxIdle;
+  idleTimeout = std::chrono::seconds(idleSeconds);
+  mutex.unlock();
+}
@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <fx.h>
+
+#include "Server.h"
+#include "SqlConnection.h"
+
+// Keeps logged in connections per server so that opening a tab or running a
+// background job doesn't pay for a new TCP, TLS and login handshake.
+// Connections given back are kept warm and handed out again with the TDS
+// reset-connection bit set on their next request, which clears the session
+// state left by the previous user without logging in again.
+//
+// Short background requests (metadata, previews) can instead take a MARS
+// session with AcquireSession. All sessions to a server are multiplexed over
+// one login kept by the pool, so they cost neither a login nor a slot.
+//
+// Acquire, AcquireSession and Release may be called from any thread.
+class ConnectionPool {
+public:
+  static ConnectionPool& instance()
+  {
+    static ConnectionPool inst;
+    return inst;
+  }
+
+  // Returns a logged in connection to server, reusing an idle one when
+  // possible. Returns nullptr if maxSize connections to this server are
+  // already in use or the login failed.
+  tds::SqlConnection *Acquire(const Server& server);
+
+  // Returns a new MARS session to server over the login shared by all
+  // sessions, logging in only when there is none yet. Falls back to Acquire
+  // if the server doesn't support MARS.
+  tds::SqlConnection *AcquireSession(const Server& server);
+
+  // Give a connection back to the pool. It is kept as long as the server has
+  // fewer than maxIdle idle connections, otherwise it is closed. Sessions
+  // are always closed, opening one again is cheap, and so are connections
+  // handed out before the server's settings changed or before the pool was
+  // told to forget it.
+  void Release(tds::SqlConnection *conn);
+
+  // Close connections that have been idle for longer than the idle timeout.
+  void EvictIdle();
+
+  // Close all idle connections to a server, e.g. after its settings changed.
+  // Connections in use are closed when released instead of being kept.
+  // Sessions in use keep the shared login open until they are released.
+  void CloseIdle(const Server& server);
+
+  // True while connections or sessions to server are handed out. They
+  // refer to server, so it must not be deleted until they are released.
+  [[nodiscard]] bool hasConnections(const Server& server);
+
+  // Close all idle connections to a server that is being deleted and drop
+  // its entry, so a server later allocated at the same address starts
+  // afresh.
+  void Forget(const Server& server);
+
+  void setLimits(size_t maxSize, size_t maxIdle, int idleSeconds);
+
+private:
+  ConnectionPool() = default;
+  ConnectionPool(const ConnectionPool&) = delete;
+  void operator=(const ConnectionPool&) = delete;
+
+  using clock = std::chrono::steady_clock;
+
+  struct IdleConnection {
+    std::unique_ptr<tds::SqlConnection> conn;
+    clock::time_point since;
+  };
+
+  // Connections are tagged with the generation of their server's entry
+  // when handed out. A new generation starts when the settings change, and
+  // every entry starts with one, so a connection is only kept if it was
+  // made with the current settings of the same server.
+  struct Entry {
+    unsigned created{0};
+    unsigned generation{0};
+
+    std::vector<IdleConnection> idle;
+    size_t inUse{0};
+    size_t sessions{0};
+
+    // Login the sessions are opened over, and when one was last opened.
+    std::unique_ptr<tds::SqlConnection> shared;
+    clock::time_point sharedUsed;
+    bool noMars{false};
+  };
+
+  // The entry of server, created if there is none. mutex must be locked.
+  Entry& entryFor(const Server& server);
+
+  // The entry conn was handed out from, or nullptr if its server was
+  // forgotten since. mutex must be locked.
+  Entry *entryOf(const tds::SqlConnection& conn);
+
+  FXMutex mutex;
+  std::map<const Server *, Entry> servers;
+  unsigned lastGeneration{0};
+
+  size_t maxSize{8};
+  size_t maxIdle{2};
+  clock::duration idleTimeout{std::chrono::minutes(5)};
+};
+
+#endif // CONNECTIONPOOL_H
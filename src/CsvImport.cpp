@@ -0,0 +1,306 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "BulkRowSource.h"
+#include "ConnectionPool.h"
+#include "CsvImport.h"
+#include "CsvReader.h"
+
+namespace {
+
+// Bytes per piece of the file handed to a parser.
+constexpr size_t kChunkBytes = 4 << 20;
+
+// Parsed chunks waiting for a connection. Bounded, so parsing can't run
+// further ahead of the network than a couple of chunks per connection.
+class ChunkQueue {
+public:
+  explicit ChunkQueue(size_t capacity) : capacity{capacity} {}
+
+  // Returns false once the queue was closed.
+  bool Push(std::unique_ptr<CsvChunk> chunk)
+  {
+    FXMutexLock lock(mutex);
+    while (chunks.size() >= capacity && !closed) {
+      notFull.wait(mutex);
+    }
+    if (closed)
+      return false;
+    chunks.push_back(std::move(chunk));
+    notEmpty.signal();
+    return true;
+  }
+
+  // Returns nullptr once the queue is closed and drained.
+  std::unique_ptr<CsvChunk> Pop()
+  {
+    FXMutexLock lock(mutex);
+    while (chunks.empty() && !closed) {
+      notEmpty.wait(mutex);
+    }
+    if (chunks.empty())
+      return nullptr;
+    std::unique_ptr<CsvChunk> chunk = std::move(chunks.front());
+    chunks.pop_front();
+    notFull.signal();
+    return chunk;
+  }
+
+  // No more chunks will be pushed. With drop, chunks still queued are
+  // thrown away too.
+  void Close(bool drop)
+  {
+    FXMutexLock lock(mutex);
+    closed = true;
+    if (drop) {
+      chunks.clear();
+    }
+    notEmpty.broadcast();
+    notFull.broadcast();
+  }
+
+private:
+  FXMutex mutex;
+  FXCondition notEmpty;
+  FXCondition notFull;
+  std::deque<std::unique_ptr<CsvChunk>> chunks;
+  size_t capacity;
+  bool closed{false};
+};
+
+// Parses pieces of the file, taking the next unparsed one each time.
+class CsvParser : public FXThread {
+public:
+  CsvParser(const CsvFile& file, const std::vector<size_t>& bounds, std::atomic<size_t>& next,
+      ChunkQueue& queue, const CsvImport::Options& opts, const std::atomic<bool>& cancelled) :
+    file{file}, bounds{bounds}, next{next}, queue{queue}, opts{opts}, cancelled{cancelled}
+  {
+  }
+protected:
+  virtual FXint run()
+  {
+    for (size_t i = next++; i + 1 < bounds.size() && !cancelled; i = next++) {
+      std::unique_ptr<CsvChunk> chunk(new CsvChunk);
+      chunk->Parse(file.data(), bounds[i], bounds[i + 1], opts.delimiter,
+          opts.header && bounds[i] == 0);
+      if (!queue.Push(std::move(chunk)))
+        break;
+    }
+    return 0;
+  }
+private:
+  const CsvFile& file;
+  const std::vector<size_t>& bounds;
+  std::atomic<size_t>& next;
+  ChunkQueue& queue;
+  const CsvImport::Options& opts;
+  const std::atomic<bool>& cancelled;
+};
+
+} // namespace
+
+// Streams parsed chunks to the server over one connection.
+class CsvLoader : public FXThread, public tds::BulkRowSource {
+public:
+  CsvLoader(CsvImport& import, tds::SqlConnection *conn, ChunkQueue& queue) :
+    import{import}, conn{conn}, queue{queue}
+  {
+  }
+
+  const std::string& error() const { return message; }
+
+  bool nextRow() override
+  {
+    if (chunk && ++row < chunk->rowCount())
+      return true;
+
+    while (!import.cancelled) {
+      if (chunk) {
+        import.loadedBytes += chunk->bytes();
+        import.signal->signal();
+      }
+      chunk = queue.Pop();
+      row = 0;
+      if (!chunk)
+        return false;
+      if (chunk->rowCount() > 0)
+        return true;
+    }
+    // Wake parsers waiting for room, nobody takes their chunks any more.
+    queue.Close(true);
+    return false;
+  }
+
+  const char *value(int col, size_t *len) override
+  {
+    CsvChunk::Field field = chunk->field(row, col);
+    *len = field.len;
+    return field.text;
+  }
+
+  void onRejected(int, int) override
+  {
+    import.rejected++;
+  }
+protected:
+  virtual FXint run()
+  {
+    int rows = 0;
+    bool ok = conn->BulkInsert(import.opts.table.text(), *this, &rows);
+    import.copied += rows;
+    if (!ok) {
+      message = conn->lastError();
+      if (message.empty()) {
+        message = "Bulk load failed";
+      }
+      // Stop the others, the import is incomplete anyway.
+      import.cancelled = true;
+      queue.Close(true);
+    }
+    return 0;
+  }
+private:
+  CsvImport& import;
+  tds::SqlConnection *conn;
+  ChunkQueue& queue;
+  std::unique_ptr<CsvChunk> chunk;
+  int row{0};
+  std::string message;
+};
+
+CsvImport::CsvImport(FXApp *app, FXObject *target, FXSelector sel)
+{
+  signal = new FXGUISignal(app, target, sel);
+}
+
+CsvImport::~CsvImport()
+{
+  if (busy) {
+    cancelled = true;
+    join();
+  }
+  delete signal;
+}
+
+bool CsvImport::Start(const Server *server, const Options& options)
+{
+  if (busy)
+    return false;
+
+  srv = server;
+  opts = options;
+  succeeded = false;
+  done = false;
+  cancelled = false;
+  totalBytes = 0;
+  loadedBytes = 0;
+  copied = 0;
+  rejected = 0;
+  message.clear();
+
+  busy = true;
+  if (!start()) {
+    busy = false;
+    return false;
+  }
+  return true;
+}
+
+bool CsvImport::Finish()
+{
+  if (!busy || !done)
+    return false;
+
+  join();
+  busy = false;
+  return succeeded;
+}
+
+FXint CsvImport::run()
+{
+  CsvFile file;
+  std::vector<tds::SqlConnection *> conns;
+
+  if (!file.Open(opts.path.text())) {
+    message = "Can't open " + std::string(opts.path.text());
+  } else {
+    for (int i = 0; i < std::max(opts.connections, 1); i++) {
+      tds::SqlConnection *conn = ConnectionPool::instance().Acquire(*srv);
+      if (conn == nullptr)
+        break;
+      conns.push_back(conn);
+    }
+    if (conns.empty()) {
+      message = "Failed to connect to SQL Server";
+    }
+  }
+
+  if (message.empty()) {
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    totalBytes = file.size();
+    std::vector<size_t> bounds = file.Split(kChunkBytes, cores);
+
+    ChunkQueue queue(conns.size() * 2);
+    std::atomic<size_t> next{0};
+
+    std::vector<std::unique_ptr<CsvLoader>> loaders;
+    for (tds::SqlConnection *conn : conns) {
+      loaders.emplace_back(new CsvLoader(*this, conn, queue));
+      if (!loaders.back()->start()) {
+        loaders.pop_back();
+      }
+    }
+
+    std::vector<std::unique_ptr<CsvParser>> parsers;
+    for (unsigned i = 0; i < cores && !loaders.empty(); i++) {
+      parsers.emplace_back(new CsvParser(file, bounds, next, queue, opts, cancelled));
+      if (!parsers.back()->start()) {
+        parsers.pop_back();
+      }
+    }
+    if (parsers.empty()) {
+      message = "Failed to start the import";
+      cancelled = true;
+    }
+
+    for (auto& parser : parsers) {
+      parser->join();
+    }
+    queue.Close(cancelled);
+    for (auto& loader : loaders) {
+      loader->join();
+      if (message.empty()) {
+        message = loader->error();
+      }
+    }
+  }
+
+  for (tds::SqlConnection *conn : conns) {
+    ConnectionPool::instance().Release(conn);
+  }
+
+  succeeded = message.empty() && !cancelled;
+  done = true;
+  signal->signal();
+  return 0;
+}
@@ -0,0 +1,88 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef CSVIMPORT_H
+#define CSVIMPORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <fx.h>
+
+#include "Server.h"
+
+// Loads a CSV file into a table on a background thread. The file is mapped
+// into memory and split at record boundaries; the pieces are parsed on all
+// cores and handed to several connections that stream them to the server
+// with the bulk load protocol. CSV fields go to table columns in order.
+//
+// The target is sent SEL_IO_READ as pieces are loaded and once the import
+// has finished, which is when finished() becomes true.
+class CsvImport : public FXThread {
+public:
+  struct Options {
+    FXString path;
+    FXString table;
+    char delimiter{','};
+    bool header{true};      // first line holds column names
+    int connections{4};
+  };
+
+  CsvImport(FXApp *app, FXObject *target, FXSelector sel);
+  virtual ~CsvImport();
+
+  // Start importing into a table of server. Returns false if an import is
+  // still running.
+  bool Start(const Server *server, const Options& options);
+  bool isBusy() const { return busy; }
+
+  // Stop after the rows already handed to the server. Batches the server has
+  // committed stay in the table.
+  void Cancel() { cancelled = true; }
+
+  // Called from the GUI thread when signaled.
+  bool finished() const { return done; }
+  uint64_t bytesTotal() const { return totalBytes; }
+  uint64_t bytesLoaded() const { return loadedBytes; }
+
+  // Once finished, joins the thread and reports the outcome.
+  bool Finish();
+  int64_t rowsCopied() const { return copied; }
+  int64_t rowsRejected() const { return rejected; }
+  const std::string& error() const { return message; }
+protected:
+  virtual FXint run();
+private:
+  FXGUISignal *signal{nullptr};
+  const Server *srv{nullptr};
+  Options opts;
+  bool busy{false};
+  bool succeeded{false};
+
+  std::atomic<bool> done{false};
+  std::atomic<bool> cancelled{false};
+  std::atomic<uint64_t> totalBytes{0};
+  std::atomic<uint64_t> loadedBytes{0};
+  std::atomic<int64_t> copied{0};
+  std::atomic<int64_t> rejected{0};
+  std::string message;
+
+  friend class CsvLoader;
+};
+
+#endif // CSVIMPORT_H
@@ -0,0 +1,285 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <fx.h>
+
+#include "CsvReader.h"
+
+namespace {
+
+// Position of the first of a, b or c in [p, end), or end. Looks at 16 bytes
+// at a time where SSE2 is available.
+const char *ScanFor(const char *p, const char *end, char a, char b, char c)
+{
+#ifdef __SSE2__
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, va),
+        _mm_or_si128(_mm_cmpeq_epi8(v, vb), _mm_cmpeq_epi8(v, vc)));
+    int mask = _mm_movemask_epi8(hit);
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p < end && *p != a && *p != b && *p != c)
+    p++;
+  return p;
+}
+
+size_t CountQuotes(const char *p, const char *end)
+{
+  size_t count = 0;
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)));
+    p += 16;
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == '"')
+      count++;
+  }
+  return count;
+}
+
+class Task : public FXThread {
+public:
+  explicit Task(std::function<void()> body) : body{std::move(body)} {}
+protected:
+  virtual FXint run() { body(); return 0; }
+private:
+  std::function<void()> body;
+};
+
+// Run fn(i) for every i in [0, count) on up to threads threads.
+void ParallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& fn)
+{
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+
+  std::vector<std::unique_ptr<Task>> tasks;
+  for (unsigned i = 1; i < threads && i < count; i++) {
+    tasks.emplace_back(new Task(work));
+    if (!tasks.back()->start()) {
+      tasks.pop_back();
+      break;
+    }
+  }
+  work();
+  for (auto& task : tasks) {
+    task->join();
+  }
+}
+
+} // namespace
+
+CsvFile::~CsvFile()
+{
+  Close();
+}
+
+bool CsvFile::Open(const char *path)
+{
+  Close();
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  if (st.st_size > 0) {
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    base = static_cast<const char *>(map);
+    length = st.st_size;
+  }
+  close(fd);
+  return true;
+}
+
+void CsvFile::Close()
+{
+  if (base != nullptr) {
+    munmap(const_cast<char *>(base), length);
+    base = nullptr;
+  }
+  length = 0;
+}
+
+std::vector<size_t> CsvFile::Split(size_t chunkBytes, unsigned threads) const
+{
+  size_t pieces = length / chunkBytes + 1;
+
+  // Whether a nominal cut falls inside a quoted field follows from the
+  // number of quotes before it, which can be counted in parallel.
+  std::vector<size_t> quotes(pieces);
+  ParallelFor(pieces, threads, [&](size_t i) {
+    quotes[i] = CountQuotes(base + length * i / pieces, base + length * (i + 1) / pieces);
+  });
+
+  std::vector<size_t> bounds{0};
+  const char *end = base + length;
+  size_t seen = 0;
+  for (size_t i = 1; i < pieces; i++) {
+    seen += quotes[i - 1];
+    bool quoted = (seen & 1) != 0;
+
+    // Move the cut past the next line break outside quotes.
+    const char *p = base + length * i / pieces;
+    while (p < end) {
+      if (quoted) {
+        p = static_cast<const char *>(memchr(p, '"', end - p));
+        if (p == nullptr) {
+          p = end;
+          break;
+        }
+        quoted = false;
+        p++;
+      } else {
+        p = ScanFor(p, end, '"', '\n', '\n');
+        if (p < end && *p == '"') {
+          quoted = true;
+          p++;
+        } else {
+          p = p < end ? p + 1 : end;
+          break;
+        }
+      }
+    }
+
+    size_t cut = p - base;
+    if (cut > bounds.back() && cut < length) {
+      bounds.push_back(cut);
+    }
+  }
+  bounds.push_back(length);
+  return bounds;
+}
+
+void CsvChunk::Parse(const char *data, size_t begin, size_t end, char delimiter, bool skipFirst)
+{
+  fields.clear();
+  rows.clear();
+  unescaped.clear();
+  byteCount = end - begin;
+
+  const char *p = data + begin;
+  const char *stop = data + end;
+  bool skip = skipFirst;
+
+  while (p < stop) {
+    // Blank lines don't make rows.
+    if (*p == '\r' || *p == '\n') {
+      p++;
+      continue;
+    }
+
+    uint32_t first = static_cast<uint32_t>(fields.size());
+    rows.push_back(first);
+    for (;;) {
+      Field field{nullptr, 0};
+
+      if (*p == '"') {
+        const char *start = ++p;
+        const char *q = static_cast<const char *>(memchr(p, '"', stop - p));
+        if (q != nullptr && q + 1 < stop && q[1] == '"') {
+          // Doubled quotes, copy the value without them. The buffer is
+          // sized for the whole chunk so earlier fields never move.
+          if (unescaped.empty()) {
+            unescaped.reserve(byteCount);
+          }
+          size_t pos = unescaped.size();
+          while (q != nullptr && q + 1 < stop && q[1] == '"') {
+            unescaped.append(p, q + 1);
+            p = q + 2;
+            q = static_cast<const char *>(memchr(p, '"', stop - p));
+          }
+          const char *last = q != nullptr ? q : stop;
+          unescaped.append(p, last);
+          field = {unescaped.data() + pos, static_cast<uint32_t>(unescaped.size() - pos)};
+          p = q != nullptr ? q + 1 : stop;
+        } else {
+          const char *last = q != nullptr ? q : stop;
+          field = {start, static_cast<uint32_t>(last - start)};
+          p = q != nullptr ? q + 1 : stop;
+        }
+        // Anything between the closing quote and the delimiter is dropped.
+        p = ScanFor(p, stop, delimiter, '\r', '\n');
+      } else {
+        const char *q = ScanFor(p, stop, delimiter, '\r', '\n');
+        if (q != p) {
+          field = {p, static_cast<uint32_t>(q - p)};
+        }
+        p = q;
+      }
+      fields.push_back(field);
+
+      if (p < stop && *p == delimiter) {
+        p++;
+        if (p < stop && *p != '\r' && *p != '\n')
+          continue;
+        // A trailing delimiter ends with a NULL field.
+        fields.push_back({nullptr, 0});
+      }
+      if (p < stop && *p == '\r')
+        p++;
+      if (p < stop && *p == '\n')
+        p++;
+      break;
+    }
+
+    if (skip) {
+      fields.resize(first);
+      rows.pop_back();
+      skip = false;
+    }
+  }
+  rows.push_back(static_cast<uint32_t>(fields.size()));
+}
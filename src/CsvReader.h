@@ -0,0 +1,88 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef CSVREADER_H
+#define CSVREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A delimited text file mapped into memory. Records are separated by LF or
+// CR LF, fields may be quoted with " and a quote inside a quoted field is
+// written twice. An empty unquoted field is NULL, "" is an empty string.
+class CsvFile {
+public:
+  CsvFile() = default;
+  ~CsvFile();
+
+  CsvFile(const CsvFile&) = delete;
+  CsvFile& operator=(const CsvFile&) = delete;
+
+  bool Open(const char *path);
+  void Close();
+
+  const char *data() const { return base; }
+  size_t size() const { return length; }
+
+  // Split the file into pieces of about chunkBytes that each start at a
+  // record boundary, returned as their start offsets followed by size().
+  // Quotes are counted on up to threads threads first, so a line break in a
+  // quoted field is never taken for the end of a record.
+  std::vector<size_t> Split(size_t chunkBytes, unsigned threads) const;
+
+private:
+  const char *base{nullptr};
+  size_t length{0};
+};
+
+// The records of one piece of a CsvFile. Field text points into the mapped
+// file, or into the chunk itself for quoted fields that had to be
+// unescaped, and stays valid as long as both are around.
+class CsvChunk {
+public:
+  struct Field {
+    const char *text;   // nullptr for NULL
+    uint32_t len;
+  };
+
+  // Parse the records in [begin, end) of data. skipFirst drops the first
+  // record, e.g. a header line.
+  void Parse(const char *data, size_t begin, size_t end, char delimiter, bool skipFirst);
+
+  int rowCount() const { return static_cast<int>(rows.size()) - 1; }
+
+  // Field col of row, NULL if the row has fewer fields.
+  Field field(int row, int col) const
+  {
+    uint32_t index = rows[row] + col;
+    if (index >= rows[row + 1])
+      return {nullptr, 0};
+    return fields[index];
+  }
+
+  size_t bytes() const { return byteCount; }
+
+private:
+  std::vector<Field> fields;
+  std::vector<uint32_t> rows;     // first field of each row, then fields.size()
+  std::string unescaped;
+  size_t byteCount{0};
+};
+
+#endif // CSVREADER_H
@@ -0,0 +1,69 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include "CursorSource.h"
+
+CursorSource::CursorSource(std::unique_ptr<tds::ResultSet> layout, int pageRows, size_t maxPages) :
+  layout{std::move(layout)}, rowsPerPage{pageRows}, pages{maxPages}
+{
+}
+
+void CursorSource::AddPage(int firstRow, std::unique_ptr<tds::ResultSet> rows)
+{
+  int count = rows ? rows->rowCount() : 0;
+
+  if (firstRow + count > knownRows) {
+    knownRows = firstRow + count;
+  }
+  if (count < rowsPerPage) {
+    // Short page, this is where the cursor ends.
+    end = true;
+    knownRows = firstRow + count;
+  }
+  if (count > 0) {
+    pages.insert(firstRow / rowsPerPage, std::move(rows));
+  }
+}
+
+int CursorSource::rowCount() const
+{
+  // Until the first page is in there is nothing to show.
+  if (end || knownRows == 0)
+    return knownRows;
+  return knownRows + rowsPerPage;
+}
+
+const char *CursorSource::cellText(int row, int col, int *len)
+{
+  int page = row / rowsPerPage;
+
+  std::unique_ptr<tds::ResultSet> *rows = pages.find(page);
+  if (rows == nullptr) {
+    if (fetchHandler) {
+      fetchHandler(page * rowsPerPage);
+    }
+    *len = 0;
+    return "";
+  }
+
+  int offset = row - page * rowsPerPage;
+  if (offset >= (*rows)->rowCount()) {
+    *len = 0;
+    return "";
+  }
+  return (*rows)->cellText(offset, col, len);
+}
@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef CURSORSOURCE_H
+#define CURSORSOURCE_H
+
+#include <functional>
+#include <memory>
+
+#include "GridSource.h"
+#include "LruCache.h"
+#include "ResultSet.h"
+
+// Rows of a server cursor, held a page at a time. Only the most recently
+// used pages are kept, so browsing a table of any size uses a bounded
+// amount of memory. A page that isn't loaded is asked for through the fetch
+// handler and shows blank until AddPage delivers it.
+//
+// The total number of rows isn't known up front: the grid is told there is
+// one more page than has been seen, until a short page marks the end.
+class CursorSource : public GridSource {
+public:
+  CursorSource(std::unique_ptr<tds::ResultSet> layout, int pageRows, size_t maxPages);
+
+  // Called with the first row of a page that needs to be fetched.
+  void setFetchHandler(std::function<void(int)> handler) { fetchHandler = std::move(handler); }
+
+  // Store the page starting at firstRow.
+  void AddPage(int firstRow, std::unique_ptr<tds::ResultSet> rows);
+
+  bool isLoaded(int firstRow) { return pages.find(firstRow / rowsPerPage) != nullptr; }
+  bool atEnd() const { return end; }
+  int rowsSeen() const { return knownRows; }
+  int pageRows() const { return rowsPerPage; }
+
+  int rowCount() const override;
+  int columnCount() const override { return layout->columnCount(); }
+  const char *columnName(int col) const override { return layout->columnName(col); }
+  const char *cellText(int row, int col, int *len) override;
+
+private:
+  std::unique_ptr<tds::ResultSet> layout;
+  int rowsPerPage;
+  LruCache<int, std::unique_ptr<tds::ResultSet>> pages;
+  int knownRows{0};
+  bool end{false};
+  std::function<void(int)> fetchHandler;
+};
+
+#endif // CURSORSOURCE_H
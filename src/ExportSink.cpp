@@ -0,0 +1,213 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include <cstring>
+
+#include "ExportSink.h"
+#include "freetds/convert.h"
+
+// Bytes collected before they are written to the file.
+static constexpr size_t kWriteBuffer = 1 << 20;
+
+ExportSink::ExportSink(char delimiter) :
+  delimiter{delimiter}, buffer(kWriteBuffer)
+{
+}
+
+ExportSink::~ExportSink()
+{
+  Close();
+}
+
+bool ExportSink::Open(const char *path)
+{
+  Close();
+
+  file = fopen(path, "wb");
+  if (file == nullptr)
+    return false;
+
+  // Writes are already done in large blocks.
+  setvbuf(file, nullptr, _IONBF, 0);
+  used = 0;
+  failed = false;
+  resultSets = 0;
+  rows = 0;
+  return true;
+}
+
+bool ExportSink::Close()
+{
+  if (file == nullptr)
+    return !failed;
+
+  Flush();
+  if (fclose(file) != 0) {
+    failed = true;
+  }
+  file = nullptr;
+  return !failed;
+}
+
+void ExportSink::Flush()
+{
+  if (used > 0 && fwrite(buffer.data(), 1, used, file) != used) {
+    failed = true;
+  }
+  used = 0;
+}
+
+void ExportSink::Put(const char *s, size_t len)
+{
+  if (used + len > buffer.size()) {
+    Flush();
+    if (len > buffer.size()) {
+      if (fwrite(s, 1, len, file) != len) {
+        failed = true;
+      }
+      return;
+    }
+  }
+  memcpy(&buffer[used], s, len);
+  used += len;
+}
+
+void ExportSink::PutChar(char c)
+{
+  if (used == buffer.size()) {
+    Flush();
+  }
+  buffer[used++] = c;
+}
+
+void ExportSink::PutField(const char *s, size_t len)
+{
+  const char *end = s + len;
+
+  if (delimiter == '\t') {
+    const char *run = s;
+    for (const char *p = s; p < end; p++) {
+      char escape;
+      switch (*p) {
+        case '\t': escape = 't'; break;
+        case '\n': escape = 'n'; break;
+        case '\r': escape = 'r'; break;
+        case '\\': escape = '\\'; break;
+        default: continue;
+      }
+      Put(run, p - run);
+      PutChar('\\');
+      PutChar(escape);
+      run = p + 1;
+    }
+    Put(run, end - run);
+    return;
+  }
+
+  bool quote = false;
+  for (const char *p = s; p < end && !quote; p++) {
+    quote = *p == delimiter || *p == '"' || *p == '\n' || *p == '\r';
+  }
+  if (!quote) {
+    Put(s, len);
+    return;
+  }
+
+  PutChar('"');
+  const char *run = s;
+  for (const char *p = s; p < end; p++) {
+    if (*p == '"') {
+      Put(run, p - run + 1);
+      PutChar('"');
+      run = p + 1;
+    }
+  }
+  Put(run, end - run);
+  PutChar('"');
+}
+
+void ExportSink::onResultFormat(const TDSCONTEXT *ctx, const TDSRESULTINFO *info)
+{
+  context = ctx;
+
+  columns.clear();
+  for (int c = 0; c < info->num_cols; c++) {
+    TDSCOLUMN *col = info->columns[c];
+    int type = tds_get_conversion_type(col->column_type, col->column_size);
+    columns.push_back({type, is_blob_col(col), col->column_type != SYBVARIANT && is_char_type(type)});
+  }
+
+  if (resultSets++ > 0) {
+    PutChar('\n');
+  }
+  for (int c = 0; c < info->num_cols; c++) {
+    if (c > 0) {
+      PutChar(delimiter);
+    }
+    const DSTR *name = &info->columns[c]->column_name;
+    PutField(tds_dstr_cstr(name), tds_dstr_len(name));
+  }
+  PutChar('\n');
+}
+
+void ExportSink::onRow(const TDSRESULTINFO *info)
+{
+  for (int c = 0; c < info->num_cols; c++) {
+    TDSCOLUMN *col = info->columns[c];
+    const Column& column = columns[c];
+
+    if (c > 0) {
+      PutChar(delimiter);
+    }
+    if (col->column_cur_size < 0) {
+      continue;
+    }
+
+    const TDS_CHAR *src = reinterpret_cast<const TDS_CHAR *>(col->column_data);
+    if (column.blob) {
+      src = reinterpret_cast<const TDSBLOB *>(src)->textvalue;
+    }
+    if (column.text) {
+      PutField(src, col->column_cur_size);
+      continue;
+    }
+
+    // Numbers, dates and the like fit easily, long binary values are
+    // converted again into a buffer of the right size.
+    char text[128];
+    CONV_RESULT cr;
+    cr.cc.c = text;
+    cr.cc.len = sizeof(text);
+    TDS_INT len = tds_convert(context, column.type, src, col->column_cur_size, TDS_CONVERT_CHAR, &cr);
+    if (len < 0) {
+      continue;
+    }
+    if (static_cast<size_t>(len) <= sizeof(text)) {
+      PutField(text, len);
+      continue;
+    }
+    scratch.resize(len);
+    cr.cc.c = &scratch[0];
+    cr.cc.len = len;
+    len = tds_convert(context, column.type, src, col->column_cur_size, TDS_CONVERT_CHAR, &cr);
+    if (len > 0) {
+      PutField(scratch.data(), len);
+    }
+  }
+  PutChar('\n');
+  rows++;
+}
@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef EXPORTSINK_H
+#define EXPORTSINK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FileSink.h"
+
+// Writes results to a CSV or TSV file as ProcessResults decodes them. Rows
+// are never collected; each value is formatted into a buffer owned by the
+// sink and written out in large blocks, so memory use doesn't depend on the
+// size of the result.
+//
+// Every result set starts with a line of column names, result sets are
+// separated by an empty line. NULL is written as an empty field. With ','
+// fields are quoted as needed (RFC 4180); with '\t' tabs, line breaks and
+// backslashes in values are escaped with a backslash.
+class ExportSink : public FileSink {
+public:
+  explicit ExportSink(char delimiter);
+  ~ExportSink();
+
+  ExportSink(const ExportSink&) = delete;
+  ExportSink& operator=(const ExportSink&) = delete;
+
+  bool Open(const char *path) override;
+  bool Close() override;
+  int64_t rowCount() const override { return rows; }
+
+  void onResultFormat(const TDSCONTEXT *context, const TDSRESULTINFO *info) override;
+  void onRow(const TDSRESULTINFO *info) override;
+
+private:
+  struct Column {
+    int type;     // conversion type
+    bool blob;    // value is held in a TDSBLOB
+    bool text;    // character data, already in the client charset
+  };
+
+  void Put(const char *s, size_t len);
+  void PutChar(char c);
+  void PutField(const char *s, size_t len);
+  void Flush();
+
+  char delimiter;
+  FILE *file{nullptr};
+  std::vector<char> buffer;
+  size_t used{0};
+  bool failed{false};
+
+  const TDSCONTEXT *context{nullptr};
+  std::vector<Column> columns;
+  int resultSets{0};
+  int64_t rows{0};
+
+  // For values that don't fit the formatting buffer on the stack.
+  std::string scratch;
+};
+
+#endif // EXPORTSINK_H
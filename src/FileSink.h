@@ -0,0 +1,55 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef FILESINK_H
+#define FILESINK_H
+
+#include <cstdint>
+
+#include "RowSink.h"
+
+enum class ExportFormat {
+  Csv,
+  Tsv,
+  Arrow
+};
+
+// A RowSink that writes results to a file as ProcessResults decodes them,
+// one row at a time. Implementations only need the result formats and the
+// rows; batches, messages and the end of the results are left to whoever
+// drives the export.
+class FileSink : public tds::RowSink {
+public:
+  // Returns a new sink for format, or nullptr.
+  static FileSink *Create(ExportFormat format);
+
+  virtual bool Open(const char *path) = 0;
+
+  // Write out what is buffered and close the file. Returns false if any
+  // write failed.
+  virtual bool Close() = 0;
+
+  virtual int64_t rowCount() const = 0;
+
+  void onRowBatch(std::unique_ptr<tds::ResultSet>&) override { }
+  void onMessage(int, int, const std::string&) override { }
+  void onDone(bool) override { }
+
+  bool wantsRows() const override { return true; }
+};
+
+#endif // FILESINK_H
@@ -0,0 +1,37 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef GRIDSOURCE_H
+#define GRIDSOURCE_H
+
+// Data provider for the ResultGrid. The grid only ever asks for the cells
+// that are currently visible, so an implementation is free to keep its data
+// in whatever form is cheapest to store.
+class GridSource {
+public:
+  virtual ~GridSource() = default;
+
+  virtual int rowCount() const = 0;
+  virtual int columnCount() const = 0;
+  virtual const char *columnName(int col) const = 0;
+
+  // Returns the text for a cell and stores its length in len, or returns
+  // nullptr if the value is NULL. The pointer only needs to stay valid until
+  // the next call.
+  virtual const char *cellText(int row, int col, int *len) = 0;
+};
+
+#endif // GRIDSOURCE_H
@@ -0,0 +1,99 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// Fixed capacity map that drops the least recently used entry when full.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+  explicit LruCache(size_t capacity) : maxEntries{capacity} {}
+
+  // Returns the cached value and marks it as most recently used, or nullptr
+  // if key is not cached.
+  Value *find(const Key& key)
+  {
+    auto it = index.find(key);
+    if (it == index.end())
+      return nullptr;
+
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->second;
+  }
+
+  // Insert or replace the value for key. If this pushes out another entry,
+  // it is moved into evicted (when given) and true is returned.
+  bool insert(const Key& key, Value value, std::pair<Key, Value> *evicted = nullptr)
+  {
+    auto it = index.find(key);
+    if (it != index.end()) {
+      it->second->second = std::move(value);
+      entries.splice(entries.begin(), entries, it->second);
+      return false;
+    }
+
+    bool dropped = false;
+    if (entries.size() >= maxEntries && !entries.empty()) {
+      index.erase(entries.back().first);
+      if (evicted != nullptr) {
+        *evicted = std::move(entries.back());
+      }
+      entries.pop_back();
+      dropped = true;
+    }
+
+    entries.emplace_front(key, std::move(value));
+    index[key] = entries.begin();
+    return dropped;
+  }
+
+  bool erase(const Key& key)
+  {
+    auto it = index.find(key);
+    if (it == index.end())
+      return false;
+
+    entries.erase(it->second);
+    index.erase(it);
+    return true;
+  }
+
+  void clear()
+  {
+    entries.clear();
+    index.clear();
+  }
+
+  size_t size() const { return entries.size(); }
+  size_t capacity() const { return maxEntries; }
+
+  // Entries from most to least recently used.
+  typename std::list<std::pair<Key, Value>>::iterator begin() { return entries.begin(); }
+  typename std::list<std::pair<Key, Value>>::iterator end() { return entries.end(); }
+
+private:
+  size_t maxEntries;
+  std::list<std::pair<Key, Value>> entries;
+  std::unordered_map<Key, typename std::list<std::pair<Key, Value>>::iterator, Hash> index;
+};
+
+#endif // LRUCACHE_H
@@ -0,0 +1,566 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "Config.h"
+#include "MetadataCache.h"
+
+// Bumped whenever the layout of the saved files changes; files with any
+// other version are ignored and fetched again.
+static const char fileMagic[4] = { 'Q', 'T', 'M', 'D' };
+static const uint32_t fileVersion = 1;
+
+// Objects shown in the tree. Everything else (constraints, triggers,
+// internal tables, ...) is left out.
+static const char objectFilter[] =
+  "o.is_ms_shipped = 0 AND o.type IN ('U', 'V', 'P', 'FN', 'IF', 'TF', 'SN')";
+
+namespace {
+
+// Keeps every result set of a request in full, for the short metadata
+// queries where there is no point in streaming.
+class ResultCollector : public tds::RowSink {
+public:
+  void onResultFormat(const TDSCONTEXT *context, const TDSRESULTINFO *info) override
+  {
+    results.emplace_back(new tds::ResultSet(context, info));
+  }
+
+  void onRowBatch(std::unique_ptr<tds::ResultSet>& batch) override
+  {
+    if (!results.empty()) {
+      results.back()->Append(*batch);
+    }
+  }
+
+  void onMessage(int msgno, int severity, const std::string& text) override
+  {
+    if (severity > 10) {
+      fprintf(stderr, "Metadata query failed: %s\n", text.c_str());
+      failed = true;
+    }
+  }
+
+  void onDone(bool success) override
+  {
+    if (!success)
+      failed = true;
+  }
+
+  std::string text(int set, int row, int col) const
+  {
+    std::string out;
+    results[set]->FormatCell(row, col, out);
+    return out;
+  }
+
+  int number(int set, int row, int col) const
+  {
+    return atoi(text(set, row, col).c_str());
+  }
+
+  std::vector<std::unique_ptr<tds::ResultSet>> results;
+  bool failed{false};
+};
+
+// Builds the contents of a cache file.
+class FileWriter {
+public:
+  FileWriter()
+  {
+    buf.append(fileMagic, sizeof(fileMagic));
+    putInt(fileVersion);
+  }
+
+  void putInt(uint32_t value)
+  {
+    unsigned char b[4] = {
+      static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8),
+      static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)
+    };
+    buf.append(reinterpret_cast<const char *>(b), sizeof(b));
+  }
+
+  void putString(const std::string& s)
+  {
+    putInt(static_cast<uint32_t>(s.size()));
+    buf.append(s);
+  }
+
+  // Replace path with the contents written so far. The file is written
+  // under a temporary name first, so a crash never leaves half of it.
+  bool Save(const std::string& path) const
+  {
+    std::string temp = path + ".tmp";
+
+    FILE *fp = fopen(temp.c_str(), "wb");
+    if (fp == nullptr) {
+      fprintf(stderr, "Failed to write %s: %s\n", temp.c_str(), strerror(errno));
+      return false;
+    }
+
+    bool ok = fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+      fprintf(stderr, "Failed to write %s\n", path.c_str());
+      remove(temp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  std::string buf;
+};
+
+// Reads a cache file written by FileWriter. Every read is bounds checked;
+// once one fails all further reads fail too.
+class FileReader {
+public:
+  bool Open(const std::string& path)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+    buf = ss.str();
+
+    if (buf.size() < sizeof(fileMagic) || memcmp(buf.data(), fileMagic, sizeof(fileMagic)) != 0) {
+      return false;
+    }
+    pos = sizeof(fileMagic);
+    return getInt() == fileVersion && ok;
+  }
+
+  uint32_t getInt()
+  {
+    if (!ok || buf.size() - pos < 4) {
+      ok = false;
+      return 0;
+    }
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(buf.data()) + pos;
+    pos += 4;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24);
+  }
+
+  std::string getString()
+  {
+    uint32_t len = getInt();
+    if (!ok || buf.size() - pos < len) {
+      ok = false;
+      return std::string();
+    }
+    std::string s(buf, pos, len);
+    pos += len;
+    return s;
+  }
+
+  bool good() const { return ok; }
+
+private:
+  std::string buf;
+  size_t pos{0};
+  bool ok{true};
+};
+
+} // namespace
+
+// Turn a server or database name into something safe to use as a file
+// name, keeping it readable where possible.
+static std::string FileName(const std::string& name)
+{
+  static const char hex[] = "0123456789abcdef";
+  std::string out;
+
+  for (size_t i = 0; i < name.size(); i++) {
+    unsigned char c = name[i];
+    if (isalnum(c) || c == '-' || c == '_' || (c == '.' && i > 0)) {
+      out += static_cast<char>(c);
+    } else {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+    }
+  }
+  return out;
+}
+
+static bool MakeDir(const std::string& path)
+{
+  if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: mkdir %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+// Quote a name for use as [name] in a query.
+static std::string QuoteName(const std::string& name)
+{
+  std::string out = "[";
+  for (char c : name) {
+    out += c;
+    if (c == ']')
+      out += ']';
+  }
+  out += ']';
+  return out;
+}
+
+// Type of a column as it would be declared, from sys.columns.
+static std::string ColumnType(const std::string& type, int maxLength, int precision, int scale)
+{
+  char buf[32];
+
+  if (type == "varchar" || type == "char" || type == "varbinary" || type == "binary") {
+    if (maxLength < 0)
+      return type + "(max)";
+    snprintf(buf, sizeof(buf), "(%d)", maxLength);
+    return type + buf;
+  }
+  if (type == "nvarchar" || type == "nchar") {
+    if (maxLength < 0)
+      return type + "(max)";
+    snprintf(buf, sizeof(buf), "(%d)", maxLength / 2);
+    return type + buf;
+  }
+  if (type == "decimal" || type == "numeric") {
+    snprintf(buf, sizeof(buf), "(%d,%d)", precision, scale);
+    return type + buf;
+  }
+  if (type == "datetime2" || type == "datetimeoffset" || type == "time") {
+    snprintf(buf, sizeof(buf), "(%d)", scale);
+    return type + buf;
+  }
+  return type;
+}
+
+static bool ObjectOrder(const MetadataCache::Object& a, const MetadataCache::Object& b)
+{
+  int cmp = a.schema.compare(b.schema);
+  if (cmp != 0)
+    return cmp < 0;
+  return a.name < b.name;
+}
+
+const MetadataCache::Object *MetadataCache::Database::find(int32_t id) const
+{
+  for (const Object& object : objects) {
+    if (object.id == id)
+      return &object;
+  }
+  return nullptr;
+}
+
+std::string MetadataCache::key(const Server& server)
+{
+  std::string k = server.server.text();
+  k += ',';
+  k += std::to_string(server.port);
+  if (!server.instance.empty()) {
+    k += '\\';
+    k += server.instance.text();
+  }
+  k += ';';
+  k += server.user.text();
+  return k;
+}
+
+std::string MetadataCache::directory(const Server& server)
+{
+  return std::string(Config::instance().dir().text()) + "/metadata/" + FileName(key(server));
+}
+
+std::shared_ptr<const MetadataCache::DatabaseList> MetadataCache::databases(const Server& server)
+{
+  FXMutexLock lock(mutex);
+  auto it = servers.find(key(server));
+  if (it == servers.end())
+    return nullptr;
+  return it->second.databases;
+}
+
+std::shared_ptr<const MetadataCache::Database> MetadataCache::database(const Server& server,
+    const std::string& name)
+{
+  FXMutexLock lock(mutex);
+  auto it = servers.find(key(server));
+  if (it == servers.end())
+    return nullptr;
+
+  auto db = it->second.objects.find(name);
+  if (db == it->second.objects.end())
+    return nullptr;
+  return db->second;
+}
+
+bool MetadataCache::LoadDatabases(const Server& server)
+{
+  if (databases(server))
+    return false;
+
+  FileReader file;
+  if (!file.Open(directory(server) + "/databases.cache"))
+    return false;
+
+  auto list = std::make_shared<DatabaseList>();
+  uint32_t count = file.getInt();
+  for (uint32_t i = 0; i < count && file.good(); i++) {
+    list->push_back(file.getString());
+  }
+  if (!file.good())
+    return false;
+
+  FXMutexLock lock(mutex);
+  Entry& entry = servers[key(server)];
+  if (entry.databases)
+    return false;
+  entry.databases = list;
+  return true;
+}
+
+bool MetadataCache::Load(const Server& server, const std::string& name)
+{
+  if (database(server, name))
+    return false;
+
+  FileReader file;
+  if (!file.Open(directory(server) + "/" + FileName(name) + ".cache"))
+    return false;
+
+  auto db = std::make_shared<Database>();
+  db->modified = file.getString();
+
+  uint32_t count = file.getInt();
+  for (uint32_t i = 0; i < count && file.good(); i++) {
+    Object object;
+    object.id = static_cast<int32_t>(file.getInt());
+    object.schema = file.getString();
+    object.name = file.getString();
+    object.type = file.getString();
+    object.modified = file.getString();
+
+    uint32_t columns = file.getInt();
+    for (uint32_t c = 0; c < columns && file.good(); c++) {
+      Column column;
+      column.name = file.getString();
+      column.type = file.getString();
+      column.nullable = file.getInt() != 0;
+      object.columns.push_back(std::move(column));
+    }
+    db->objects.push_back(std::move(object));
+  }
+  if (!file.good())
+    return false;
+
+  FXMutexLock lock(mutex);
+  auto& slot = servers[key(server)].objects[name];
+  if (slot)
+    return false;
+  slot = db;
+  return true;
+}
+
+bool MetadataCache::RefreshDatabases(tds::SqlConnection& conn, bool *changed)
+{
+  const Server& server = conn.serverInfo();
+  if (changed != nullptr)
+    *changed = false;
+
+  ResultCollector results;
+  if (!conn.SubmitQuery("SELECT name FROM sys.databases "
+                        "WHERE state = 0 AND HAS_DBACCESS(name) = 1 ORDER BY name"))
+    return false;
+  conn.ProcessResults(results);
+  if (results.failed || results.results.size() != 1)
+    return false;
+
+  auto list = std::make_shared<DatabaseList>();
+  for (int row = 0; row < results.results[0]->rowCount(); row++) {
+    list->push_back(results.text(0, row, 0));
+  }
+
+  {
+    FXMutexLock lock(mutex);
+    Entry& entry = servers[key(server)];
+    if (entry.databases && *entry.databases == *list)
+      return true;
+    entry.databases = list;
+  }
+  if (changed != nullptr)
+    *changed = true;
+
+  FileWriter file;
+  file.putInt(static_cast<uint32_t>(list->size()));
+  for (const std::string& name : *list) {
+    file.putString(name);
+  }
+
+  std::string dir = directory(server);
+  if (MakeDir(std::string(Config::instance().dir().text()) + "/metadata") && MakeDir(dir)) {
+    file.Save(dir + "/databases.cache");
+  }
+  return true;
+}
+
+bool MetadataCache::Refresh(tds::SqlConnection& conn, const std::string& name, bool *changed)
+{
+  const Server& server = conn.serverInfo();
+  if (changed != nullptr)
+    *changed = false;
+
+  Load(server, name);
+  std::shared_ptr<const Database> current = database(server, name);
+
+  // Objects are fetched again from the newest modify_date seen rather than
+  // just after it; datetime ticks are coarse enough for two changes to
+  // share one.
+  std::string since = current ? current->modified : std::string("1900-01-01T00:00:00");
+  std::string db = QuoteName(name);
+  std::string filter = objectFilter;
+
+  std::string sql =
+    "SELECT o.object_id FROM " + db + ".sys.objects o WHERE " + filter + ";\n"
+    "SELECT o.object_id, s.name, o.name, RTRIM(o.type), CONVERT(varchar(23), o.modify_date, 126) "
+    "FROM " + db + ".sys.objects o JOIN " + db + ".sys.schemas s ON s.schema_id = o.schema_id "
+    "WHERE " + filter + " AND o.modify_date >= CONVERT(datetime, @since, 126);\n"
+    "SELECT c.object_id, c.name, t.name, CAST(c.max_length AS int), CAST(c.precision AS int), "
+    "CAST(c.scale AS int), CAST(c.is_nullable AS int) "
+    "FROM " + db + ".sys.columns c JOIN " + db + ".sys.objects o ON o.object_id = c.object_id "
+    "JOIN " + db + ".sys.types t ON t.user_type_id = c.user_type_id "
+    "WHERE " + filter + " AND o.modify_date >= CONVERT(datetime, @since, 126) "
+    "ORDER BY c.object_id, c.column_id";
+
+  tds::SqlParams params;
+  params.Add("@since", since);
+
+  ResultCollector results;
+  if (!conn.Execute(sql.c_str(), params))
+    return false;
+  conn.ProcessResults(results);
+  if (results.failed || results.results.size() != 3)
+    return false;
+
+  const tds::ResultSet& ids = *results.results[0];
+  const tds::ResultSet& updated = *results.results[1];
+  const tds::ResultSet& columns = *results.results[2];
+
+  std::set<int32_t> existing;
+  for (int row = 0; row < ids.rowCount(); row++) {
+    existing.insert(results.number(0, row, 0));
+  }
+
+  // Changed objects with their columns, by object_id.
+  std::map<int32_t, Object> changes;
+  for (int row = 0; row < updated.rowCount(); row++) {
+    Object object;
+    object.id = results.number(1, row, 0);
+    object.schema = results.text(1, row, 1);
+    object.name = results.text(1, row, 2);
+    object.type = results.text(1, row, 3);
+    object.modified = results.text(1, row, 4);
+    changes[object.id] = std::move(object);
+  }
+  for (int row = 0; row < columns.rowCount(); row++) {
+    auto it = changes.find(results.number(2, row, 0));
+    if (it == changes.end())
+      continue;
+
+    Column column;
+    column.name = results.text(2, row, 1);
+    column.type = ColumnType(results.text(2, row, 2), results.number(2, row, 3),
+        results.number(2, row, 4), results.number(2, row, 5));
+    column.nullable = results.number(2, row, 6) != 0;
+    it->second.columns.push_back(std::move(column));
+  }
+
+  auto next = std::make_shared<Database>();
+  bool modified = !current;
+
+  if (current) {
+    next->modified = current->modified;
+    for (const Object& object : current->objects) {
+      auto change = changes.find(object.id);
+      if (change != changes.end()) {
+        // Refetched only because it shares the last modify_date.
+        if (change->second.modified == object.modified && change->second.name == object.name &&
+            change->second.schema == object.schema &&
+            change->second.columns.size() == object.columns.size()) {
+          changes.erase(change);
+        } else {
+          continue;
+        }
+      } else if (existing.count(object.id) == 0) {
+        modified = true;
+        continue;
+      }
+      next->objects.push_back(object);
+    }
+  }
+
+  for (auto& change : changes) {
+    modified = true;
+    if (change.second.modified > next->modified)
+      next->modified = change.second.modified;
+    next->objects.push_back(std::move(change.second));
+  }
+
+  if (!modified)
+    return true;
+
+  std::sort(next->objects.begin(), next->objects.end(), ObjectOrder);
+
+  {
+    FXMutexLock lock(mutex);
+    servers[key(server)].objects[name] = next;
+  }
+  if (changed != nullptr)
+    *changed = true;
+
+  FileWriter file;
+  file.putString(next->modified);
+  file.putInt(static_cast<uint32_t>(next->objects.size()));
+  for (const Object& object : next->objects) {
+    file.putInt(static_cast<uint32_t>(object.id));
+    file.putString(object.schema);
+    file.putString(object.name);
+    file.putString(object.type);
+    file.putString(object.modified);
+    file.putInt(static_cast<uint32_t>(object.columns.size()));
+    for (const Column& column : object.columns) {
+      file.putString(column.name);
+      file.putString(column.type);
+      file.putInt(column.nullable ? 1 : 0);
+    }
+  }
+
+  std::string dir = directory(server);
+  if (MakeDir(std::string(Config::instance().dir().text()) + "/metadata") && MakeDir(dir)) {
+    file.Save(dir + "/" + FileName(name) + ".cache");
+  }
+  return true;
+}
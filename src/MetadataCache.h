@@ -0,0 +1,114 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fx.h>
+
+#include "Server.h"
+#include "SqlConnection.h"
+
+// Schema metadata of the servers in the tree: the databases of each server
+// and the tables, views and routines (with their columns) of each database.
+//
+// Everything is saved to files under Config::dir() as it is fetched, so a
+// database that was browsed before is shown straight from disk. Refreshing
+// a database only fetches the objects whose modify_date is at or after the
+// newest one already cached, plus the list of object ids to find the ones
+// that were dropped, so a revisit costs little even with 50k objects.
+//
+// Snapshots are immutable once published: a refresh builds the next one
+// while the GUI keeps reading the last. All methods may be called from any
+// thread.
+class MetadataCache {
+public:
+  static MetadataCache& instance()
+  {
+    static MetadataCache inst;
+    return inst;
+  }
+
+  struct Column {
+    std::string name;
+    std::string type;      // declared type, e.g. "nvarchar(50)"
+    bool nullable;
+  };
+
+  struct Object {
+    int32_t id;            // object_id
+    std::string schema;
+    std::string name;
+    std::string type;      // sys.objects type code, e.g. "U", "V", "P"
+    std::string modified;  // modify_date, ISO 8601
+    std::vector<Column> columns;
+  };
+
+  struct Database {
+    // Ordered by schema and name.
+    std::vector<Object> objects;
+
+    // Newest modify_date of the objects, where the next refresh starts.
+    std::string modified;
+
+    const Object *find(int32_t id) const;
+  };
+
+  using DatabaseList = std::vector<std::string>;
+
+  // Cached databases of server, or nullptr if they were never loaded.
+  std::shared_ptr<const DatabaseList> databases(const Server& server);
+
+  // Cached objects of a database of server, or nullptr if they were never
+  // loaded.
+  std::shared_ptr<const Database> database(const Server& server, const std::string& name);
+
+  // Load what was saved for server, or the database name of server, if it
+  // isn't in memory yet. Returns true if a saved copy was loaded.
+  bool LoadDatabases(const Server& server);
+  bool Load(const Server& server, const std::string& name);
+
+  // Fetch the databases of the server of conn, or the changes to database
+  // name since the last refresh, and save the result. changed is set if a
+  // new snapshot was published. Returns false if the server could not be
+  // queried, in which case the cached copy is kept.
+  bool RefreshDatabases(tds::SqlConnection& conn, bool *changed = nullptr);
+  bool Refresh(tds::SqlConnection& conn, const std::string& name, bool *changed = nullptr);
+
+private:
+  MetadataCache() = default;
+  MetadataCache(const MetadataCache&) = delete;
+  void operator=(const MetadataCache&) = delete;
+
+  struct Entry {
+    std::shared_ptr<const DatabaseList> databases;
+    std::map<std::string, std::shared_ptr<const Database>> objects;
+  };
+
+  static std::string key(const Server& server);
+  static std::string directory(const Server& server);
+
+  FXMutex mutex;
+  std::map<std::string, Entry> servers;
+};
+
+#endif // METADATACACHE_H
@@ -0,0 +1,234 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include "ConnectionPool.h"
+#include "MetadataCache.h"
+#include "MetadataWorker.h"
+
+MetadataWorker::MetadataWorker(FXApp *app, FXObject *target, FXSelector sel)
+{
+  signal = new FXGUISignal(app, target, sel);
+  start();
+}
+
+MetadataWorker::~MetadataWorker()
+{
+  {
+    FXMutexLock lock(mutex);
+    stopping = true;
+    pending.clear();
+    wake.signal();
+  }
+  join();
+  delete signal;
+}
+
+void MetadataWorker::Request(const Server *server, const std::string& database)
+{
+  FXMutexLock lock(mutex);
+  for (const Job& job : pending) {
+    if (job.server == server && job.database == database && !job.all)
+      return;
+  }
+  pending.push_back({server, database, false});
+  wake.signal();
+}
+
+void MetadataWorker::Index(const Server *server)
+{
+  FXMutexLock lock(mutex);
+  for (const Server *s : indexed) {
+    if (s == server)
+      return;
+  }
+  indexed.push_back(server);
+  pending.push_back({server, std::string(), true});
+  wake.signal();
+}
+
+std::shared_ptr<const ObjectIndex> MetadataWorker::index()
+{
+  FXMutexLock lock(mutex);
+  return built;
+}
+
+bool MetadataWorker::isIndexing()
+{
+  FXMutexLock lock(mutex);
+  return !indexed.empty() && (active != nullptr || !pending.empty() || stale);
+}
+
+void MetadataWorker::Forget(const Server *server)
+{
+  FXMutexLock lock(mutex);
+  for (auto it = pending.begin(); it != pending.end();) {
+    if (it->server == server) {
+      it = pending.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // The index is built from every server in indexed.
+  while (active == server || building) {
+    idle.wait(mutex);
+  }
+
+  for (auto it = updates.begin(); it != updates.end();) {
+    if (it->server == server) {
+      it = updates.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = indexed.begin(); it != indexed.end(); ++it) {
+    if (*it == server) {
+      indexed.erase(it);
+      stale = true;
+      wake.signal();
+      break;
+    }
+  }
+}
+
+std::vector<MetadataWorker::Update> MetadataWorker::takeUpdates()
+{
+  FXMutexLock lock(mutex);
+  std::vector<Update> taken;
+  taken.swap(updates);
+  return taken;
+}
+
+void MetadataWorker::post(const Update& update)
+{
+  {
+    FXMutexLock lock(mutex);
+    updates.push_back(update);
+    if (update.server != nullptr && !indexed.empty()) {
+      stale = true;
+    }
+  }
+  signal->signal();
+}
+
+void MetadataWorker::BuildIndex()
+{
+  std::vector<const Server *> servers;
+  {
+    FXMutexLock lock(mutex);
+    servers = indexed;
+    stale = false;
+    building = true;
+  }
+
+  auto index = ObjectIndex::Build(servers);
+
+  {
+    FXMutexLock lock(mutex);
+    built = index;
+    building = false;
+    idle.broadcast();
+  }
+  post({nullptr, std::string()});
+}
+
+// Index every database of server: the list of databases is loaded first,
+// then every database that was saved, so the index can be built from disk
+// at once. Refreshing the databases from the server is queued after that.
+void MetadataWorker::LoadAll(const Server *server)
+{
+  MetadataCache& cache = MetadataCache::instance();
+
+  auto list = cache.databases(*server);
+  if (!list)
+    return;
+
+  for (const std::string& name : *list) {
+    if (cache.Load(*server, name)) {
+      post({server, name});
+    }
+  }
+  BuildIndex();
+
+  FXMutexLock lock(mutex);
+  for (const std::string& name : *list) {
+    pending.push_back({server, name, false});
+  }
+}
+
+FXint MetadataWorker::run()
+{
+  MetadataCache& cache = MetadataCache::instance();
+
+  for (;;) {
+    Job job;
+    bool rebuild = false;
+    {
+      FXMutexLock lock(mutex);
+      while (pending.empty() && !stale && !stopping) {
+        wake.wait(mutex);
+      }
+      if (stopping)
+        break;
+
+      if (pending.empty()) {
+        rebuild = true;
+      } else {
+        job = pending.front();
+        pending.pop_front();
+        active = job.server;
+      }
+    }
+
+    // Out of requests with changes the index hasn't seen.
+    if (rebuild) {
+      BuildIndex();
+      continue;
+    }
+
+    const Server& server = *job.server;
+    bool listing = job.database.empty();
+    Update update{job.server, job.database};
+
+    // Show what was saved last time while the server is asked.
+    if (listing ? cache.LoadDatabases(server) : cache.Load(server, job.database)) {
+      post(update);
+    }
+
+    bool changed = false;
+    tds::SqlConnection *conn = ConnectionPool::instance().AcquireSession(server);
+    if (conn != nullptr) {
+      if (listing) {
+        cache.RefreshDatabases(*conn, &changed);
+      } else {
+        cache.Refresh(*conn, job.database, &changed);
+      }
+      ConnectionPool::instance().Release(conn);
+    }
+    if (changed) {
+      post(update);
+    }
+
+    if (job.all) {
+      LoadAll(job.server);
+    }
+
+    FXMutexLock lock(mutex);
+    active = nullptr;
+    idle.broadcast();
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef METADATAWORKER_H
+#define METADATAWORKER_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fx.h>
+
+#include "ObjectIndex.h"
+#include "Server.h"
+
+// Fills the MetadataCache on a background thread. Requests are queued and
+// run one after another over a pooled session. For each request the saved
+// copy is loaded first, so the tree can show it while the server is asked
+// for changes. The target is sent SEL_IO_READ whenever the cache changed
+// and picks up what changed with takeUpdates().
+//
+// The worker also keeps the ObjectIndex of the servers passed to Index up
+// to date, rebuilding it whenever it has run out of requests and the cache
+// changed since the last build.
+class MetadataWorker : public FXThread {
+public:
+  MetadataWorker(FXApp *app, FXObject *target, FXSelector sel);
+  virtual ~MetadataWorker();
+
+  struct Update {
+    const Server *server;  // nullptr when the index was rebuilt
+    std::string database;  // empty for the list of databases
+  };
+
+  // Queue loading the databases of server, or the objects of database.
+  void Request(const Server *server, const std::string& database = std::string());
+
+  // Add the objects of every database of server to the index. Whatever is
+  // saved on disk is indexed first, then each database is refreshed from
+  // the server.
+  void Index(const Server *server);
+
+  // Latest index built, nullptr before the first build.
+  std::shared_ptr<const ObjectIndex> index();
+
+  // True while databases are still being loaded for the index.
+  bool isIndexing();
+
+  // Drop the queued requests for server and wait for the running one and
+  // any index build to finish, so server can be changed or deleted. It is
+  // also dropped from the index.
+  void Forget(const Server *server);
+
+  // Called from the GUI thread when signaled.
+  std::vector<Update> takeUpdates();
+protected:
+  virtual FXint run();
+private:
+  struct Job {
+    const Server *server;
+    std::string database;
+    bool all;            // every database of server, see Index
+  };
+
+  void post(const Update& update);
+  void LoadAll(const Server *server);
+  void BuildIndex();
+
+  FXGUISignal *signal{nullptr};
+
+  FXMutex mutex;
+  FXCondition wake;
+  FXCondition idle;
+  std::deque<Job> pending;
+  std::vector<Update> updates;
+  const Server *active{nullptr};
+  bool stopping{false};
+
+  // Servers in the index, whether the cache changed since it was built,
+  // and whether it is being built from the servers in indexed.
+  std::vector<const Server *> indexed;
+  std::shared_ptr<const ObjectIndex> built;
+  bool stale{false};
+  bool building{false};
+};
+
+#endif // METADATAWORKER_H
@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <chrono>
+
+#include "ObjectFinder.h"
+
+FXDEFMAP(ObjectFinder) ObjectFinderMap[] = {
+  FXMAPFUNC(SEL_CHANGED, ObjectFinder::ID_TEXT, ObjectFinder::OnTextChanged),
+  FXMAPFUNC(SEL_KEYPRESS, ObjectFinder::ID_TEXT, ObjectFinder::OnTextKey),
+  FXMAPFUNC(SEL_DOUBLECLICKED, ObjectFinder::ID_RESULTS, ObjectFinder::OnResultOpen)
+};
+
+FXIMPLEMENT(ObjectFinder, FXDialogBox, ObjectFinderMap, ARRAYNUMBER(ObjectFinderMap))
+
+// Matches listed at most.
+static constexpr size_t kMaxResults = 50;
+
+ObjectFinder::ObjectFinder(FXWindow *owner, MetadataWorker *worker) :
+  FXDialogBox(owner, "Go to Object", DECOR_TITLE | DECOR_BORDER | DECOR_RESIZE,
+    0,0,500,360, 0,0,0,0, 0,0), worker{worker}
+{
+  FXVerticalFrame *contents = new FXVerticalFrame(this,
+      LAYOUT_SIDE_LEFT | LAYOUT_FILL_X | LAYOUT_FILL_Y,
+      0,0,0,0, 10,10,10,10);
+
+  m_text = new FXTextField(contents, 40, this, ID_TEXT,
+      FRAME_THICK | FRAME_SUNKEN | LAYOUT_FILL_X);
+
+  FXVerticalFrame *frame = new FXVerticalFrame(contents,
+      FRAME_SUNKEN | FRAME_THICK | LAYOUT_FILL_X | LAYOUT_FILL_Y, 0,0,0,0, 0,0,0,0);
+  m_results = new FXList(frame, this, ID_RESULTS,
+      LIST_BROWSESELECT | LAYOUT_FILL_X | LAYOUT_FILL_Y);
+
+  m_status = new FXLabel(contents, " ", nullptr, JUSTIFY_LEFT | LAYOUT_FILL_X);
+
+  FXHorizontalFrame *buttonframe = new FXHorizontalFrame(contents, LAYOUT_FILL_X);
+  new FXButton(buttonframe, "&Go", nullptr, this, FXDialogBox::ID_ACCEPT,
+               BUTTON_INITIAL|BUTTON_DEFAULT|FRAME_RAISED|FRAME_THICK|LAYOUT_CENTER_X, 0,0,0,0, 32,32,5,5);
+  new FXButton(buttonframe, "Cancel", nullptr, this, FXDialogBox::ID_CANCEL,
+               BUTTON_DEFAULT|FRAME_RAISED|FRAME_THICK|LAYOUT_CENTER_X, 0,0,0,0, 32,32,5,5);
+
+  index = worker->index();
+  search();
+}
+
+ObjectFinder::~ObjectFinder()
+{
+}
+
+void ObjectFinder::indexChanged()
+{
+  index = worker->index();
+  search();
+}
+
+void ObjectFinder::search()
+{
+  m_results->clearItems();
+  results.clear();
+
+  FXString status;
+  if (!index) {
+    m_status->setText("Loading object names...");
+    return;
+  }
+
+  std::string text = m_text->getText().trim().text();
+  if (!text.empty()) {
+    auto start = std::chrono::steady_clock::now();
+    results = index->Search(text, kMaxResults);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    for (const auto& entry : results) {
+      m_results->appendItem(index->label(entry));
+    }
+    if (!results.empty()) {
+      m_results->setCurrentItem(0);
+      m_results->selectItem(0);
+    }
+
+    status.format("%d matches in %.2f ms", static_cast<int>(results.size()),
+        std::chrono::duration<double, std::milli>(elapsed).count());
+  } else {
+    status.format("%d names indexed", static_cast<int>(index->size()));
+  }
+
+  if (worker->isIndexing()) {
+    status += ", still loading...";
+  }
+  m_status->setText(status);
+}
+
+long ObjectFinder::OnTextChanged(FXObject*, FXSelector, void*)
+{
+  search();
+  return 1;
+}
+
+// Up and down move through the matches without leaving the text field.
+long ObjectFinder::OnTextKey(FXObject*, FXSelector, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+  FXint count = m_results->getNumItems();
+  FXint current = m_results->getCurrentItem();
+
+  switch (ev->code) {
+    case KEY_Up:
+      if (current > 0) {
+        m_results->setCurrentItem(current - 1);
+        m_results->selectItem(current - 1);
+        m_results->makeItemVisible(current - 1);
+      }
+      return 1;
+    case KEY_Down:
+      if (current + 1 < count) {
+        m_results->setCurrentItem(current + 1);
+        m_results->selectItem(current + 1);
+        m_results->makeItemVisible(current + 1);
+      }
+      return 1;
+    case KEY_Return:
+    case KEY_KP_Enter:
+      return OnResultOpen(nullptr, 0, nullptr);
+    default:
+      return 0;
+  }
+}
+
+long ObjectFinder::OnResultOpen(FXObject*, FXSelector, void*)
+{
+  if (m_results->getCurrentItem() >= 0) {
+    handle(this, FXSEL(SEL_COMMAND, FXDialogBox::ID_ACCEPT), nullptr);
+  }
+  return 1;
+}
+
+bool ObjectFinder::selection(std::shared_ptr<const ObjectIndex>& from, ObjectIndex::Entry& entry) const
+{
+  FXint current = m_results->getCurrentItem();
+  if (current < 0 || current >= static_cast<FXint>(results.size()))
+    return false;
+
+  from = index;
+  entry = results[current];
+  return true;
+}
@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef OBJECTFINDER_H
+#define OBJECTFINDER_H
+
+#include <memory>
+#include <vector>
+
+#include <fx.h>
+
+#include "MetadataWorker.h"
+#include "ObjectIndex.h"
+
+// The "Go to object" box. Every keystroke searches the ObjectIndex built by
+// the MetadataWorker and lists the best matches; nothing is sent to the
+// servers while typing.
+class ObjectFinder : public FXDialogBox {
+  FXDECLARE(ObjectFinder)
+public:
+  ObjectFinder(FXWindow *owner, MetadataWorker *worker);
+  virtual ~ObjectFinder();
+
+  enum {
+    ID_TEXT = FXDialogBox::ID_LAST,
+    ID_RESULTS,
+    ID_LAST
+  };
+
+  long OnTextChanged(FXObject*, FXSelector, void*);
+  long OnTextKey(FXObject*, FXSelector, void*);
+  long OnResultOpen(FXObject*, FXSelector, void*);
+
+  // Called when the worker has built a new index, to search it again.
+  void indexChanged();
+
+  // The chosen match once execute() returned true, and the index it is an
+  // entry of. Returns false if nothing was chosen.
+  bool selection(std::shared_ptr<const ObjectIndex>& from, ObjectIndex::Entry& entry) const;
+
+private:
+  ObjectFinder() = default;
+
+  void search();
+
+  MetadataWorker *worker{nullptr};
+  std::shared_ptr<const ObjectIndex> index;
+  std::vector<ObjectIndex::Entry> results;
+
+  FXTextField *m_text;
+  FXList *m_results;
+  FXLabel *m_status;
+};
+
+#endif // OBJECTFINDER_H
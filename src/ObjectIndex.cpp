@@ -0,0 +1,277 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+
+#include "ObjectIndex.h"
+
+// Names are looked at in order, shortest first, and the search stops once
+// this many matched. It bounds the time a search over a very common
+// trigram takes, at the cost of long names that only match it.
+static constexpr size_t kMaxNames = 2000;
+
+static std::string Lower(const std::string& s)
+{
+  std::string out(s);
+  for (char& c : out) {
+    c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  }
+  return out;
+}
+
+// Unique trigrams of s, as 24 bit keys. Names are indexed with two blanks
+// in front, so the first one or two characters of a name form trigrams of
+// their own and a short search can still match prefixes.
+static void Trigrams(const std::string& s, std::vector<uint32_t>& out)
+{
+  out.clear();
+  for (size_t i = 0; i + 3 <= s.size(); i++) {
+    out.push_back(static_cast<uint32_t>(static_cast<unsigned char>(s[i])) << 16 |
+                  static_cast<uint32_t>(static_cast<unsigned char>(s[i + 1])) << 8 |
+                  static_cast<unsigned char>(s[i + 2]));
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+static const char *TypeName(const std::string& type)
+{
+  if (type == "U")
+    return "table";
+  if (type == "V")
+    return "view";
+  if (type == "P")
+    return "procedure";
+  if (type == "SN")
+    return "synonym";
+  return "function";
+}
+
+std::shared_ptr<const ObjectIndex> ObjectIndex::Build(const std::vector<const Server *>& servers)
+{
+  MetadataCache& cache = MetadataCache::instance();
+  auto index = std::make_shared<ObjectIndex>();
+
+  struct Named {
+    std::string name;
+    Entry entry;
+  };
+  std::vector<Named> all;
+
+  for (const Server *server : servers) {
+    auto list = cache.databases(*server);
+    if (!list)
+      continue;
+
+    for (const std::string& name : *list) {
+      auto snapshot = cache.database(*server, name);
+      if (!snapshot)
+        continue;
+
+      auto db = static_cast<int32_t>(index->databases.size());
+      index->databases.push_back({server, server->name, name, snapshot});
+
+      for (size_t i = 0; i < snapshot->objects.size(); i++) {
+        const auto& object = snapshot->objects[i];
+        all.push_back({Lower(object.name), {db, static_cast<int32_t>(i), -1}});
+        for (size_t c = 0; c < object.columns.size(); c++) {
+          all.push_back({Lower(object.columns[c].name),
+              {db, static_cast<int32_t>(i), static_cast<int32_t>(c)}});
+        }
+      }
+    }
+  }
+
+  // Shortest names first; objects before the columns of the same name.
+  std::sort(all.begin(), all.end(), [](const Named& a, const Named& b) {
+    if (a.name.size() != b.name.size())
+      return a.name.size() < b.name.size();
+    int cmp = a.name.compare(b.name);
+    if (cmp != 0)
+      return cmp < 0;
+    return (a.entry.column >= 0) < (b.entry.column >= 0);
+  });
+
+  index->entries.reserve(all.size());
+  for (size_t i = 0; i < all.size(); i++) {
+    if (i == 0 || all[i].name != all[i - 1].name) {
+      index->nameEntries.push_back(static_cast<uint32_t>(index->entries.size()));
+      index->nameOffsets.push_back(static_cast<uint32_t>(index->names.size()));
+      index->names += all[i].name;
+    }
+    index->entries.push_back(all[i].entry);
+  }
+  index->nameEntries.push_back(static_cast<uint32_t>(index->entries.size()));
+  index->nameOffsets.push_back(static_cast<uint32_t>(index->names.size()));
+  all.clear();
+  all.shrink_to_fit();
+
+  // Trigram and name pairs, sorted into one posting list per trigram.
+  std::vector<uint64_t> pairs;
+  std::vector<uint32_t> trigrams;
+  uint32_t numNames = static_cast<uint32_t>(index->nameOffsets.size() - 1);
+  for (uint32_t n = 0; n < numNames; n++) {
+    std::string padded = "  ";
+    padded.append(index->names, index->nameOffsets[n], index->nameOffsets[n + 1] - index->nameOffsets[n]);
+    Trigrams(padded, trigrams);
+    for (uint32_t key : trigrams) {
+      pairs.push_back(static_cast<uint64_t>(key) << 32 | n);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  index->postings.reserve(pairs.size());
+  for (size_t i = 0; i < pairs.size(); i++) {
+    auto key = static_cast<uint32_t>(pairs[i] >> 32);
+    if (i == 0 || key != index->keys.back()) {
+      index->keys.push_back(key);
+      index->keyOffsets.push_back(static_cast<uint32_t>(i));
+    }
+    index->postings.push_back(static_cast<uint32_t>(pairs[i]));
+  }
+  index->keyOffsets.push_back(static_cast<uint32_t>(pairs.size()));
+
+  return index;
+}
+
+const std::string& ObjectIndex::nameOf(const Entry& entry) const
+{
+  const auto& object = databases[entry.database].snapshot->objects[entry.object];
+  return entry.column < 0 ? object.name : object.columns[entry.column].name;
+}
+
+std::vector<ObjectIndex::Entry> ObjectIndex::Search(const std::string& text, size_t limit) const
+{
+  std::vector<Entry> results;
+
+  std::string query = Lower(text);
+  std::string qualifier;
+  size_t dot = query.rfind('.');
+  if (dot != std::string::npos) {
+    qualifier = query.substr(0, dot);
+    query.erase(0, dot + 1);
+  }
+  if (query.empty())
+    return results;
+
+  std::vector<uint32_t> trigrams;
+  Trigrams(query.size() < 3 ? "  " + query : query, trigrams);
+
+  struct Span {
+    const uint32_t *begin;
+    const uint32_t *end;
+  };
+  std::vector<Span> spans;
+  for (uint32_t key : trigrams) {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it == keys.end() || *it != key)
+      return results;
+    size_t k = it - keys.begin();
+    spans.push_back({postings.data() + keyOffsets[k], postings.data() + keyOffsets[k + 1]});
+  }
+  std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+    return a.end - a.begin < b.end - b.begin;
+  });
+
+  struct Match {
+    uint32_t name;
+    int rank;
+    size_t pos;
+  };
+  std::vector<Match> matches;
+
+  for (const uint32_t *p = spans[0].begin; p != spans[0].end && matches.size() < kMaxNames; p++) {
+    bool all = true;
+    for (size_t s = 1; s < spans.size() && all; s++) {
+      all = std::binary_search(spans[s].begin, spans[s].end, *p);
+    }
+    if (!all)
+      continue;
+
+    std::string_view name(names.data() + nameOffsets[*p], nameOffsets[*p + 1] - nameOffsets[*p]);
+    size_t pos = name.find(query);
+    size_t len = name.size();
+
+    int rank;
+    if (pos == 0 && len == query.size()) {
+      rank = 0;
+    } else if (pos == 0) {
+      rank = 1;
+    } else if (pos != std::string::npos) {
+      rank = 2;
+    } else {
+      // Every trigram is there, but not in one piece.
+      rank = 3;
+    }
+    matches.push_back({*p, rank, pos});
+  }
+
+  // Names are numbered shortest first, which breaks the remaining ties.
+  std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+    if (a.rank != b.rank)
+      return a.rank < b.rank;
+    if (a.pos != b.pos)
+      return a.pos < b.pos;
+    return a.name < b.name;
+  });
+
+  for (const Match& match : matches) {
+    for (uint32_t e = nameEntries[match.name]; e < nameEntries[match.name + 1]; e++) {
+      const Entry& entry = entries[e];
+      if (!qualifier.empty()) {
+        const auto& object = databases[entry.database].snapshot->objects[entry.object];
+        const std::string& owner = entry.column < 0 ? object.schema : object.name;
+        if (Lower(owner).compare(0, qualifier.size(), qualifier) != 0)
+          continue;
+      }
+
+      results.push_back(entry);
+      if (results.size() >= limit)
+        return results;
+    }
+  }
+  return results;
+}
+
+FXString ObjectIndex::label(const Entry& entry) const
+{
+  const Database& db = databases[entry.database];
+  const auto& object = db.snapshot->objects[entry.object];
+
+  FXString label;
+  if (entry.column < 0) {
+    label = object.schema.c_str();
+    label += ".";
+    label += object.name.c_str();
+    label += " (";
+    label += TypeName(object.type);
+    label += ")";
+  } else {
+    label = nameOf(entry).c_str();
+    label += " (column of ";
+    label += object.schema.c_str();
+    label += ".";
+    label += object.name.c_str();
+    label += ")";
+  }
+  label += " - ";
+  label += db.name.c_str();
+  label += " - ";
+  label += db.serverName;
+  return label;
+}
@@ -0,0 +1,98 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef OBJECTINDEX_H
+#define OBJECTINDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fx.h>
+
+#include "MetadataCache.h"
+#include "Server.h"
+
+// Trigram index over the names of the tables, views, routines and columns
+// held in the MetadataCache, for finding objects by a few typed characters.
+//
+// Names are indexed once however many objects share them (every database
+// has its "id" columns), each distinct name listing the objects and
+// columns that carry it. The trigrams of the names are kept as one sorted
+// array of posting lists, so a search is a few binary searches and an
+// intersection, and never touches the server. An index is immutable once
+// built and holds on to the snapshots it was built from.
+class ObjectIndex {
+public:
+  struct Entry {
+    int32_t database;    // see server() and database()
+    int32_t object;      // index into the objects of the snapshot
+    int32_t column;      // index into the columns of the object, -1 for the object
+  };
+
+  // Index the objects and columns of every cached database of servers.
+  static std::shared_ptr<const ObjectIndex> Build(const std::vector<const Server *>& servers);
+
+  // Entries whose name matches text, best first: exact matches, then
+  // prefixes, then other substrings, shorter names and objects before
+  // columns. Text shorter than three characters only matches prefixes. A
+  // "schema." or "table." before the name narrows objects by their schema
+  // and columns by their table.
+  std::vector<Entry> Search(const std::string& text, size_t limit) const;
+
+  // Text to list an entry with, e.g. "name  (column of dbo.t) - db - server".
+  FXString label(const Entry& entry) const;
+
+  const Server *server(const Entry& entry) const { return databases[entry.database].server; }
+  const std::string& database(const Entry& entry) const { return databases[entry.database].name; }
+  const MetadataCache::Object& object(const Entry& entry) const
+  {
+    return databases[entry.database].snapshot->objects[entry.object];
+  }
+
+  size_t size() const { return entries.size(); }
+
+private:
+  struct Database {
+    const Server *server;
+    FXString serverName;
+    std::string name;
+    std::shared_ptr<const MetadataCache::Database> snapshot;
+  };
+
+  const std::string& nameOf(const Entry& entry) const;
+
+  std::vector<Database> databases;
+
+  // Entries grouped by name; the entries named names[n] are
+  // entries[nameEntries[n] .. nameEntries[n + 1]).
+  std::vector<Entry> entries;
+  std::vector<uint32_t> nameEntries;
+
+  // Distinct lower case names, shortest first, stored back to back: name n
+  // is names[nameOffsets[n] .. nameOffsets[n + 1]).
+  std::string names;
+  std::vector<uint32_t> nameOffsets;
+
+  // Names containing trigram keys[i] are postings[keyOffsets[i] ..
+  // keyOffsets[i + 1]), in ascending order.
+  std::vector<uint32_t> keys;
+  std::vector<uint32_t> keyOffsets;
+  std::vector<uint32_t> postings;
+};
+
+#endif // OBJECTINDEX_H
@@ -0,0 +1,482 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <algorithm>
+
+#include "ObjectTree.h"
+
+// Folders the objects of a database are grouped into, by sys.objects type.
+struct ObjectFolder {
+  const char *label;
+  const char *types;   // space separated
+};
+
+static const ObjectFolder objectFolders[] = {
+  { "Tables", "U" },
+  { "Views", "V" },
+  { "Stored Procedures", "P" },
+  { "Functions", "FN IF TF" },
+  { "Synonyms", "SN" }
+};
+
+static bool inFolder(int folder, const std::string& type)
+{
+  std::string types = std::string(" ") + objectFolders[folder].types + " ";
+  return types.find(" " + type + " ") != std::string::npos;
+}
+
+ObjectTree::ObjectTree()
+{
+  rows.push_back({RootNode, 0, true, 0, -1, -1, -1});
+}
+
+const char *ObjectTree::folderLabel(int folder)
+{
+  return objectFolders[folder].label;
+}
+
+FXString ObjectTree::label(int index) const
+{
+  const Row& r = rows[index];
+
+  switch (r.kind) {
+    case RootNode:
+      return "Servers";
+    case ServerNode: {
+      const Server *server = servers[r.owner];
+      FXString label = server->name + " (";
+      label += server->user;
+      label += ")";
+      return label;
+    }
+    case DatabaseNode:
+      return databases[r.owner].name.c_str();
+    case FolderNode:
+      return folderLabel(r.folder);
+    case ObjectNode: {
+      const auto& object = databases[r.owner].snapshot->objects[r.object];
+      FXString label = object.schema.c_str();
+      label += ".";
+      label += object.name.c_str();
+      return label;
+    }
+    case ColumnNode: {
+      const auto& column = databases[r.owner].snapshot->objects[r.object].columns[r.column];
+      FXString label = column.name.c_str();
+      label += " (";
+      label += column.type.c_str();
+      label += column.nullable ? ", null)" : ", not null)";
+      return label;
+    }
+  }
+  return FXString();
+}
+
+bool ObjectTree::hasChildren(int index) const
+{
+  const Row& r = rows[index];
+
+  switch (r.kind) {
+    case ObjectNode:
+      return !databases[r.owner].snapshot->objects[r.object].columns.empty();
+    case ColumnNode:
+      return false;
+    default:
+      // Not known until expanded.
+      return true;
+  }
+}
+
+int ObjectTree::parentOf(int index) const
+{
+  int depth = rows[index].depth;
+  while (--index >= 0) {
+    if (rows[index].depth < depth)
+      return index;
+  }
+  return -1;
+}
+
+int ObjectTree::subtreeEnd(int index) const
+{
+  int depth = rows[index].depth;
+  int end = index + 1;
+  while (end < rowCount() && rows[end].depth > depth) {
+    end++;
+  }
+  return end;
+}
+
+void ObjectTree::Insert(int at, const std::vector<Row>& children)
+{
+  rows.insert(rows.begin() + at, children.begin(), children.end());
+  if (currentRow >= at) {
+    currentRow += static_cast<int>(children.size());
+  }
+}
+
+void ObjectTree::Erase(int first, int last)
+{
+  rows.erase(rows.begin() + first, rows.begin() + last);
+  if (currentRow >= last) {
+    currentRow -= last - first;
+  } else if (currentRow >= first) {
+    currentRow = first - 1;
+  }
+}
+
+void ObjectTree::Expand(int index)
+{
+  const Row& r = rows[index];
+  if (r.expanded)
+    return;
+
+  MetadataCache& cache = MetadataCache::instance();
+  const uint8_t depth = r.depth + 1;
+  std::vector<Row> children;
+
+  switch (r.kind) {
+    case RootNode:
+      for (size_t i = 0; i < servers.size(); i++) {
+        if (servers[i] != nullptr) {
+          children.push_back({ServerNode, depth, false, 0, static_cast<int32_t>(i), -1, -1});
+        }
+      }
+      break;
+    case ServerNode: {
+      int32_t server = r.owner;
+      auto list = cache.databases(*servers[server]);
+      if (list) {
+        for (const std::string& name : *list) {
+          children.push_back({DatabaseNode, depth, false, 0, databaseSlot(server, name), -1, -1});
+        }
+      }
+      break;
+    }
+    case DatabaseNode: {
+      // Nothing below refers to the old snapshot while collapsed.
+      DatabaseSlot& slot = databases[r.owner];
+      slot.snapshot = cache.database(*servers[slot.server], slot.name);
+      for (int f = 0; f < static_cast<int>(ARRAYNUMBER(objectFolders)); f++) {
+        children.push_back({FolderNode, depth, false, static_cast<uint8_t>(f), r.owner, -1, -1});
+      }
+      break;
+    }
+    case FolderNode: {
+      const auto& snapshot = databases[r.owner].snapshot;
+      if (snapshot) {
+        const auto& objects = snapshot->objects;
+        for (size_t i = 0; i < objects.size(); i++) {
+          if (inFolder(r.folder, objects[i].type)) {
+            children.push_back({ObjectNode, depth, false, 0, r.owner, static_cast<int32_t>(i), -1});
+          }
+        }
+      }
+      break;
+    }
+    case ObjectNode: {
+      const auto& columns = databases[r.owner].snapshot->objects[r.object].columns;
+      for (size_t c = 0; c < columns.size(); c++) {
+        children.push_back({ColumnNode, depth, false, 0, r.owner, r.object, static_cast<int32_t>(c)});
+      }
+      break;
+    }
+    case ColumnNode:
+      return;
+  }
+
+  rows[index].expanded = true;
+  Insert(index + 1, children);
+}
+
+void ObjectTree::Collapse(int index)
+{
+  if (!rows[index].expanded)
+    return;
+
+  Erase(index + 1, subtreeEnd(index));
+  rows[index].expanded = false;
+}
+
+ObjectTree::Key ObjectTree::keyOf(int index) const
+{
+  const Row& r = rows[index];
+  Key key{r.kind, r.owner, 0, 0};
+
+  switch (r.kind) {
+    case FolderNode:
+      key.folder = r.folder;
+      break;
+    case ObjectNode:
+      key.id = databases[r.owner].snapshot->objects[r.object].id;
+      break;
+    case ColumnNode:
+      key.folder = r.column;
+      key.id = databases[r.owner].snapshot->objects[r.object].id;
+      break;
+    default:
+      break;
+  }
+  return key;
+}
+
+void ObjectTree::Rebuild(int index)
+{
+  if (!rows[index].expanded)
+    return;
+
+  int end = subtreeEnd(index);
+  std::vector<Key> expanded;
+  for (int i = index + 1; i < end; i++) {
+    if (rows[i].expanded) {
+      expanded.push_back(keyOf(i));
+    }
+  }
+
+  bool selected = currentRow > index && currentRow < end;
+  Key current{};
+  if (selected) {
+    current = keyOf(currentRow);
+  }
+
+  Collapse(index);
+  Expand(index);
+
+  // Rows inserted by an expansion are visited next, so nested expansions
+  // are restored in the same pass.
+  int depth = rows[index].depth;
+  for (int i = index + 1; i < rowCount() && rows[i].depth > depth; i++) {
+    Key key = keyOf(i);
+    if (std::find(expanded.begin(), expanded.end(), key) != expanded.end()) {
+      Expand(i);
+    }
+    if (selected && key == current) {
+      currentRow = i;
+    }
+  }
+}
+
+int ObjectTree::serverSlot(const Server *server) const
+{
+  auto it = std::find(servers.begin(), servers.end(), server);
+  if (it == servers.end())
+    return -1;
+  return static_cast<int>(it - servers.begin());
+}
+
+int ObjectTree::serverRow(const Server *server) const
+{
+  int slot = serverSlot(server);
+  if (slot < 0)
+    return -1;
+
+  for (int i = 0; i < rowCount(); i++) {
+    if (rows[i].kind == ServerNode && rows[i].owner == slot)
+      return i;
+  }
+  return -1;
+}
+
+int ObjectTree::databaseSlot(int server, const std::string& name)
+{
+  auto key = std::make_pair(static_cast<int32_t>(server), name);
+  auto it = databaseSlots.find(key);
+  if (it != databaseSlots.end())
+    return it->second;
+
+  int32_t slot = static_cast<int32_t>(databases.size());
+  databases.push_back({server, name, nullptr});
+  databaseSlots[key] = slot;
+  return slot;
+}
+
+void ObjectTree::DropDatabases(int server)
+{
+  for (auto it = databaseSlots.begin(); it != databaseSlots.end();) {
+    if (it->first.first == server) {
+      DatabaseSlot& slot = databases[it->second];
+      slot.server = -1;
+      slot.snapshot.reset();
+      it = databaseSlots.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void ObjectTree::AddServer(Server *server)
+{
+  servers.push_back(server);
+  if (rows[0].expanded) {
+    int32_t slot = static_cast<int32_t>(servers.size() - 1);
+    Insert(rowCount(), { {ServerNode, 1, false, 0, slot, -1, -1} });
+  }
+}
+
+void ObjectTree::RemoveServer(const Server *server)
+{
+  int slot = serverSlot(server);
+  if (slot < 0)
+    return;
+
+  int row = serverRow(server);
+  if (row >= 0) {
+    int end = subtreeEnd(row);
+    if (currentRow >= row && currentRow < end) {
+      currentRow = -1;
+    }
+    Erase(row, end);
+  }
+
+  DropDatabases(slot);
+  servers[slot] = nullptr;
+}
+
+void ObjectTree::ResetServer(const Server *server)
+{
+  int row = serverRow(server);
+  if (row >= 0) {
+    Collapse(row);
+  }
+  DropDatabases(serverSlot(server));
+}
+
+Server *ObjectTree::serverOf(int index) const
+{
+  const Row& r = rows[index];
+
+  switch (r.kind) {
+    case RootNode:
+      return nullptr;
+    case ServerNode:
+      return servers[r.owner];
+    default:
+      return servers[databases[r.owner].server];
+  }
+}
+
+const std::string& ObjectTree::databaseOf(int index) const
+{
+  static const std::string none;
+
+  const Row& r = rows[index];
+  if (r.kind == RootNode || r.kind == ServerNode)
+    return none;
+  return databases[r.owner].name;
+}
+
+int ObjectTree::childOf(int index, Kind kind, int32_t owner, int32_t value) const
+{
+  int end = subtreeEnd(index);
+  int depth = rows[index].depth + 1;
+
+  for (int i = index + 1; i < end; i++) {
+    const Row& r = rows[i];
+    if (r.depth != depth || r.kind != kind || r.owner != owner)
+      continue;
+    if ((kind == FolderNode && r.folder == value) || (kind == ObjectNode && r.object == value) ||
+        (kind == ColumnNode && r.column == value) || kind == DatabaseNode)
+      return i;
+  }
+  return -1;
+}
+
+int ObjectTree::Reveal(const Server *server, const std::string& database, int32_t objectId,
+    const std::string& column)
+{
+  Expand(0);
+  int row = serverRow(server);
+  if (row < 0)
+    return -1;
+  currentRow = row;
+
+  Expand(row);
+  auto slot = databaseSlots.find(std::make_pair(static_cast<int32_t>(serverSlot(server)), database));
+  if (slot == databaseSlots.end())
+    return row;
+  int db = childOf(row, DatabaseNode, slot->second, 0);
+  if (db < 0)
+    return row;
+  currentRow = db;
+
+  // Expanding the database takes the latest snapshot.
+  Expand(db);
+  const auto& snapshot = databases[slot->second].snapshot;
+  if (!snapshot)
+    return db;
+
+  const auto& objects = snapshot->objects;
+  int32_t object = -1;
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (objects[i].id == objectId) {
+      object = static_cast<int32_t>(i);
+      break;
+    }
+  }
+  if (object < 0)
+    return db;
+
+  int folder = 0;
+  while (folder < static_cast<int>(ARRAYNUMBER(objectFolders)) && !inFolder(folder, objects[object].type)) {
+    folder++;
+  }
+  row = childOf(db, FolderNode, slot->second, folder);
+  if (row < 0)
+    return db;
+
+  Expand(row);
+  row = childOf(row, ObjectNode, slot->second, object);
+  if (row < 0)
+    return db;
+  currentRow = row;
+
+  if (!column.empty()) {
+    const auto& columns = objects[object].columns;
+    for (size_t c = 0; c < columns.size(); c++) {
+      if (columns[c].name == column) {
+        Expand(row);
+        int child = childOf(row, ColumnNode, slot->second, static_cast<int32_t>(c));
+        if (child >= 0) {
+          currentRow = child;
+        }
+        break;
+      }
+    }
+  }
+  return currentRow;
+}
+
+void ObjectTree::DatabasesChanged(const Server *server)
+{
+  int row = serverRow(server);
+  if (row >= 0) {
+    Rebuild(row);
+  }
+}
+
+void ObjectTree::ObjectsChanged(const Server *server, const std::string& database)
+{
+  auto it = databaseSlots.find(std::make_pair(static_cast<int32_t>(serverSlot(server)), database));
+  if (it == databaseSlots.end())
+    return;
+
+  for (int i = 0; i < rowCount(); i++) {
+    if (rows[i].kind == DatabaseNode && rows[i].owner == it->second) {
+      Rebuild(i);
+      return;
+    }
+  }
+}
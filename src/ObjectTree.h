@@ -0,0 +1,159 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef OBJECTTREE_H
+#define OBJECTTREE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fx.h>
+
+#include "MetadataCache.h"
+#include "Server.h"
+
+// Model behind the ServerTreeList: the servers, their databases and the
+// objects and columns of each database, flattened to the lines that can
+// currently be seen, i.e. whose parents are all expanded.
+//
+// A line is a Row of a few indices into the servers and the MetadataCache
+// snapshots; its text is only built when it is painted. Expanding a folder
+// of 40k tables therefore adds 40k small rows to one array, and nothing is
+// created for the children of a line until it is expanded.
+class ObjectTree {
+public:
+  enum Kind : uint8_t {
+    RootNode,
+    ServerNode,
+    DatabaseNode,
+    FolderNode,
+    ObjectNode,
+    ColumnNode
+  };
+
+  struct Row {
+    Kind kind;
+    uint8_t depth;
+    bool expanded;
+    uint8_t folder;    // folder of folder rows, see folderLabel
+    int32_t owner;     // server slot of server rows, database slot below
+    int32_t object;    // index into the objects of the database snapshot
+    int32_t column;    // index into the columns of the object
+  };
+
+  ObjectTree();
+
+  int rowCount() const { return static_cast<int>(rows.size()); }
+  const Row& row(int index) const { return rows[index]; }
+
+  // Text to show for a row.
+  FXString label(int index) const;
+
+  // False for rows that are known to have no children.
+  bool hasChildren(int index) const;
+
+  // Row of the parent of a row, -1 for the root.
+  int parentOf(int index) const;
+
+  // Insert the children of a row below it, or remove them.
+  void Expand(int index);
+  void Collapse(int index);
+
+  // Selected row, -1 for none. Kept on the same line as rows are inserted
+  // and removed above it.
+  int current() const { return currentRow; }
+  void setCurrent(int index) { currentRow = index; }
+
+  void AddServer(Server *server);
+  void RemoveServer(const Server *server);
+
+  // Forget everything loaded below server, e.g. after its settings changed.
+  void ResetServer(const Server *server);
+
+  // Server and database a row belongs to; nullptr and empty for rows above.
+  Server *serverOf(int index) const;
+  const std::string& databaseOf(int index) const;
+
+  // Expand the lines down to an object of database of server, or to its
+  // column if column isn't empty, and make it current. Returns its row,
+  // or the row of the deepest line that could be found, or -1.
+  int Reveal(const Server *server, const std::string& database, int32_t objectId,
+      const std::string& column = std::string());
+
+  // Rebuild the lines below server, or below database of server, from the
+  // MetadataCache, keeping expanded what was expanded.
+  void DatabasesChanged(const Server *server);
+  void ObjectsChanged(const Server *server, const std::string& database);
+
+  static const char *folderLabel(int folder);
+
+private:
+  struct DatabaseSlot {
+    int32_t server;    // -1 once the server was reset or removed
+    std::string name;
+    std::shared_ptr<const MetadataCache::Database> snapshot;
+  };
+
+  // Identifies an expanded row across a rebuild.
+  struct Key {
+    Kind kind;
+    int32_t owner;
+    int32_t folder;    // folder, or column index of column rows
+    int32_t id;        // object_id of object and column rows
+
+    bool operator==(const Key& other) const
+    {
+      return kind == other.kind && owner == other.owner && folder == other.folder && id == other.id;
+    }
+  };
+
+  int serverRow(const Server *server) const;
+  int serverSlot(const Server *server) const;
+  int databaseSlot(int server, const std::string& name);
+
+  // Detach the database slots of a server, so they aren't used for it
+  // again.
+  void DropDatabases(int server);
+
+  // One past the last row below index.
+  int subtreeEnd(int index) const;
+
+  // Child of index of the given kind, folder, object or column, -1 if it
+  // isn't there.
+  int childOf(int index, Kind kind, int32_t owner, int32_t value) const;
+
+  Key keyOf(int index) const;
+  void Insert(int at, const std::vector<Row>& children);
+  void Erase(int first, int last);
+
+  // Collapse and expand index again, then expand the rows below it that
+  // were expanded before.
+  void Rebuild(int index);
+
+  std::vector<Row> rows;
+
+  // Slots referred to by rows. Slots are never reused, a removed server
+  // leaves nullptr behind.
+  std::vector<Server *> servers;
+  std::vector<DatabaseSlot> databases;
+  std::map<std::pair<int32_t, std::string>, int32_t> databaseSlots;
+  int currentRow{-1};
+};
+
+#endif // OBJECTTREE_H
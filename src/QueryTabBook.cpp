@@ -34,21 +34,67 @@ void QueryTabBook::AddTab(const FXString& label, tds::SqlConnection *conn)
   newTab->show();
 }
 
-void QueryTabBook::ExecuteActiveTabQuery()
+QueryTabItem *QueryTabBook::ActiveTab()
 {
   // Get current tab
   int tabIndex = this->getCurrent();
   if (tabIndex == -1) {
     // No selected tab
-    return;
+    return nullptr;
   }
 
-  auto *item = static_cast<QueryTabItem *>(this->childAtIndex(tabIndex * 2));
+  // Each tab item is followed by its content frame.
+  return static_cast<QueryTabItem *>(this->childAtIndex(tabIndex * 2));
+}
+
+void QueryTabBook::ExecuteActiveTabQuery()
+{
+  QueryTabItem *item = ActiveTab();
   if (item == nullptr) {
     fprintf(stderr, "Failed to find query tab, can't run query!\n");
     return;
   }
 
-  printf("Running a query on %d... %s\n", tabIndex, item->getText().text());
+  printf("Running a query on %d... %s\n", getCurrent(), item->getText().text());
   item->ExecuteQuery();
 }
+
+void QueryTabBook::BrowseActiveTabQuery()
+{
+  QueryTabItem *item = ActiveTab();
+  if (item != nullptr) {
+    item->BrowseQuery();
+  }
+}
+
+void QueryTabBook::ExportActiveTabQuery(const FXString& path, ExportFormat format)
+{
+  QueryTabItem *item = ActiveTab();
+  if (item != nullptr) {
+    item->ExportQuery(path, format);
+  }
+}
+
+void QueryTabBook::CancelActiveTabQuery()
+{
+  QueryTabItem *item = ActiveTab();
+  if (item != nullptr) {
+    item->CancelQuery();
+  }
+}
+
+void QueryTabBook::CloseActiveTab()
+{
+  QueryTabItem *item = ActiveTab();
+  if (item == nullptr)
+    return;
+
+  // Remove the content frame that follows the tab item as well.
+  delete item->getNext();
+  delete item;
+
+  if (numChildren() > 0) {
+    setCurrent(0);
+  }
+  recalc();
+}
@@ -31,6 +31,15 @@ public:
 
   void AddTab(const FXString& label, tds::SqlConnection *conn);
   void ExecuteActiveTabQuery();
+  void BrowseActiveTabQuery();
+  void ExportActiveTabQuery(const FXString& path, ExportFormat format);
+  void CancelActiveTabQuery();
+
+  // Close the selected tab and release its connection.
+  void CloseActiveTab();
+
+  // Returns the selected tab, or nullptr if there is none.
+  QueryTabItem *ActiveTab();
 private:
   QueryTabBook() = default;
 };
@@ -14,16 +14,20 @@
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 //
 
+#include "ConnectionPool.h"
 #include "QueryTabItem.h"
-#include "freetds/convert.h"
 
 FXDEFMAP(QueryTabItem) queryTabItemMap[] = {
-  FXMAPFUNC(SEL_COMMAND, tds::SqlConnection::ID_ROW_HEADER, QueryTabItem::OnRowHeaderRead),
-  FXMAPFUNC(SEL_COMMAND, tds::SqlConnection::ID_ROW_READ, QueryTabItem::OnRowRead)
+  FXMAPFUNC(SEL_IO_READ, QueryTabItem::ID_QUERY_EVENT, QueryTabItem::OnQueryEvent),
+  FXMAPFUNC(SEL_TIMEOUT, QueryTabItem::ID_QUERY_TIMEOUT, QueryTabItem::OnQueryTimeout)
 };
 
 FXIMPLEMENT(QueryTabItem, FXTabItem, queryTabItemMap, ARRAYNUMBER(queryTabItemMap))
 
+// Rows per cursor fetch and the number of fetched pages kept in memory.
+static constexpr int kBrowsePageRows = 500;
+static constexpr size_t kBrowsePages = 16;
+
 QueryTabItem::QueryTabItem(FXTabBook *tabbook, const FXString& label, tds::SqlConnection *conn) :
   FXTabItem(tabbook, label, nullptr), parent(tabbook), conn{conn}
 {
@@ -41,7 +45,7 @@ QueryTabItem::QueryTabItem(FXTabBook *tabbook, const FXString& label, tds::SqlCo
 
   statusBar = new FXStatusBar(frame, LAYOUT_FILL_X);
 
-  conn->setTarget(this);
+  worker = new QueryWorker(getApp(), conn, this, ID_QUERY_EVENT);
 #if 0
   // if query executed
   queryFrame = new FXVerticalFrame(splitter, FRAME_SUNKEN | FRAME_THICK |
@@ -96,8 +100,33 @@ QueryTabItem::QueryTabItem(FXTabBook *tabbook, const FXString& label, tds::SqlCo
 #endif
 }
 
+QueryTabItem::~QueryTabItem()
+{
+  getApp()->removeTimeout(this, ID_QUERY_TIMEOUT);
+  worker->Cancel();
+  delete worker;
+
+  // The worker has finished with the connection, hand it back for reuse.
+  ConnectionPool::instance().Release(conn);
+}
+
 void QueryTabItem::ExecuteQuery()
 {
+  StartQuery(false);
+}
+
+void QueryTabItem::BrowseQuery()
+{
+  StartQuery(true);
+}
+
+void QueryTabItem::StartQuery(bool browse)
+{
+  if (worker->isBusy()) {
+    statusBar->getStatusLine()->setNormalText("A query is already running");
+    return;
+  }
+
   printf("Executing %s\n", text->getText().text());
 
 
@@ -108,24 +137,30 @@ void QueryTabItem::ExecuteQuery()
     child->destroy();
     delete child;
   }
-  resultTable = nullptr;
+  resultGrid = nullptr;
+  results.clear();
+  cursorSource.reset();
+  browsing = browse;
+  fetchingRow = -1;
+  pendingRow = -1;
+  rowCount = 0;
+  cancelling = false;
 
   queryFrame->show();
 
   statusBar->getStatusLine()->setNormalText("Executing query");
 
-  // submit to freetds
-  conn->SubmitQuery(text->getText().text());
-  conn->ProcessResults();
-
-  if (resultTable != nullptr) {
-    printf("Row items: %d\n", resultTable->getRowHeader()->getNumItems());
-    printf("Col items: %d\n", resultTable->getColumnHeader()->getNumItems());
+  // submit to freetds, results arrive through OnQueryEvent
+  bool started = browse ? worker->Browse(text->getText(), kBrowsePageRows) :
+    worker->Execute(text->getText());
+  if (!started) {
+    statusBar->getStatusLine()->setNormalText("Failed to start query");
+    return;
   }
 
-  printf("After process results\n");
-
-  statusBar->getStatusLine()->setNormalText("Done!");
+  if (queryTimeout > 0) {
+    getApp()->addTimeout(this, ID_QUERY_TIMEOUT, queryTimeout * 1000);
+  }
 
 #if 0
   if (resultTable != nullptr) {
@@ -155,85 +190,158 @@ void QueryTabItem::ExecuteQuery()
 
 }
 
-long QueryTabItem::OnRowHeaderRead(FX::FXObject *, FX::FXSelector, void *data)
+void QueryTabItem::ExportQuery(const FXString& path, ExportFormat format)
 {
-  auto *resultInfo = static_cast<TDSRESULTINFO *>(data);
-
-  resultTable = new FXTable(queryFrame,nullptr,0,TABLE_COL_SIZABLE|LAYOUT_FILL_X|LAYOUT_FILL_Y,0,0,0,0, 2,2,2,2);
-
-  // Remove row header
-  //resultTable->setRowHeaderMode(LAYOUT_FIX_WIDTH);
-  resultTable->setRowHeaderMode(LAYOUT_MIN_WIDTH);
-  resultTable->setRowHeaderWidth(0);
-  resultTable->setTableSize(0,resultInfo->num_cols);
+  if (worker->isBusy()) {
+    statusBar->getStatusLine()->setNormalText("A query is already running");
+    return;
+  }
 
+  cancelling = false;
+  exporting = true;
+  statusBar->getStatusLine()->setNormalText("Exporting to " + path);
 
-  resultTable->setBackColor(FXRGB(255,255,255));
-  resultTable->setCellColor(0,0,FXRGB(255,255,255));
-  resultTable->setCellColor(0,1,FXRGB(255,240, 240));
-  resultTable->setCellColor(1,0,FXRGB(240, 255, 240));
-  resultTable->setCellColor(1,1,FXRGB(240, 240, 255));
+  if (!worker->Export(text->getText(), path, format)) {
+    exporting = false;
+    statusBar->getStatusLine()->setNormalText("Failed to start query");
+    return;
+  }
 
-  for(int c=0; c<resultInfo->num_cols; c++){
-    resultTable->setColumnText(c, tds_dstr_cstr(&resultInfo->columns[c]->column_name));
+  if (queryTimeout > 0) {
+    getApp()->addTimeout(this, ID_QUERY_TIMEOUT, queryTimeout * 1000);
   }
+}
 
-  resultTable->create();
-  resultTable->show();
+void QueryTabItem::CancelQuery()
+{
+  if (!worker->isBusy() || cancelling)
+    return;
 
+  cancelling = true;
+  statusBar->getStatusLine()->setNormalText("Cancelling query");
+  worker->Cancel();
+}
 
+long QueryTabItem::OnQueryTimeout(FX::FXObject *, FX::FXSelector, void *)
+{
+  if (!worker->isBusy() || cancelling)
+    return 1;
 
+  CancelQuery();
+  timedOut = true;
+  statusBar->getStatusLine()->setNormalText("Query timed out after " + FXStringVal(queryTimeout) + " seconds, cancelling");
+  return 1;
+}
 
-  queryFrame->layout();
-  queryFrame->recalc();
-  queryFrame->update();
+long QueryTabItem::OnQueryEvent(FX::FXObject *, FX::FXSelector, void *)
+{
+  for (QueryWorker::Event& event : worker->takeEvents()) {
+    switch (event.type) {
+      case QueryWorker::ResultFormat:
+        OnResultFormat(event.results.release());
+        break;
+      case QueryWorker::Rows:
+        if (event.row >= 0) {
+          OnPage(event.row, std::move(event.results));
+        } else {
+          OnRows(*event.results);
+        }
+        break;
+      case QueryWorker::Message:
+        statusBar->getStatusLine()->setNormalText(event.message.c_str());
+        break;
+      case QueryWorker::Done:
+        printf("After process results\n");
+        getApp()->removeTimeout(this, ID_QUERY_TIMEOUT);
+        fetchingRow = -1;
+        if (exporting) {
+          // The outcome was posted as the last message.
+          exporting = false;
+        } else if (browsing) {
+          FXString status = "Browsing, " + FXStringVal(rowCount) + " rows";
+          if (cursorSource && !cursorSource->atEnd())
+            status += " so far";
+          statusBar->getStatusLine()->setNormalText(status);
+          if (pendingRow >= 0 && !cancelling) {
+            RequestPage(pendingRow);
+          }
+          pendingRow = -1;
+        } else if (timedOut) {
+          statusBar->getStatusLine()->setNormalText("Query timed out after " + FXStringVal(queryTimeout) +
+              " seconds, " + FXStringVal(rowCount) + " rows");
+        } else if (cancelling) {
+          statusBar->getStatusLine()->setNormalText("Query cancelled, " + FXStringVal(rowCount) + " rows");
+        } else {
+          statusBar->getStatusLine()->setNormalText("Done! " + FXStringVal(rowCount) + " rows");
+        }
+        cancelling = false;
+        timedOut = false;
+        break;
+    }
+  }
 
   return 1;
 }
 
-long QueryTabItem::OnRowRead(FX::FXObject *, FX::FXSelector, void *data)
+void QueryTabItem::OnResultFormat(tds::ResultSet *resultSet)
 {
-  auto *resultInfo = static_cast<TDSRESULTINFO *>(data);
-
-  //int col = resultTable->getNumColumns();
-  int row = resultTable->getNumRows();
-  printf("Num row: %d\n", row);
+  resultGrid = new ResultGrid(queryFrame, LAYOUT_FILL_X | LAYOUT_FILL_Y);
+  if (browsing) {
+    cursorSource.reset(new CursorSource(std::unique_ptr<tds::ResultSet>(resultSet),
+          kBrowsePageRows, kBrowsePages));
+    cursorSource->setFetchHandler([this](int firstRow) { RequestPage(firstRow); });
+    resultGrid->setSource(cursorSource.get());
+  } else {
+    results.emplace_back(resultSet);
+    resultGrid->setSource(resultSet);
+  }
 
+  resultGrid->create();
+  resultGrid->show();
 
+  queryFrame->layout();
+  queryFrame->recalc();
+  queryFrame->update();
+}
 
-  resultTable->insertRows(row);
-  resultTable->setRowText(row,FXStringVal(row));
+void QueryTabItem::OnRows(const tds::ResultSet& batch)
+{
+  if (results.empty())
+    return;
 
-  for(int c=0; c<resultInfo->num_cols; c++){
+  results.back()->Append(batch);
+  rowCount += batch.rowCount();
+  resultGrid->rowsChanged();
+  statusBar->getStatusLine()->setNormalText("Executing query, " + FXStringVal(rowCount) + " rows");
+}
 
-    auto *col = resultInfo->columns[c];
-    if (col->column_cur_size < 0) {
-      resultTable->setItemText(row,c,"NULL");
-      continue;
-    }
+void QueryTabItem::OnPage(int firstRow, std::unique_ptr<tds::ResultSet> page)
+{
+  if (!cursorSource)
+    return;
 
-    int ctype = tds_get_conversion_type(col->column_type, col->column_size);
+  cursorSource->AddPage(firstRow, std::move(page));
+  rowCount = cursorSource->rowsSeen();
+  resultGrid->rowsChanged();
+}
 
-    unsigned char *src = col->column_data;
-    if (is_blob_col(col) && col->column_type != SYBVARIANT) {
-      src = (unsigned char *) ((TDSBLOB *) src)->textvalue;
-    }
-    int srclen = col->column_cur_size;
-
-    CONV_RESULT dres;
-    if (tds_convert(conn->getContext(), ctype, src, srclen, SYBVARCHAR, &dres) < 0)
-      continue;
-    resultTable->setItemText(row,c,dres.c);
-    if (strlen(dres.c) > 20) {
-      int width = resultTable->getColumnWidth(c);
-      if (width < 200) {
-        resultTable->setColumnWidth(c, width * 2);
-      }
-    }
-    free(dres.c);
+void QueryTabItem::RequestPage(int firstRow)
+{
+  // The grid asks for a missing page once for every cell it paints, only
+  // the first of those fetches it. While another page is on its way, the
+  // latest request wins.
+  if (firstRow == fetchingRow || cursorSource->isLoaded(firstRow))
+    return;
+
+  if (worker->isBusy()) {
+    pendingRow = firstRow;
+    return;
   }
 
-  return 1;
+  if (worker->Fetch(firstRow)) {
+    fetchingRow = firstRow;
+    statusBar->getStatusLine()->setNormalText("Fetching rows " + FXStringVal(firstRow + 1));
+  }
 }
 
 void QueryTabItem::create()
@@ -17,8 +17,14 @@
 #ifndef QUERYTABITEM_H
 #define QUERYTABITEM_H
 
+#include <memory>
+#include <vector>
+
 #include <fx.h>
 
+#include "CursorSource.h"
+#include "QueryWorker.h"
+#include "ResultGrid.h"
 #include "SqlConnection.h"
 
 // A FXTabItem is rather simple, and is essentially just a label. New controls
@@ -29,17 +35,44 @@ class QueryTabItem : public FXTabItem {
   FXDECLARE(QueryTabItem)
 public:
   QueryTabItem(FXTabBook *tabbook, const FXString& label, tds::SqlConnection *conn);
-  virtual ~QueryTabItem() = default;
+  virtual ~QueryTabItem();
 
   virtual void create();
 
+  tds::SqlConnection *connection() const { return conn; }
+
   void ExecuteQuery();
+  void CancelQuery();
+
+  // Run the query through a server cursor and page its rows in as they are
+  // scrolled to, rather than reading the whole result.
+  void BrowseQuery();
+
+  // Run the query and write its results to a CSV or TSV file instead of
+  // the grid.
+  void ExportQuery(const FXString& path, ExportFormat format);
+
+  // Seconds after which a running query is cancelled, 0 for no limit.
+  void setQueryTimeout(int seconds) { queryTimeout = seconds; }
+  int getQueryTimeout() const { return queryTimeout; }
 
-  long OnRowHeaderRead(FXObject*,FXSelector,void*);
-  long OnRowRead(FXObject*,FXSelector,void*);
+  long OnQueryEvent(FXObject*,FXSelector,void*);
+  long OnQueryTimeout(FXObject*,FXSelector,void*);
+
+  enum {
+    ID_QUERY_EVENT = FXTabItem::ID_LAST,
+    ID_QUERY_TIMEOUT,
+    ID_LAST
+  };
 private:
   QueryTabItem() = default;
 
+  void StartQuery(bool browse);
+  void OnResultFormat(tds::ResultSet *resultSet);
+  void OnRows(const tds::ResultSet& batch);
+  void OnPage(int firstRow, std::unique_ptr<tds::ResultSet> page);
+  void RequestPage(int firstRow);
+
   FXTabBook *parent;
   FXText *text;
 
@@ -48,9 +81,25 @@ private:
   FXStatusBar *statusBar;
 
   FXVerticalFrame *queryFrame{nullptr};
-  FXTable *resultTable{nullptr};
+  ResultGrid *resultGrid{nullptr};
+
+  // Result sets of the last query, in the order they were received.
+  std::vector<std::unique_ptr<tds::ResultSet>> results;
+
+  // Pages of the cursor being browsed, the page being fetched and the one
+  // to fetch next (-1 for none).
+  std::unique_ptr<CursorSource> cursorSource;
+  bool browsing{false};
+  int fetchingRow{-1};
+  int pendingRow{-1};
 
   tds::SqlConnection *conn;
+  QueryWorker *worker{nullptr};
+  int rowCount{0};
+  int queryTimeout{0};
+  bool cancelling{false};
+  bool timedOut{false};
+  bool exporting{false};
 };
 
 #endif // QUERYTABITEM_H
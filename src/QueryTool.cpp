@@ -21,16 +21,30 @@
 #include "QueryTool.h"
 #include "QueryTabItem.h"
 
+#include "ConnectionPool.h"
 #include "SqlConnection.h"
 
+// How often idle pooled connections are checked for expiry, in milliseconds.
+static const FXuint POOL_EVICT_INTERVAL = 60 * 1000;
+
 FXDEFMAP(QueryTool) queryToolMap[] = {
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_ABOUT, QueryTool::OnCommandAbout),
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_CONNECT, QueryTool::OnCommandConnect),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_DISCONNECT, QueryTool::OnCommandDisconnect),
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_PREFERENCES, QueryTool::OnCommandPreferences),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_FIND_OBJECT, QueryTool::OnCommandFindObject),
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_QUIT, QueryTool::OnCommandQuit),
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_QUERY_RUN, QueryTool::OnCommandQueryRun),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_QUERY_BROWSE, QueryTool::OnCommandQueryBrowse),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_QUERY_EXPORT, QueryTool::OnCommandQueryExport),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_QUERY_CANCEL, QueryTool::OnCommandQueryCancel),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_QUERY_TIMEOUT, QueryTool::OnCommandQueryTimeout),
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_TEST_QUERY, QueryTool::OnCommandTestQuery),
   FXMAPFUNC(SEL_COMMAND, QueryTool::ID_TEST_QUERY_TABLE, QueryTool::OnCommandTestQueryTable),
+  FXMAPFUNC(SEL_TIMEOUT, QueryTool::ID_POOL_EVICT, QueryTool::OnPoolEvict),
+  FXMAPFUNC(SEL_IO_READ, QueryTool::ID_CONNECT_DONE, QueryTool::OnConnectDone),
+  FXMAPFUNC(SEL_COMMAND, QueryTool::ID_IMPORT_CSV, QueryTool::OnCommandImportCsv),
+  FXMAPFUNC(SEL_IO_READ, QueryTool::ID_IMPORT_EVENT, QueryTool::OnImportEvent),
   FXMAPFUNC(SEL_COMMAND, ServerTreeList::ID_CONNECT, QueryTool::OnServerListConnect)
 };
 
@@ -49,18 +63,25 @@ QueryTool::QueryTool(FXApp *app) :
   m_file_disconnect = new FXMenuCommand(menuPanes[0], "Disconnect", nullptr,
       this, ID_DISCONNECT);
   m_file_disconnect->disable();
+  m_file_import = new FXMenuCommand(menuPanes[0], "Import CSV...", nullptr, this, ID_IMPORT_CSV);
+  m_file_import->disable();
   m_file_sep = new FXMenuSeparator(menuPanes[0]);
   m_file_quit = new FXMenuCommand(menuPanes[0], "Quit\tCtrl-Q", nullptr, this, ID_QUIT);
   menuTitle[0] = new FXMenuTitle(menuBar, "&File", nullptr, menuPanes[0]);
 
   // Edit menu
   menuPanes[1] = new FXMenuPane(this);
+  m_edit_find = new FXMenuCommand(menuPanes[1], "Go to Object...\tCtrl-T", nullptr, this, ID_FIND_OBJECT);
   m_edit_pref = new FXMenuCommand(menuPanes[1], "&Preferences", nullptr, this, ID_PREFERENCES);
   menuTitle[1] = new FXMenuTitle(menuBar, "&Edit", nullptr, menuPanes[1]);
 
   // Query menu
   menuPanes[2] = new FXMenuPane(this);
   m_query_run = new FXMenuCommand(menuPanes[2], "Run Query\tF5", nullptr, this, ID_QUERY_RUN);
+  m_query_browse = new FXMenuCommand(menuPanes[2], "Browse Query\tCtrl-F5", nullptr, this, ID_QUERY_BROWSE);
+  m_query_export = new FXMenuCommand(menuPanes[2], "Export Query...\tCtrl-E", nullptr, this, ID_QUERY_EXPORT);
+  m_query_cancel = new FXMenuCommand(menuPanes[2], "Cancel Query\tShift-F5", nullptr, this, ID_QUERY_CANCEL);
+  m_query_timeout = new FXMenuCommand(menuPanes[2], "Query Timeout...", nullptr, this, ID_QUERY_TIMEOUT);
   menuTitle[2] = new FXMenuTitle(menuBar, "Query", nullptr, menuPanes[2]);
 
   // Help menu
@@ -83,10 +104,17 @@ QueryTool::QueryTool(FXApp *app) :
   tabBook = new QueryTabBook(queryFrame);
 
   treeList = new ServerTreeList(srvFrame, this);
+
+  connector = new ConnectWorker(app, this, ID_CONNECT_DONE);
+  importer = new CsvImport(app, this, ID_IMPORT_EVENT);
 }
 
 QueryTool::~QueryTool()
 {
+  getApp()->removeTimeout(this, ID_POOL_EVICT);
+  delete connector;
+  delete importer;
+
   for (auto pane : menuPanes) {
     delete pane;
   }
@@ -99,6 +127,8 @@ QueryTool::create()
 {
   FXMainWindow::create();
 
+  getApp()->addTimeout(this, ID_POOL_EVICT, POOL_EVICT_INTERVAL);
+
   show(PLACEMENT_SCREEN);
 }
 
@@ -132,11 +162,31 @@ long QueryTool::OnServerListConnect(FXObject*, FXSelector, void *data)
 {
   Server *server = static_cast<Server *>(data);
 
-  // We need to make sure we can make a connection before creating a query tab.
+  // We need to make sure we can make a connection before creating a query
+  // tab. Connecting happens in the background, the tab is added once the
+  // login has finished.
+  if (!connector->Connect(server)) {
+    getApp()->beep();
+    return 1;
+  }
+
   printf("Making connection to %s\n", server->server.text());
+  server->connecting = true;
+  getApp()->beginWaitCursor();
+  return 1;
+}
+
+long QueryTool::OnConnectDone(FXObject*, FXSelector, void *)
+{
+  if (!connector->isBusy())
+    return 1;
+
+  getApp()->endWaitCursor();
 
-  auto *connection = new tds::SqlConnection(*server);
-  if (! connection->Connect()) {
+  Server *server = connector->server();
+  tds::SqlConnection *connection = connector->takeConnection();
+  server->connecting = false;
+  if (connection == nullptr) {
    FXMessageBox::error(this, MBOX_OK, "QueryTool", "Failed to connect to SQL Server");
    return 1;
   }
@@ -144,12 +194,95 @@ long QueryTool::OnServerListConnect(FXObject*, FXSelector, void *data)
   printf("Connected!\n");
 
   tabBook->AddTab(server->name + " (" + server->user + ")", connection);
+  m_file_disconnect->enable();
+  m_file_import->enable();
 
   return 1;
 }
 
 long QueryTool::OnCommandDisconnect(FXObject*, FXSelector, void*)
 {
+  // Closing the tab gives its connection back to the pool.
+  tabBook->CloseActiveTab();
+  if (tabBook->ActiveTab() == nullptr) {
+    m_file_disconnect->disable();
+    m_file_import->disable();
+  }
+  return 1;
+}
+
+long QueryTool::OnCommandImportCsv(FXObject*, FXSelector, void*)
+{
+  QueryTabItem *item = tabBook->ActiveTab();
+  if (item == nullptr || importer->isBusy()) {
+    getApp()->beep();
+    return 1;
+  }
+
+  FXString path = FXFileDialog::getOpenFilename(this, "Import CSV", FXString::null,
+      "CSV Files (*.csv,*.txt)\nAll Files (*)");
+  if (path.empty())
+    return 1;
+
+  CsvImport::Options options;
+  options.path = path;
+  if (!FXInputDialog::getString(options.table, this, "Import CSV", "Destination table:") ||
+      options.table.empty())
+    return 1;
+  options.header = FXMessageBox::question(this, MBOX_YES_NO, "Import CSV",
+      "Does the first line hold the column names?") == MBOX_CLICKED_YES;
+
+  // The import uses connections of its own, the tab stays usable.
+  if (!importer->Start(&item->connection()->serverInfo(), options)) {
+    FXMessageBox::error(this, MBOX_OK, "Import CSV", "Failed to start the import");
+    return 1;
+  }
+
+  importProgress = new FXProgressDialog(this, "Import CSV", "Importing " + FXPath::name(path),
+      PROGRESSDIALOG_NORMAL | PROGRESSDIALOG_CANCEL);
+  importProgress->setTotal(1000);
+  importProgress->create();
+  importProgress->show(PLACEMENT_OWNER);
+  return 1;
+}
+
+long QueryTool::OnImportEvent(FXObject*, FXSelector, void*)
+{
+  if (!importer->isBusy())
+    return 1;
+
+  if (!importer->finished()) {
+    if (importProgress->isCancelled()) {
+      importProgress->setMessage("Cancelling...");
+      importer->Cancel();
+    } else if (importer->bytesTotal() > 0) {
+      importProgress->setProgress(static_cast<FXuint>(importer->bytesLoaded() * 1000 / importer->bytesTotal()));
+    }
+    return 1;
+  }
+
+  delete importProgress;
+  importProgress = nullptr;
+
+  bool ok = importer->Finish();
+  FXString summary = FXStringVal(static_cast<FXlong>(importer->rowsCopied())) + " rows copied";
+  if (importer->rowsRejected() > 0) {
+    summary += ", " + FXStringVal(static_cast<FXlong>(importer->rowsRejected())) + " rows rejected";
+  }
+  if (ok) {
+    FXMessageBox::information(this, MBOX_OK, "Import CSV", "%s.", summary.text());
+  } else if (!importer->error().empty()) {
+    FXMessageBox::error(this, MBOX_OK, "Import CSV", "%s\n\n%s.", importer->error().c_str(), summary.text());
+  } else {
+    FXMessageBox::warning(this, MBOX_OK, "Import CSV", "Import cancelled, %s.", summary.text());
+  }
+  return 1;
+}
+
+long QueryTool::OnPoolEvict(FXObject*, FXSelector, void*)
+{
+  ConnectionPool::instance().EvictIdle();
+  getApp()->addTimeout(this, ID_POOL_EVICT, POOL_EVICT_INTERVAL);
   return 1;
 }
 
@@ -158,6 +291,12 @@ long QueryTool::OnCommandPreferences(FXObject*, FXSelector, void*)
   return 1;
 }
 
+long QueryTool::OnCommandFindObject(FXObject*, FXSelector, void*)
+{
+  treeList->FindObject();
+  return 1;
+}
+
 long QueryTool::OnCommandQuit(FXObject*, FXSelector, void*)
 {
   getApp()->exit(0);
@@ -170,6 +309,54 @@ long QueryTool::OnCommandQueryRun(FXObject*, FXSelector, void*)
   return 1;
 }
 
+long QueryTool::OnCommandQueryBrowse(FXObject*, FXSelector, void*)
+{
+  tabBook->BrowseActiveTabQuery();
+  return 1;
+}
+
+long QueryTool::OnCommandQueryExport(FXObject*, FXSelector, void*)
+{
+  if (tabBook->ActiveTab() == nullptr)
+    return 1;
+
+  FXString path = FXFileDialog::getSaveFilename(this, "Export Query", "results.csv",
+      "CSV Files (*.csv)\nTab Separated Files (*.tsv,*.txt)\nArrow Stream Files (*.arrow,*.arrows)\nAll Files (*)");
+  if (path.empty())
+    return 1;
+
+  FXString ext = FXPath::extension(path);
+  ExportFormat format = ExportFormat::Csv;
+  if (comparecase(ext, "tsv") == 0 || comparecase(ext, "txt") == 0) {
+    format = ExportFormat::Tsv;
+  } else if (comparecase(ext, "arrow") == 0 || comparecase(ext, "arrows") == 0) {
+    format = ExportFormat::Arrow;
+  }
+  tabBook->ExportActiveTabQuery(path, format);
+  return 1;
+}
+
+long QueryTool::OnCommandQueryCancel(FXObject*, FXSelector, void*)
+{
+  tabBook->CancelActiveTabQuery();
+  return 1;
+}
+
+long QueryTool::OnCommandQueryTimeout(FXObject*, FXSelector, void*)
+{
+  QueryTabItem *item = tabBook->ActiveTab();
+  if (item == nullptr)
+    return 1;
+
+  FXint seconds = item->getQueryTimeout();
+  if (FXInputDialog::getInteger(seconds, this, "Query Timeout",
+      "Cancel queries in this tab after this many seconds (0 for no limit):",
+      nullptr, 0, 24 * 60 * 60)) {
+    item->setQueryTimeout(seconds);
+  }
+  return 1;
+}
+
 long QueryTool::OnCommandTestQuery(FX::FXObject *, FX::FXSelector, void *)
 {
   return 1;
@@ -19,6 +19,8 @@
 
 #include <fx.h>
 
+#include "ConnectWorker.h"
+#include "CsvImport.h"
 #include "QueryTabBook.h"
 #include "ServerTreeList.h"
 
@@ -34,8 +36,17 @@ public:
     ID_DISCONNECT,
     ID_PREFERENCES,
     ID_QUERY_RUN,
+    ID_QUERY_BROWSE,
+    ID_QUERY_EXPORT,
+    ID_QUERY_CANCEL,
+    ID_QUERY_TIMEOUT,
     ID_TEST_QUERY,
-    ID_TEST_QUERY_TABLE
+    ID_TEST_QUERY_TABLE,
+    ID_POOL_EVICT,
+    ID_CONNECT_DONE,
+    ID_IMPORT_CSV,
+    ID_IMPORT_EVENT,
+    ID_FIND_OBJECT
   };
 
   void create();
@@ -43,17 +54,29 @@ public:
   long OnCommandAbout(FXObject*, FXSelector, void*);
   long OnCommandConnect(FXObject*, FXSelector, void*);
   long OnServerListConnect(FXObject*, FXSelector, void *);
+  long OnConnectDone(FXObject*, FXSelector, void *);
   long OnCommandDisconnect(FXObject*, FXSelector, void*);
+  long OnCommandImportCsv(FXObject*, FXSelector, void*);
+  long OnImportEvent(FXObject*, FXSelector, void*);
   long OnCommandPreferences(FXObject*, FXSelector, void*);
+  long OnCommandFindObject(FXObject*, FXSelector, void*);
   long OnCommandQuit(FXObject*, FXSelector, void*);
   long OnCommandTestQuery(FXObject*, FXSelector, void*);
   long OnCommandTestQueryTable(FXObject*, FXSelector, void*);
   long OnCommandQueryRun(FXObject*, FXSelector, void*);
+  long OnCommandQueryBrowse(FXObject*, FXSelector, void*);
+  long OnCommandQueryExport(FXObject*, FXSelector, void*);
+  long OnCommandQueryCancel(FXObject*, FXSelector, void*);
+  long OnCommandQueryTimeout(FXObject*, FXSelector, void*);
+  long OnPoolEvict(FXObject*, FXSelector, void*);
 private:
   QueryTool() = default;
 
   QueryTabBook *tabBook;
   ServerTreeList *treeList;
+  ConnectWorker *connector;
+  CsvImport *importer;
+  FXProgressDialog *importProgress{nullptr};
 
   FXVerticalFrame *queryFrame;
 
@@ -65,14 +88,20 @@ private:
   // File menu commands
   FXMenuCommand *m_file_connect;
   FXMenuCommand *m_file_disconnect;
+  FXMenuCommand *m_file_import;
   FXMenuSeparator *m_file_sep;
   FXMenuCommand *m_file_quit;
 
   // Edit
+  FXMenuCommand *m_edit_find;
   FXMenuCommand *m_edit_pref;
 
   // Query
   FXMenuCommand *m_query_run;
+  FXMenuCommand *m_query_browse;
+  FXMenuCommand *m_query_export;
+  FXMenuCommand *m_query_cancel;
+  FXMenuCommand *m_query_timeout;
 
   // Help
   FXMenuCommand *m_help_about;
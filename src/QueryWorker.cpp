@@ -0,0 +1,321 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include "QueryWorker.h"
+
+QueryWorker::QueryWorker(FXApp *app, tds::SqlConnection *conn, FXObject *target, FXSelector sel) :
+  conn{conn}
+{
+  signal = new FXGUISignal(app, target, sel);
+}
+
+QueryWorker::~QueryWorker()
+{
+  if (busy) {
+    join();
+  }
+  delete signal;
+}
+
+bool QueryWorker::Execute(const FXString& query)
+{
+  if (busy)
+    return false;
+
+  sql = query;
+  return Start(Query);
+}
+
+bool QueryWorker::Browse(const FXString& query, int rows)
+{
+  if (busy)
+    return false;
+
+  sql = query;
+  pageRows = rows;
+  return Start(Open);
+}
+
+bool QueryWorker::Fetch(int firstRow)
+{
+  if (busy)
+    return false;
+
+  pageRow = firstRow;
+  return Start(Page);
+}
+
+bool QueryWorker::Export(const FXString& query, const FXString& path, ExportFormat format)
+{
+  if (busy)
+    return false;
+
+  sql = query;
+  exportPath = path;
+  exportFormat = format;
+  return Start(ExportFile);
+}
+
+bool QueryWorker::Start(Job next)
+{
+  job = next;
+  busy = true;
+  cancelled = false;
+  if (!start()) {
+    busy = false;
+    return false;
+  }
+  return true;
+}
+
+void QueryWorker::Cancel()
+{
+  if (!busy)
+    return;
+
+  cancelled = true;
+  conn->Cancel();
+}
+
+FXint QueryWorker::run()
+{
+  if (job == Page) {
+    FetchPage(pageRow);
+    post({Done, nullptr, std::string()});
+    return 0;
+  }
+
+  // Any new query or cursor replaces the cursor being browsed.
+  conn->CloseCursor();
+
+  if (job == Open) {
+    if (!cancelled && conn->OpenCursor(sql.text(), pageRows)) {
+      conn->ProcessResults(*this);
+      if (!cancelled && conn->cursorOpen()) {
+        job = Page;
+        FetchPage(0);
+      }
+    }
+    post({Done, nullptr, std::string()});
+    return 0;
+  }
+
+  if (job == Query) {
+    RunScript();
+    post({Done, nullptr, std::string()});
+    return 0;
+  }
+
+  if (job == ExportFile) {
+    exporter.reset(FileSink::Create(exportFormat));
+    if (!exporter->Open(exportPath.text())) {
+      exporter.reset();
+      post({Message, nullptr, "Can't write " + std::string(exportPath.text())});
+      post({Done, nullptr, std::string()});
+      return 0;
+    }
+    lastProgress = std::chrono::steady_clock::now();
+  }
+
+  // A cancel that arrives while the query is being sent finds the
+  // connection idle and is dropped by the library, so repeat it here.
+  if (cancelled || !conn->SubmitQuery(sql.text())) {
+    onDone(false);
+    return 0;
+  }
+  if (cancelled) {
+    conn->Cancel();
+  }
+  conn->ProcessResults(*this);
+  return 0;
+}
+
+void QueryWorker::RunScript()
+{
+  using clock = std::chrono::steady_clock;
+
+  std::vector<tds::SqlBatch> batches = tds::SplitBatches(sql.text());
+  if (batches.empty())
+    return;
+
+  // Progress is only worth reporting when there is more than one batch.
+  const bool script = batches.size() > 1 || batches[0].count > 1;
+
+  std::string current;
+  std::string next;
+  if (!conn->EncodeQuery(batches[0].sql.c_str(), current)) {
+    post({Message, nullptr, "Can't convert the query to the server's encoding"});
+    return;
+  }
+
+  for (size_t i = 0; i < batches.size(); i++) {
+    const tds::SqlBatch& batch = batches[i];
+
+    for (int run = 1; run <= batch.count; run++) {
+      clock::time_point start = clock::now();
+      batchRowCount = 0;
+      batchErrors = 0;
+
+      // A cancel that arrives while the query is being sent finds the
+      // connection idle and is dropped by the library, so repeat it here.
+      if (cancelled || !conn->SubmitEncoded(current))
+        return;
+      if (cancelled) {
+        conn->Cancel();
+      }
+
+      // Prepare the next batch while the server works on this one, so it
+      // can go out as soon as the last DONE has been read.
+      if (run == batch.count && i + 1 < batches.size() &&
+          !conn->EncodeQuery(batches[i + 1].sql.c_str(), next)) {
+        next.clear();
+      }
+
+      conn->ProcessResults(*this);
+      if (!batchDone)
+        return;
+
+      if (script) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+        std::string status = "Batch " + std::to_string(i + 1) + " of " + std::to_string(batches.size()) +
+          " (line " + std::to_string(batch.line) + ")";
+        if (batch.count > 1) {
+          status += ", run " + std::to_string(run) + " of " + std::to_string(batch.count);
+        }
+        status += ": " + std::to_string(batchRowCount) + " rows, " + std::to_string(ms) + " ms";
+        if (batchErrors > 0) {
+          status += ", " + std::to_string(batchErrors) + " errors";
+        }
+        post({Message, nullptr, status});
+      }
+    }
+
+    if (i + 1 < batches.size() && next.empty()) {
+      post({Message, nullptr, "Can't convert batch " + std::to_string(i + 2) +
+          " to the server's encoding"});
+      return;
+    }
+    current.swap(next);
+  }
+}
+
+void QueryWorker::FetchPage(int firstRow)
+{
+  page.reset();
+  if (!cancelled && conn->FetchCursor(firstRow)) {
+    conn->ProcessResults(*this);
+  }
+  // An empty page (or none at all) tells the receiver the cursor ended.
+  post({Rows, std::move(page), std::string(), firstRow});
+}
+
+void QueryWorker::post(Event&& event)
+{
+  mutex.lock();
+  events.push_back(std::move(event));
+  mutex.unlock();
+  signal->signal();
+}
+
+std::vector<QueryWorker::Event> QueryWorker::takeEvents()
+{
+  std::vector<Event> pending;
+
+  mutex.lock();
+  pending.swap(events);
+  mutex.unlock();
+
+  for (const Event& event : pending) {
+    if (event.type == Done) {
+      join();
+      busy = false;
+    }
+  }
+  return pending;
+}
+
+void QueryWorker::onResultFormat(const TDSCONTEXT *context, const TDSRESULTINFO *info)
+{
+  if (job == ExportFile) {
+    exporter->onResultFormat(context, info);
+    return;
+  }
+  if (job == Page) {
+    page.reset(new tds::ResultSet(context, info));
+    return;
+  }
+  post({ResultFormat, std::unique_ptr<tds::ResultSet>(new tds::ResultSet(context, info)), std::string()});
+}
+
+void QueryWorker::onRowBatch(std::unique_ptr<tds::ResultSet>& batch)
+{
+  if (job == Page) {
+    // Collect the batches of a page so it arrives in one piece.
+    if (page && page->rowCount() > 0) {
+      page->Append(*batch);
+    } else {
+      page = std::move(batch);
+    }
+    return;
+  }
+  batchRowCount += batch->rowCount();
+  post({Rows, std::move(batch), std::string()});
+}
+
+void QueryWorker::onMessage(int, int severity, const std::string& text)
+{
+  if (severity > 10) {
+    batchErrors++;
+  }
+  post({Message, nullptr, text});
+}
+
+void QueryWorker::onRow(const TDSRESULTINFO *info)
+{
+  exporter->onRow(info);
+
+  // Checking the clock for every row would cost more than writing it.
+  if ((exporter->rowCount() & 0xffff) == 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastProgress >= std::chrono::seconds(1)) {
+      lastProgress = now;
+      post({Message, nullptr, "Exporting, " + std::to_string(exporter->rowCount()) + " rows"});
+    }
+  }
+}
+
+void QueryWorker::onDone(bool success)
+{
+  if (job == ExportFile) {
+    int64_t rows = exporter->rowCount();
+    bool written = exporter->Close();
+    exporter.reset();
+
+    std::string status;
+    if (!written) {
+      status = "Failed writing " + std::string(exportPath.text());
+    } else {
+      status = (success ? "Exported " : "Export stopped after ") + std::to_string(rows) +
+        " rows to " + exportPath.text();
+    }
+    post({Message, nullptr, status});
+    post({Done, nullptr, std::string()});
+    return;
+  }
+
+  // Cursor jobs and scripts run several requests and post Done themselves.
+  batchDone = success;
+}
@@ -0,0 +1,132 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef QUERYWORKER_H
+#define QUERYWORKER_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fx.h>
+
+#include "FileSink.h"
+#include "SqlConnection.h"
+#include "SqlScript.h"
+
+// Runs queries for a single SqlConnection on a background thread. As the
+// RowSink of the query it queues everything the connection reports, and the
+// GUI thread is woken through an FXGUISignal to pick it up with
+// takeEvents(). Once a query has been started, the connection must not be
+// touched from the GUI thread until the Done event has been taken.
+class QueryWorker : public FXThread, public tds::RowSink {
+public:
+  QueryWorker(FXApp *app, tds::SqlConnection *conn, FXObject *target, FXSelector sel);
+  virtual ~QueryWorker();
+
+  enum EventType {
+    ResultFormat,
+    Rows,
+    Message,
+    Done
+  };
+
+  struct Event {
+    EventType type;
+    std::unique_ptr<tds::ResultSet> results;
+    std::string message;
+    int row{-1};      // first row of a cursor page, -1 for query rows
+  };
+
+  // Start executing sql. Scripts are split into batches at GO lines and
+  // the batches are sent one after another, each batch reporting its row
+  // count and time in a Message. Returns false if a query is still running.
+  bool Execute(const FXString& sql);
+
+  // Open a server cursor over sql and fetch its first page. Posts the
+  // ResultFormat of the cursor, then a single Rows event holding the whole
+  // page with row set to 0, then Done.
+  bool Browse(const FXString& sql, int pageRows);
+
+  // Fetch the page of the open cursor starting at firstRow, posted as a
+  // single Rows event followed by Done.
+  bool Fetch(int firstRow);
+
+  // Run sql and write its results to path in format as they arrive,
+  // without posting any rows. Progress and the outcome are posted as
+  // Message events, followed by Done.
+  bool Export(const FXString& sql, const FXString& path, ExportFormat format);
+  bool isBusy() const { return busy; }
+
+  // Cancel the running query. The Done event still follows once the
+  // connection has drained.
+  void Cancel();
+
+  // Called from the GUI thread when signaled.
+  std::vector<Event> takeEvents();
+
+  // RowSink, called on the worker thread
+  void onResultFormat(const TDSCONTEXT *context, const TDSRESULTINFO *info) override;
+  void onRowBatch(std::unique_ptr<tds::ResultSet>& batch) override;
+  void onMessage(int msgno, int severity, const std::string& text) override;
+  void onDone(bool success) override;
+  bool wantsRows() const override { return job == ExportFile; }
+  void onRow(const TDSRESULTINFO *info) override;
+protected:
+  virtual FXint run();
+private:
+  enum Job {
+    Query,
+    Open,
+    Page,
+    ExportFile
+  };
+
+  bool Start(Job next);
+  void RunScript();
+  void FetchPage(int firstRow);
+  void post(Event&& event);
+
+  tds::SqlConnection *conn{nullptr};
+  FXGUISignal *signal{nullptr};
+  FXString sql;
+  Job job{Query};
+  int pageRows{0};
+  int pageRow{0};
+
+  // Outcome of the batch of a script being run, worker thread only.
+  int64_t batchRowCount{0};
+  int batchErrors{0};
+  bool batchDone{false};
+
+  // Rows of the page being fetched, worker thread only.
+  std::unique_ptr<tds::ResultSet> page;
+
+  // File being exported to and when progress was last posted.
+  std::unique_ptr<FileSink> exporter;
+  FXString exportPath;
+  ExportFormat exportFormat{ExportFormat::Csv};
+  std::chrono::steady_clock::time_point lastProgress;
+  bool busy{false};
+  std::atomic<bool> cancelled{false};
+
+  FXMutex mutex;
+  std::vector<Event> events;
+};
+
+#endif // QUERYWORKER_H
@@ -0,0 +1,312 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <cstring>
+
+#include "ResultGrid.h"
+
+FXDEFMAP(ResultGrid) resultGridMap[] = {
+  FXMAPFUNC(SEL_PAINT, 0, ResultGrid::OnPaint),
+  FXMAPFUNC(SEL_CHANGED, ResultGrid::ID_HEADER, ResultGrid::OnHeaderChanged),
+  FXMAPFUNC(SEL_LEFTBUTTONPRESS, 0, ResultGrid::OnLeftBtnPress),
+  FXMAPFUNC(SEL_KEYPRESS, 0, ResultGrid::OnKeyPress),
+  FXMAPFUNC(SEL_CLIPBOARD_REQUEST, 0, ResultGrid::OnClipboardRequest)
+};
+
+FXIMPLEMENT(ResultGrid, FXScrollArea, resultGridMap, ARRAYNUMBER(resultGridMap))
+
+// Padding around the text of a cell.
+static constexpr int kCellPad = 3;
+
+// Column widths are estimated from this many leading rows.
+static constexpr int kSizeSampleRows = 64;
+static constexpr int kMinColumnWidth = 60;
+static constexpr int kMaxColumnWidth = 300;
+
+ResultGrid::ResultGrid(FXComposite *p, FXuint opts, FXint x, FXint y, FXint w, FXint h) :
+  FXScrollArea(p, opts, x, y, w, h)
+{
+  flags |= FLAG_ENABLED;
+  backColor = FXRGB(255, 255, 255);
+  header = new FXHeader(this, this, ID_HEADER, HEADER_HORIZONTAL | HEADER_TRACKING |
+      HEADER_BUTTON | HEADER_RESIZE | FRAME_RAISED | FRAME_THICK);
+  font = getApp()->getNormalFont();
+  rowHeight = font->getFontHeight() + 2 * kCellPad;
+}
+
+void ResultGrid::create()
+{
+  FXScrollArea::create();
+  font->create();
+  rowHeight = font->getFontHeight() + 2 * kCellPad;
+}
+
+bool ResultGrid::canFocus() const
+{
+  return true;
+}
+
+void ResultGrid::setSource(GridSource *src)
+{
+  source = src;
+  sizedRows = 0;
+  selRow = -1;
+  selCol = -1;
+
+  header->clearItems();
+  if (source != nullptr) {
+    for (int c = 0; c < source->columnCount(); c++) {
+      const char *name = source->columnName(c);
+      FXint w = font->getTextWidth(name, strlen(name)) + 4 * kCellPad;
+      header->appendItem(name, nullptr, FXCLAMP(kMinColumnWidth, w, kMaxColumnWidth));
+    }
+    autoSizeColumns(0, source->rowCount());
+  }
+  recalc();
+  update();
+}
+
+// Widen columns to fit the first few rows. Only a small sample is measured
+// so this stays cheap no matter how large the result set becomes.
+void ResultGrid::autoSizeColumns(int firstRow, int lastRow)
+{
+  lastRow = FXMIN(lastRow, kSizeSampleRows);
+  if (firstRow >= lastRow)
+    return;
+
+  for (int c = 0; c < source->columnCount(); c++) {
+    FXint w = header->getItemSize(c);
+    for (int r = firstRow; r < lastRow; r++) {
+      int len;
+      const char *text = source->cellText(r, c, &len);
+      if (text == nullptr)
+        continue;
+      w = FXMAX(w, font->getTextWidth(text, len) + 2 * kCellPad + 1);
+    }
+    header->setItemSize(c, FXMIN(w, kMaxColumnWidth));
+  }
+  sizedRows = lastRow;
+}
+
+void ResultGrid::rowsChanged()
+{
+  if (source != nullptr && sizedRows < kSizeSampleRows) {
+    autoSizeColumns(sizedRows, source->rowCount());
+  }
+  recalc();
+  update();
+}
+
+FXint ResultGrid::getContentWidth()
+{
+  return header->getTotalSize();
+}
+
+// The header is part of the content height so that the last row can be
+// scrolled fully into view below it.
+FXint ResultGrid::getContentHeight()
+{
+  int rows = source != nullptr ? source->rowCount() : 0;
+  return rows * rowHeight + header->getDefaultHeight();
+}
+
+void ResultGrid::layout()
+{
+  placeScrollBars(width, height);
+
+  vertical->setLine(rowHeight);
+  horizontal->setLine(rowHeight);
+
+  header->position(0, 0, getViewportWidth(), header->getDefaultHeight());
+  header->setPosition(pos_x);
+
+  update();
+  flags &= ~FLAG_DIRTY;
+}
+
+void ResultGrid::moveContents(FXint x, FXint y)
+{
+  FXint hh = header->getHeight();
+  FXint dx = x - pos_x;
+  FXint dy = y - pos_y;
+  pos_x = x;
+  pos_y = y;
+  header->setPosition(x);
+  scroll(0, hh, getViewportWidth(), getViewportHeight() - hh, dx, dy);
+}
+
+long ResultGrid::OnHeaderChanged(FXObject*, FXSelector, void*)
+{
+  recalc();
+  update();
+  return 1;
+}
+
+void ResultGrid::updateCell(int row, int col)
+{
+  if (row < 0 || col < 0)
+    return;
+
+  update(pos_x + header->getItemOffset(col), header->getHeight() + pos_y + row * rowHeight,
+      header->getItemSize(col), rowHeight);
+}
+
+long ResultGrid::OnLeftBtnPress(FXObject*, FXSelector, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+
+  setFocus();
+  if (source == nullptr)
+    return 1;
+
+  FXint top = header->getHeight();
+  if (ev->win_y < top)
+    return 1;
+
+  int row = (ev->win_y - top - pos_y) / rowHeight;
+  int col = header->getItemAt(ev->win_x);
+  if (row >= source->rowCount() || col < 0 || col >= source->columnCount()) {
+    row = -1;
+    col = -1;
+  }
+
+  updateCell(selRow, selCol);
+  selRow = row;
+  selCol = col;
+  updateCell(selRow, selCol);
+
+  return 1;
+}
+
+long ResultGrid::OnKeyPress(FXObject *sender, FXSelector sel, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+
+  if ((ev->state & CONTROLMASK) && (ev->code == KEY_c || ev->code == KEY_C)) {
+    copySelection();
+    return 1;
+  }
+  return FXScrollArea::onKeyPress(sender, sel, ptr);
+}
+
+void ResultGrid::copySelection()
+{
+  if (source == nullptr || selRow < 0 || selCol < 0)
+    return;
+
+  // Formatting happens here rather than when the row was read.
+  int len;
+  const char *text = source->cellText(selRow, selCol, &len);
+  if (text == nullptr) {
+    clipped = "NULL";
+  } else {
+    clipped.assign(text, len);
+  }
+
+  FXDragType types[] = { stringType };
+  acquireClipboard(types, ARRAYNUMBER(types));
+}
+
+long ResultGrid::OnClipboardRequest(FXObject *sender, FXSelector sel, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+
+  if (FXScrollArea::onClipboardRequest(sender, sel, ptr))
+    return 1;
+
+  if (ev->target == stringType) {
+    FXuchar *data;
+    FXuint len = clipped.length();
+    FXMALLOC(&data, FXuchar, len);
+    memcpy(data, clipped.text(), len);
+    setDNDData(FROM_CLIPBOARD, ev->target, data, len);
+    return 1;
+  }
+  return 0;
+}
+
+long ResultGrid::OnPaint(FXObject*, FXSelector, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+  FXDCWindow dc(this, ev);
+
+  dc.setForeground(backColor);
+  dc.fillRectangle(ev->rect_x, ev->rect_y, ev->rect_w, ev->rect_h);
+
+  if (source == nullptr)
+    return 1;
+
+  FXint top = header->getHeight();
+  FXint vw = getViewportWidth();
+  FXint vh = getViewportHeight();
+  int numRows = source->rowCount();
+  int numCols = source->columnCount();
+
+  // Only rows intersecting the dirty rectangle are visited.
+  FXint ylo = FXMAX(ev->rect_y, top);
+  FXint yhi = FXMIN(ev->rect_y + ev->rect_h, vh);
+  if (ylo >= yhi || numRows == 0)
+    return 1;
+  int firstRow = FXMAX((ylo - top - pos_y) / rowHeight, 0);
+  int lastRow = FXMIN((yhi - top - pos_y) / rowHeight + 1, numRows);
+
+  dc.setFont(font);
+  FXint ascent = font->getFontAscent();
+  FXint xlo = ev->rect_x;
+  FXint xhi = FXMIN(ev->rect_x + ev->rect_w, vw);
+
+  for (int c = 0; c < numCols; c++) {
+    FXint x = pos_x + header->getItemOffset(c);
+    FXint w = header->getItemSize(c);
+    if (x + w <= xlo)
+      continue;
+    if (x >= xhi)
+      break;
+
+    dc.setClipRectangle(FXMAX(x, 0), ylo, FXMIN(w - 1, xhi - x), yhi - ylo);
+    for (int r = firstRow; r < lastRow; r++) {
+      FXint y = top + pos_y + r * rowHeight;
+      if (r == selRow && c == selCol) {
+        dc.setForeground(getApp()->getSelbackColor());
+        dc.fillRectangle(x, y, w - 1, rowHeight - 1);
+      }
+      int len;
+      const char *text = source->cellText(r, c, &len);
+      if (text == nullptr) {
+        dc.setForeground(FXRGB(128, 128, 128));
+        dc.drawText(x + kCellPad, y + kCellPad + ascent, "NULL", 4);
+      } else {
+        dc.setForeground(FXRGB(0, 0, 0));
+        dc.drawText(x + kCellPad, y + kCellPad + ascent, text, len);
+      }
+    }
+    dc.clearClipRectangle();
+
+    // Column separator
+    dc.setForeground(FXRGB(224, 224, 224));
+    dc.drawLine(x + w - 1, ylo, x + w - 1, yhi);
+  }
+
+  // Row separators
+  dc.setForeground(FXRGB(224, 224, 224));
+  FXint right = FXMIN(pos_x + header->getTotalSize(), xhi);
+  for (int r = firstRow; r < lastRow; r++) {
+    FXint y = top + pos_y + (r + 1) * rowHeight - 1;
+    dc.drawLine(xlo, y, right, y);
+  }
+
+  return 1;
+}
@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef RESULTGRID_H
+#define RESULTGRID_H
+
+#include <fx.h>
+
+#include "GridSource.h"
+
+// A read-only grid that draws cells straight from a GridSource. Unlike
+// FXTable there is no per-cell item, so the cost of painting is bounded by
+// the number of visible cells regardless of how many rows the source holds.
+class ResultGrid : public FXScrollArea {
+  FXDECLARE(ResultGrid)
+public:
+  ResultGrid(FXComposite *p, FXuint opts = 0, FXint x = 0, FXint y = 0,
+      FXint w = 0, FXint h = 0);
+  virtual ~ResultGrid() = default;
+
+  virtual void create();
+  virtual void layout();
+  virtual FXint getContentWidth();
+  virtual FXint getContentHeight();
+  virtual void moveContents(FXint x, FXint y);
+  virtual bool canFocus() const;
+
+  // The grid does not own the source.
+  void setSource(GridSource *src);
+  GridSource *getSource() const { return source; }
+
+  // Notify the grid that rows were appended to the source.
+  void rowsChanged();
+
+  long OnPaint(FXObject*,FXSelector,void*);
+  long OnHeaderChanged(FXObject*,FXSelector,void*);
+  long OnLeftBtnPress(FXObject*,FXSelector,void*);
+  long OnKeyPress(FXObject*,FXSelector,void*);
+  long OnClipboardRequest(FXObject*,FXSelector,void*);
+
+  enum {
+    ID_HEADER = FXScrollArea::ID_LAST,
+    ID_LAST
+  };
+private:
+  ResultGrid() = default;
+
+  void autoSizeColumns(int firstRow, int lastRow);
+  void updateCell(int row, int col);
+  void copySelection();
+
+  FXHeader *header{nullptr};
+  FXFont *font{nullptr};
+  GridSource *source{nullptr};
+  FXint rowHeight{1};
+  int sizedRows{0};
+
+  // Currently selected cell, -1 if none.
+  int selRow{-1};
+  int selCol{-1};
+
+  // Text handed out while we own the clipboard.
+  FXString clipped;
+};
+
+#endif // RESULTGRID_H
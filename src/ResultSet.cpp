@@ -0,0 +1,255 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#include <cstdlib>
+#include <cstring>
+
+#include "ResultSet.h"
+#include "freetds/convert.h"
+
+namespace tds {
+
+// Returns the number of bytes a value of this column occupies in the row
+// buffer if it is stored there in a fixed binary form, or 0 if the value
+// is variable length (character, binary and blob data).
+static int fixed_width(TDSCOLUMN *col, int ctype)
+{
+  if (is_blob_col(col))
+    return 0;
+
+  switch (ctype) {
+    case SYBNUMERIC:
+    case SYBDECIMAL:
+    case SYBMSDATE:
+    case SYBMSTIME:
+    case SYBMSDATETIME2:
+    case SYBMSDATETIMEOFFSET:
+    case SYB5BIGDATETIME:
+    case SYB5BIGTIME:
+      return col->funcs->row_len(col);
+    default:
+      break;
+  }
+
+  if (is_fixed_type(ctype))
+    return tds_get_size_by_type(static_cast<TDS_SERVER_TYPE>(ctype));
+
+  return 0;
+}
+
+// Enough cells for a few screens worth of grid.
+static constexpr size_t kFormattedCells = 8192;
+
+ResultSet::ResultSet(const TDSCONTEXT *context, const TDSRESULTINFO *info) :
+  context{context}, formatted{kFormattedCells}
+{
+  columns.resize(info->num_cols);
+  for (int c = 0; c < info->num_cols; c++) {
+    TDSCOLUMN *col = info->columns[c];
+    Column& column = columns[c];
+
+    column.name = tds_dstr_cstr(&col->column_name);
+    column.type = tds_get_conversion_type(col->column_type, col->column_size);
+    column.size = col->column_size;
+    column.precision = col->column_prec;
+    column.scale = col->column_scale;
+    column.width = fixed_width(col, column.type);
+
+    // Variants are stored as their text representation.
+    if (col->column_type == SYBVARIANT) {
+      column.type = SYBVARCHAR;
+    }
+  }
+}
+
+ResultSet::~ResultSet()
+{
+  for (TDSPACKET *packet : packets) {
+    tds_release_packet(packet);
+  }
+}
+
+void ResultSet::AddRow(const TDSRESULTINFO *info)
+{
+  for (int c = 0; c < info->num_cols; c++) {
+    TDSCOLUMN *col = info->columns[c];
+    Column& column = columns[c];
+    bool isNull = col->column_cur_size < 0;
+
+    column.nulls.push_back(isNull);
+
+    if (column.width > 0) {
+      size_t pos = column.data.size();
+      column.data.resize(pos + column.width);
+      if (!isNull) {
+        memcpy(&column.data[pos], col->column_data, column.width);
+      }
+      continue;
+    }
+
+    if (isNull) {
+      column.values.push_back(nullptr);
+      column.lengths.push_back(0);
+      continue;
+    }
+
+    if (col->column_ref != nullptr) {
+      // Rows arrive in order, so a packet is only ever added once.
+      if (packets.empty() || packets.back() != col->column_packet) {
+        tds_retain_packet(col->column_packet);
+        packets.push_back(col->column_packet);
+      }
+      column.values.push_back(reinterpret_cast<const char *>(col->column_ref));
+      column.lengths.push_back(col->column_cur_size);
+      continue;
+    }
+
+    if (col->column_type == SYBVARIANT) {
+      CONV_RESULT dres;
+      int ctype = tds_get_conversion_type(col->column_type, col->column_size);
+      TDS_INT len = tds_convert(context, ctype, col->column_data, col->column_cur_size,
+          SYBVARCHAR, &dres);
+      if (len < 0) {
+        len = 0;
+        dres.c = nullptr;
+      }
+      column.values.push_back(arena.at(arena.Add(dres.c, len)));
+      column.lengths.push_back(len);
+      free(dres.c);
+      continue;
+    }
+
+    const unsigned char *src = col->column_data;
+    if (is_blob_col(col)) {
+      src = (const unsigned char *) ((TDSBLOB *) src)->textvalue;
+    }
+    column.values.push_back(arena.at(arena.Add(src, col->column_cur_size)));
+    column.lengths.push_back(col->column_cur_size);
+  }
+  numRows++;
+}
+
+void ResultSet::Append(const ResultSet& other)
+{
+  for (size_t c = 0; c < columns.size(); c++) {
+    Column& column = columns[c];
+    const Column& from = other.columns[c];
+
+    column.nulls.insert(column.nulls.end(), from.nulls.begin(), from.nulls.end());
+
+    if (column.width > 0) {
+      column.data.insert(column.data.end(), from.data.begin(), from.data.end());
+      continue;
+    }
+
+    column.values.reserve(column.values.size() + from.values.size());
+    column.lengths.reserve(column.lengths.size() + from.lengths.size());
+    for (size_t r = 0; r < from.lengths.size(); r++) {
+      uint32_t len = from.lengths[r];
+      const char *value = from.nulls[r] ? nullptr : arena.at(arena.Add(from.values[r], len));
+      column.values.push_back(value);
+      column.lengths.push_back(len);
+    }
+  }
+  numRows += other.numRows;
+}
+
+void ResultSet::Clear()
+{
+  for (Column& column : columns) {
+    column.nulls.clear();
+    column.data.clear();
+    column.values.clear();
+    column.lengths.clear();
+  }
+  for (TDSPACKET *packet : packets) {
+    tds_release_packet(packet);
+  }
+  packets.clear();
+  arena.Clear();
+  formatted.clear();
+  numRows = 0;
+}
+
+const unsigned char *ResultSet::value(int row, int col, int *len) const
+{
+  const Column& column = columns[col];
+
+  if (column.nulls[row]) {
+    *len = 0;
+    return nullptr;
+  }
+
+  if (column.width > 0) {
+    *len = column.width;
+    return &column.data[static_cast<size_t>(row) * column.width];
+  }
+
+  *len = static_cast<int>(column.lengths[row]);
+  return reinterpret_cast<const unsigned char *>(column.values[row]);
+}
+
+bool ResultSet::FormatCell(int row, int col, std::string& out) const
+{
+  const Column& column = columns[col];
+
+  int srclen;
+  const unsigned char *src = value(row, col, &srclen);
+  if (src == nullptr)
+    return false;
+
+  // Character data is already in the client charset.
+  if (column.width == 0 && is_char_type(column.type)) {
+    out.assign(reinterpret_cast<const char *>(src), srclen);
+    return true;
+  }
+
+  CONV_RESULT dres;
+  TDS_INT converted = tds_convert(context, column.type, src, srclen, SYBVARCHAR, &dres);
+  if (converted < 0) {
+    out.clear();
+    return true;
+  }
+  out.assign(dres.c, converted);
+  free(dres.c);
+  return true;
+}
+
+const char *ResultSet::cellText(int row, int col, int *len)
+{
+  const Column& column = columns[col];
+  if (column.nulls[row])
+    return nullptr;
+
+  // Character data can be drawn straight from where it is stored.
+  if (column.width == 0 && is_char_type(column.type)) {
+    return reinterpret_cast<const char *>(value(row, col, len));
+  }
+
+  uint64_t key = (static_cast<uint64_t>(row) << 16) | static_cast<unsigned int>(col);
+  std::string *text = formatted.find(key);
+  if (text == nullptr) {
+    std::string out;
+    FormatCell(row, col, out);
+    formatted.insert(key, std::move(out));
+    text = formatted.find(key);
+  }
+
+  *len = static_cast<int>(text->size());
+  return text->c_str();
+}
+
+} // namespace tds
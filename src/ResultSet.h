@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef TDS_RESULTSET_H
+#define TDS_RESULTSET_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tds/include/freetds/tds.h"
+
+#include "Arena.h"
+#include "GridSource.h"
+#include "LruCache.h"
+
+namespace tds {
+
+// Holds the rows of a single result set, one typed column at a time.
+//
+// Fixed-width values (integers, floats, money, datetimes, numerics, ...)
+// are kept in their native binary form in a flat per-column buffer.
+// Character and binary values are appended to a shared arena, with each
+// column keeping the address and length of its values. Adding a row
+// therefore never allocates per cell, and values are only formatted as text
+// when they are asked for.
+//
+// Rows added from a result marked with tds_set_in_place may also leave
+// values in the packets they arrived in. The result set then holds a
+// reference to those packets until it is cleared or destroyed, and
+// Append copies the values out.
+class ResultSet : public GridSource {
+public:
+  struct Column {
+    std::string name;
+    int type;        // conversion type, see tds_get_conversion_type
+    int size;        // declared size on the server
+    int precision;
+    int scale;
+    int width;       // bytes per value for fixed columns, 0 for variable
+
+    std::vector<bool> nulls;
+
+    // Fixed-width values, width bytes each
+    std::vector<unsigned char> data;
+
+    // Variable-length values, in the arena or in a received packet
+    std::vector<const char *> values;
+    std::vector<uint32_t> lengths;
+  };
+
+  ResultSet(const TDSCONTEXT *context, const TDSRESULTINFO *info);
+  ~ResultSet() override;
+
+  ResultSet(const ResultSet&) = delete;
+  ResultSet& operator=(const ResultSet&) = delete;
+
+  // Append the row currently held in info (same layout as the constructor).
+  void AddRow(const TDSRESULTINFO *info);
+
+  // Append all rows of another result set with the same columns.
+  void Append(const ResultSet& other);
+
+  // Drop all rows and packets but keep the columns and allocated capacity.
+  void Clear();
+
+  const Column& column(int col) const { return columns[col]; }
+
+  bool isNull(int row, int col) const { return columns[col].nulls[row]; }
+
+  // Raw value of a cell, in the form described by column(col).type, or
+  // nullptr if the value is NULL.
+  const unsigned char *value(int row, int col, int *len) const;
+
+  // Convert a non-NULL cell to text. This is the only place values are
+  // formatted, whether for painting, copying or exporting.
+  bool FormatCell(int row, int col, std::string& out) const;
+
+  int rowCount() const override { return numRows; }
+  int columnCount() const override { return static_cast<int>(columns.size()); }
+  const char *columnName(int col) const override { return columns[col].name.c_str(); }
+  const char *cellText(int row, int col, int *len) override;
+
+private:
+  const TDSCONTEXT *context;
+  std::vector<Column> columns;
+  int numRows{0};
+
+  Arena arena;
+
+  // Packets that values were left in, one reference each.
+  std::vector<TDSPACKET *> packets;
+
+  // Formatted text of recently painted cells, keyed by row and column.
+  LruCache<uint64_t, std::string> formatted;
+};
+
+} // namespace tds
+
+#endif // TDS_RESULTSET_H
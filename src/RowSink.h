@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+#ifndef TDS_ROWSINK_H
+#define TDS_ROWSINK_H
+
+#include <memory>
+#include <string>
+
+#include "tds/include/freetds/tds.h"
+
+#include "ResultSet.h"
+
+namespace tds {
+
+// Receives everything SqlConnection::ProcessResults reads from the server.
+// The methods are called on whichever thread runs ProcessResults.
+class RowSink {
+public:
+  virtual ~RowSink() = default;
+
+  // A new result set starts. info describes its columns and is only valid
+  // for the duration of the call.
+  virtual void onResultFormat(const TDSCONTEXT *context, const TDSRESULTINFO *info) = 0;
+
+  // A batch of rows for the current result set. The sink may keep the batch
+  // by moving it out of the pointer; otherwise it is cleared and reused.
+  virtual void onRowBatch(std::unique_ptr<ResultSet>& batch) = 0;
+
+  // Sinks that take rows one at a time, straight from the decoder, return
+  // true here. They are handed each row with onRow instead, and no batches
+  // are built for them.
+  virtual bool wantsRows() const { return false; }
+
+  // A row of the current result set. info holds the decoded values and is
+  // only valid for the duration of the call.
+  virtual void onRow(const TDSRESULTINFO *info) { }
+
+  // An informational or error message from the server.
+  virtual void onMessage(int msgno, int severity, const std::string& text) = 0;
+
+  // All results have been read. success is false if reading stopped early.
+  virtual void onDone(bool success) = 0;
+};
+
+} // namespace tds
+
+#endif // TDS_ROWSINK_H
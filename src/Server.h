@@ -27,8 +27,17 @@ struct Server {
   FXString user;
   FXString password;
   FXString default_database;
+  // Receive on a separate thread while results are decoded, see
+  // tds_start_readahead.
+  bool readahead{false};
+  // Ask for MARS at login, so background requests share it, see
+  // SqlConnection::OpenSession.
+  bool mars{false};
 
   bool connected{false};
+  // A login to this server is being made in the background, see
+  // ConnectWorker. The server must not be edited or deleted meanwhile.
+  bool connecting{false};
 };
 
 #endif // SERVER_H
@@ -69,6 +69,16 @@ ServerEditDialog::ServerEditDialog(FXWindow *owner, const Server *server) :
   m_database = new FXTextField(matrix, 25, nullptr, 0,
                                FRAME_THICK|FRAME_SUNKEN|LAYOUT_FILL_COLUMN|LAYOUT_FILL_ROW);
 
+  new FXLabel(matrix, "Network:", nullptr, JUSTIFY_LEFT | LAYOUT_FILL_COLUMN |
+                                            LAYOUT_FILL_ROW);
+  m_readahead = new FXCheckButton(matrix, "Read ahead on a separate thread (slow links)",
+                                  nullptr, 0, CHECKBUTTON_NORMAL|LAYOUT_FILL_COLUMN|LAYOUT_FILL_ROW);
+
+  new FXLabel(matrix, "Sessions:", nullptr, JUSTIFY_LEFT | LAYOUT_FILL_COLUMN |
+                                            LAYOUT_FILL_ROW);
+  m_mars = new FXCheckButton(matrix, "Share one login between requests (MARS)",
+                             nullptr, 0, CHECKBUTTON_NORMAL|LAYOUT_FILL_COLUMN|LAYOUT_FILL_ROW);
+
   m_error = new FXLabel(contents, " ");
 
   FXHorizontalFrame *buttonframe = new FXHorizontalFrame(contents,LAYOUT_FILL_X|LAYOUT_FILL_Y);
@@ -87,6 +97,8 @@ ServerEditDialog::ServerEditDialog(FXWindow *owner, const Server *server) :
     m_username->setText(server->user);
     m_password->setText(server->password);
     m_database->setText(server->default_database);
+    m_readahead->setCheck(server->readahead);
+    m_mars->setCheck(server->mars);
   }
 }
 
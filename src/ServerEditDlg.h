@@ -41,6 +41,8 @@ public:
   [[nodiscard]] FXString username() const { return m_username->getText().trim(); }
   [[nodiscard]] FXString password() const { return m_password->getText().trim(); }
   [[nodiscard]] FXString database() const { return m_database->getText().trim(); }
+  [[nodiscard]] bool readahead() const { return m_readahead->getCheck() == TRUE; }
+  [[nodiscard]] bool mars() const { return m_mars->getCheck() == TRUE; }
 
 private:
   ServerEditDialog() = default;
@@ -57,6 +59,8 @@ private:
   FXLabel *m_password_lbl;
   FXTextField *m_password;
   FXTextField *m_database;
+  FXCheckButton *m_readahead;
+  FXCheckButton *m_mars;
 
   FXLabel *m_error;
 };
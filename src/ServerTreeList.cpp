@@ -20,6 +20,7 @@
 #include <cstdio>
 
 #include "Config.h"
+#include "ConnectionPool.h"
 #include "ServerEditDlg.h"
 #include "ServerTreeList.h"
 #include "SqlConnection.h"
@@ -31,30 +32,45 @@
 #include <cJSON.h>
 
 FXDEFMAP(ServerTreeList) stlEventMap[] = {
-  FXMAPFUNC(SEL_LEFTBUTTONPRESS, ServerTreeList::ID_REQUEST_TREE, ServerTreeList::OnCmdTreeLeftClick),
-  FXMAPFUNC(SEL_RIGHTBUTTONPRESS, ServerTreeList::ID_REQUEST_TREE, ServerTreeList::OnCmdTreeRightClick),
+  FXMAPFUNC(SEL_PAINT, 0, ServerTreeList::OnPaint),
+  FXMAPFUNC(SEL_LEFTBUTTONPRESS, 0, ServerTreeList::OnCmdTreeLeftClick),
+  FXMAPFUNC(SEL_RIGHTBUTTONPRESS, 0, ServerTreeList::OnCmdTreeRightClick),
+  FXMAPFUNC(SEL_KEYPRESS, 0, ServerTreeList::OnKeyPress),
   FXMAPFUNC(SEL_COMMAND, ServerTreeList::ID_NEW, ServerTreeList::OnAddNewServer),
   FXMAPFUNC(SEL_COMMAND, ServerTreeList::ID_EDIT, ServerTreeList::OnEditServer),
   FXMAPFUNC(SEL_COMMAND, ServerTreeList::ID_DELETE, ServerTreeList::OnDeleteServer),
-  FXMAPFUNC(SEL_COMMAND, ServerTreeList::ID_CONNECT, ServerTreeList::OnConnectServer)
+  FXMAPFUNC(SEL_COMMAND, ServerTreeList::ID_CONNECT, ServerTreeList::OnConnectServer),
+  FXMAPFUNC(SEL_IO_READ, ServerTreeList::ID_METADATA, ServerTreeList::OnMetadataLoaded)
 };
 
-FXIMPLEMENT(ServerTreeList, FXTreeList, stlEventMap, ARRAYNUMBER(stlEventMap))
+FXIMPLEMENT(ServerTreeList, FXScrollArea, stlEventMap, ARRAYNUMBER(stlEventMap))
+
+// Indentation per level, which is also the space the expand box sits in.
+static constexpr int kIndent = 16;
+static constexpr int kBoxSize = 9;
+static constexpr int kRowPad = 1;
+static constexpr int kMargin = 2;
 
 ServerTreeList::ServerTreeList(FXComposite *parent, FXObject *qtTarget) :
-  FXTreeList(parent, this, ID_REQUEST_TREE,
-      FRAME_SUNKEN | FRAME_THICK | LAYOUT_FILL_X | LAYOUT_FILL_Y |
-      LAYOUT_TOP | LAYOUT_RIGHT | TREELIST_SHOWS_BOXES | TREELIST_SHOWS_LINES |
-      TREELIST_SINGLESELECT), queryTool{qtTarget}
+  FXScrollArea(parent, FRAME_SUNKEN | FRAME_THICK | LAYOUT_FILL_X | LAYOUT_FILL_Y |
+      LAYOUT_TOP | LAYOUT_RIGHT), queryTool{qtTarget}
 {
+  flags |= FLAG_ENABLED;
+  backColor = FXRGB(255, 255, 255);
+  font = getApp()->getNormalFont();
+
   ico_root = new FXXPMIcon(getApp(), root_xpm);
   ico_server = new FXXPMIcon(getApp(), server_xpm);
+
+  metadata = new MetadataWorker(getApp(), this, ID_METADATA);
 }
 
 ServerTreeList::~ServerTreeList()
 {
   saveConfig();
 
+  delete metadata;
+
   // Cleanup icons
   delete ico_root;
   delete ico_server;
@@ -62,29 +78,328 @@ ServerTreeList::~ServerTreeList()
 
 void ServerTreeList::create()
 {
-  FXTreeList::create();
+  FXScrollArea::create();
 
   ico_root->create();
   ico_server->create();
-
-  m_root = appendItem(nullptr, "Servers", ico_root, ico_root);
-  m_root->setHasItems(true);
+  font->create();
+  rowHeight = FXMAX(font->getFontHeight(), ico_server->getHeight()) + 2 * kRowPad;
 
   // Load servers resource
   loadConfig();
 
   for (auto& server : ServerList) {
-    FXString label = server.name + " (";
-    label += server.user;
-    label += ")";
+    tree.AddServer(&server);
+  }
+  recalc();
+}
+
+bool ServerTreeList::canFocus() const
+{
+  return true;
+}
+
+FXint ServerTreeList::getContentWidth()
+{
+  return widest;
+}
+
+FXint ServerTreeList::getContentHeight()
+{
+  return tree.rowCount() * rowHeight;
+}
+
+void ServerTreeList::layout()
+{
+  placeScrollBars(width, height);
+
+  vertical->setLine(rowHeight);
+  horizontal->setLine(kIndent);
+
+  update();
+  flags &= ~FLAG_DIRTY;
+}
+
+int ServerTreeList::rowAt(FXint y) const
+{
+  int row = (y - pos_y) / rowHeight;
+  if (y < pos_y || row >= tree.rowCount())
+    return -1;
+  return row;
+}
+
+void ServerTreeList::updateRow(int row)
+{
+  if (row < 0)
+    return;
+
+  update(0, pos_y + row * rowHeight, getViewportWidth(), rowHeight);
+}
+
+void ServerTreeList::select(int row)
+{
+  updateRow(tree.current());
+  tree.setCurrent(row);
+  updateRow(row);
+
+  if (row < 0)
+    return;
+
+  // Scroll the line into view.
+  FXint y = row * rowHeight;
+  if (y + pos_y < 0) {
+    setPosition(pos_x, -y);
+  } else if (y + pos_y + rowHeight > getViewportHeight()) {
+    setPosition(pos_x, getViewportHeight() - y - rowHeight);
+  }
+}
+
+void ServerTreeList::toggle(int row)
+{
+  ObjectTree::Kind kind = tree.row(row).kind;
+
+  if (tree.row(row).expanded) {
+    tree.Collapse(row);
+  } else if (tree.hasChildren(row)) {
+    tree.Expand(row);
+
+    // Show what is cached at once; the worker catches up with the server.
+    if (kind == ObjectTree::ServerNode) {
+      metadata->Request(tree.serverOf(row));
+    } else if (kind == ObjectTree::DatabaseNode) {
+      metadata->Request(tree.serverOf(row), tree.databaseOf(row));
+    }
+  }
+
+  recalc();
+  update();
+}
+
+Server *ServerTreeList::currentServer() const
+{
+  int row = tree.current();
+  if (row < 0 || tree.row(row).kind != ObjectTree::ServerNode)
+    return nullptr;
+  return tree.serverOf(row);
+}
+
+long ServerTreeList::OnPaint(FXObject*, FXSelector, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+  FXDCWindow dc(this, ev);
+
+  dc.setForeground(backColor);
+  dc.fillRectangle(ev->rect_x, ev->rect_y, ev->rect_w, ev->rect_h);
+
+  // Only lines intersecting the dirty rectangle are visited.
+  FXint ylo = FXMAX(ev->rect_y, 0);
+  FXint yhi = FXMIN(ev->rect_y + ev->rect_h, getViewportHeight());
+  if (ylo >= yhi || tree.rowCount() == 0)
+    return 1;
+  int firstRow = FXMAX((ylo - pos_y) / rowHeight, 0);
+  int lastRow = FXMIN((yhi - pos_y) / rowHeight + 1, tree.rowCount());
+
+  dc.setFont(font);
+  FXint ascent = font->getFontAscent();
+  FXint textY = (rowHeight - font->getFontHeight()) / 2 + ascent;
+  FXint right = 0;
+
+  for (int r = firstRow; r < lastRow; r++) {
+    const ObjectTree::Row& row = tree.row(r);
+    FXint x = pos_x + kMargin + row.depth * kIndent;
+    FXint y = pos_y + r * rowHeight;
+
+    if (tree.hasChildren(r)) {
+      FXint bx = x + (kIndent - kBoxSize) / 2;
+      FXint by = y + (rowHeight - kBoxSize) / 2;
+      FXint mid = kBoxSize / 2;
+      dc.setForeground(FXRGB(128, 128, 128));
+      dc.drawRectangle(bx, by, kBoxSize - 1, kBoxSize - 1);
+      dc.setForeground(FXRGB(0, 0, 0));
+      dc.drawLine(bx + 2, by + mid, bx + kBoxSize - 3, by + mid);
+      if (!row.expanded) {
+        dc.drawLine(bx + mid, by + 2, bx + mid, by + kBoxSize - 3);
+      }
+    }
+    x += kIndent;
+
+    FXIcon *icon = nullptr;
+    if (row.kind == ObjectTree::RootNode) {
+      icon = ico_root;
+    } else if (row.kind == ObjectTree::ServerNode) {
+      icon = ico_server;
+    }
+    if (icon != nullptr) {
+      dc.drawIcon(icon, x, y + (rowHeight - icon->getHeight()) / 2);
+      x += icon->getWidth() + kMargin;
+    }
+
+    FXString label = tree.label(r);
+    FXint tw = font->getTextWidth(label);
+    if (r == tree.current()) {
+      dc.setForeground(getApp()->getSelbackColor());
+      dc.fillRectangle(x, y, tw + 2 * kMargin, rowHeight);
+      dc.setForeground(getApp()->getSelforeColor());
+    } else {
+      dc.setForeground(FXRGB(0, 0, 0));
+    }
+    dc.drawText(x + kMargin, y + textY, label);
+
+    right = FXMAX(right, x + tw + 2 * kMargin - pos_x);
+  }
+
+  // Widths are only known for lines that were painted.
+  if (right > widest) {
+    widest = right;
+    recalc();
+  }
+  return 1;
+}
+
+long ServerTreeList::OnCmdTreeLeftClick(FXObject *obj, FXSelector, void* ptr)
+{
+  FXEvent* event=(FXEvent*)ptr;
+
+  setFocus();
+
+  // Locate item
+  int row = rowAt(event->win_y);
+  if (row < 0) {
+    select(-1);
+    return 1;
+  }
+
+  // Expand box, or a double click anywhere on the line.
+  FXint box = pos_x + kMargin + tree.row(row).depth * kIndent;
+  if ((event->win_x >= box && event->win_x < box + kIndent) || event->click_count == 2) {
+    select(row);
+    toggle(row);
+    return 1;
+  }
+
+  select(row);
+  return 1;
+}
+
+long ServerTreeList::OnCmdTreeRightClick(FXObject* obj, FXSelector, void* ptr)
+{
+  const FXEvent* event = (FXEvent*)ptr;
+  int row = rowAt(event->click_y);
+
+  FXMenuPane serverMenu(this);
+
+  if (row < 0) {
+    new FXMenuCommand(&serverMenu, "Add new server...", nullptr, this, ID_NEW);
+  } else {
+    select(row);
 
-    appendItem(m_root, label, ico_server, ico_server, &server);
+    // Databases and their objects have no commands (yet).
+    if (tree.row(row).kind != ObjectTree::ServerNode)
+      return 1;
+
+    new FXMenuCommand(&serverMenu, "Connect to server", nullptr, this, ID_CONNECT);
+    new FXMenuCommand(&serverMenu, "Disconnect", nullptr, this, ID_DISCONNECT);
+    new FXMenuCommand(&serverMenu, "Edit server...", nullptr, this, ID_EDIT);
+    new FXMenuCommand(&serverMenu, "Delete Server", nullptr, this, ID_DELETE);
   }
 
-  if (!ServerList.empty()) {
-    expandTree(m_root, false);
+  serverMenu.create();
+  serverMenu.popup(nullptr, event->root_x, event->root_y);
+  getApp()->runModalWhileShown(&serverMenu);
+  return 1;
+}
+
+long ServerTreeList::OnKeyPress(FXObject *sender, FXSelector sel, void *ptr)
+{
+  auto *ev = static_cast<FXEvent *>(ptr);
+  int row = tree.current();
+
+  switch (ev->code) {
+    case KEY_Up:
+      if (row > 0) {
+        select(row - 1);
+      }
+      return 1;
+    case KEY_Down:
+      if (row + 1 < tree.rowCount()) {
+        select(row + 1);
+      }
+      return 1;
+    case KEY_Left:
+      if (row < 0)
+        return 1;
+      if (tree.row(row).expanded) {
+        toggle(row);
+      } else if (tree.parentOf(row) >= 0) {
+        select(tree.parentOf(row));
+      }
+      return 1;
+    case KEY_Right:
+      if (row >= 0 && !tree.row(row).expanded) {
+        toggle(row);
+      }
+      return 1;
+    case KEY_Return:
+    case KEY_KP_Enter:
+      if (row >= 0) {
+        toggle(row);
+      }
+      return 1;
+    default:
+      break;
   }
+  return FXScrollArea::onKeyPress(sender, sel, ptr);
+}
 
+long ServerTreeList::OnMetadataLoaded(FXObject *, FXSelector, void *)
+{
+  for (const auto& update : metadata->takeUpdates()) {
+    if (update.server == nullptr) {
+      if (finder != nullptr) {
+        finder->indexChanged();
+      }
+    } else if (update.database.empty()) {
+      tree.DatabasesChanged(update.server);
+    } else {
+      tree.ObjectsChanged(update.server, update.database);
+    }
+  }
+  recalc();
+  update();
+  return 1;
+}
+
+void ServerTreeList::FindObject()
+{
+  for (const auto& server : ServerList) {
+    metadata->Index(&server);
+  }
+
+  ObjectFinder dlg(this, metadata);
+  finder = &dlg;
+  bool chosen = dlg.execute(PLACEMENT_OWNER);
+  finder = nullptr;
+
+  std::shared_ptr<const ObjectIndex> index;
+  ObjectIndex::Entry entry;
+  if (!chosen || !dlg.selection(index, entry))
+    return;
+
+  const Server *server = index->server(entry);
+  const std::string& database = index->database(entry);
+  const auto& object = index->object(entry);
+  std::string column = entry.column >= 0 ? object.columns[entry.column].name : std::string();
+
+  int row = tree.Reveal(server, database, object.id, column);
+
+  // The server and database were opened on the way.
+  metadata->Request(server);
+  metadata->Request(server, database);
+
+  recalc();
+  layout();
+  select(row);
+  setFocus();
 }
 
 long ServerTreeList::OnAddNewServer(FX::FXObject *, FX::FXSelector, void *)
@@ -102,13 +417,12 @@ long ServerTreeList::OnAddNewServer(FX::FXObject *, FX::FXSelector, void *)
     server->user = editDlg.username();
     server->password = editDlg.password();
     server->default_database = editDlg.database();
+    server->readahead = editDlg.readahead();
+    server->mars = editDlg.mars();
 
-    FXString label = server->name + " (";
-    label += server->user;
-    label += ")";
-
-    appendItem(m_root, label, ico_server, ico_server, server);
-    expandTree(m_root, true);
+    tree.AddServer(server);
+    recalc();
+    update();
   }
   return 1;
 }
@@ -116,10 +430,14 @@ long ServerTreeList::OnAddNewServer(FX::FXObject *, FX::FXSelector, void *)
 long ServerTreeList::OnEditServer(FX::FXObject *, FX::FXSelector, void *)
 {
   // Get selected item:
-  FXTreeItem *item = getCurrentItem();
-  Server *server = nullptr;
-  if (item != nullptr) {
-    server = static_cast<Server *>(item->getData());
+  Server *server = currentServer();
+  if (server == nullptr)
+    return 1;
+
+  // The login in progress uses the current settings.
+  if (server->connecting) {
+    getApp()->beep();
+    return 1;
   }
 
   ServerEditDialog editDlg(this, server);
@@ -131,14 +449,18 @@ long ServerTreeList::OnEditServer(FX::FXObject *, FX::FXSelector, void *)
     server->user = editDlg.username();
     server->password = editDlg.password();
     server->default_database = editDlg.database();
+    server->readahead = editDlg.readahead();
+    server->mars = editDlg.mars();
 
-    FXString label = server->name + " (";
-    label += server->user;
-    label += ")";
+    // Idle connections were made with the old settings.
+    ConnectionPool::instance().CloseIdle(*server);
 
-    item->setText(label);
+    // What was loaded below it may belong to another server now.
+    metadata->Forget(server);
+    tree.ResetServer(server);
 
-    updateItem(item);
+    recalc();
+    update();
   }
   return 1;
 }
@@ -146,12 +468,21 @@ long ServerTreeList::OnEditServer(FX::FXObject *, FX::FXSelector, void *)
 long ServerTreeList::OnDeleteServer(FX::FXObject *, FX::FXSelector, void *)
 {
   // Get selected item:
-  FXTreeItem *item = getCurrentItem();
-  Server *server = nullptr;
-  if (item != nullptr) {
-    server = static_cast<Server *>(item->getData());
+  Server *server = currentServer();
+  if (server == nullptr)
+    return 1;
+
+  // Open tabs and running jobs refer to the server through their connections.
+  if (server->connecting || ConnectionPool::instance().hasConnections(*server)) {
+    FXMessageBox::error(this, MBOX_OK, "Delete Server",
+        "%s is still in use, close the tabs using it first.", server->name.text());
+    return 1;
   }
 
+  metadata->Forget(server);
+  ConnectionPool::instance().Forget(*server);
+  tree.RemoveServer(server);
+
   for (std::list<Server>::iterator it = ServerList.begin(); it != ServerList.end();) {
     if (&(*it) == server) {
       it = ServerList.erase(it);
@@ -160,70 +491,18 @@ long ServerTreeList::OnDeleteServer(FX::FXObject *, FX::FXSelector, void *)
     }
   }
 
-  removeItem(item);
-  return 1;
-}
-
-long ServerTreeList::OnCmdTreeLeftClick(FXObject *obj, FXSelector, void* ptr)
-{
-  FXEvent* event=(FXEvent*)ptr;
-  FXTreeItem *item;
-  FXint code;
-
-  printf("Got here!\n");
-
-  // Locate item
-  item=getItemAt(event->win_x,event->win_y);
-  if (item == nullptr) {
-    killSelection(true);
-    return 1;
-  }
-
-  // Find out where hit
-  code=hitItem(item,event->win_x,event->win_y);
-  printf("code = %d\n", code);
-
-  setCurrentItem(item, true);
-  // Change item selection
-  state=item->isSelected();
-  if (item->isEnabled() && !state) selectItem(item, true);
-  flags |= FLAG_PRESSED;
-  return 1;
-}
-
-long ServerTreeList::OnCmdTreeRightClick(FXObject* obj, FXSelector, void* ptr)
-{
-  const FXEvent* event = (FXEvent*)ptr;
-  FXTreeItem *item = getItemAt(event->click_x, event->click_y);
-
-  FXMenuPane serverMenu(this);
-
-  if (!item) {
-    new FXMenuCommand(&serverMenu, "Add new server...", nullptr, this, ID_NEW);
-  } else {
-    setCurrentItem(item, true);
-    state=item->isSelected();
-    if (item->isEnabled() && !state) selectItem(item, true);
-    new FXMenuCommand(&serverMenu, "Connect to server", nullptr, this, ID_CONNECT);
-    new FXMenuCommand(&serverMenu, "Disconnect", nullptr, this, ID_DISCONNECT);
-    new FXMenuCommand(&serverMenu, "Edit server...", nullptr, this, ID_EDIT);
-    new FXMenuCommand(&serverMenu, "Delete Server", nullptr, this, ID_DELETE);
-  }
-
-  serverMenu.create();
-  serverMenu.popup(nullptr, event->root_x, event->root_y);
-  getApp()->runModalWhileShown(&serverMenu);
+  recalc();
+  update();
   return 1;
 }
 
 long ServerTreeList::OnConnectServer(FX::FXObject *, FX::FXSelector, void *)
 {
-  const FXTreeItem *item = getCurrentItem();
-  if (item == nullptr) {
+  Server *server = currentServer();
+  if (server == nullptr) {
     printf("Cannot connect to non-existant item?!?\n");
     return 1;
   }
-  auto server = static_cast<Server *>(item->getData());
 
   queryTool->handle(this, FXSEL(SEL_COMMAND, ID_CONNECT), server);
 
@@ -248,6 +527,12 @@ static int getJSONInt(cJSON *root, const char *property)
   return 0;
 }
 
+static bool getJSONBool(cJSON *root, const char *property)
+{
+  const cJSON *obj = cJSON_GetObjectItem(root, property);
+  return obj != nullptr && obj->type == cJSON_True;
+}
+
 void ServerTreeList::loadConfig()
 {
   FXString serverConfig = Config::instance().dir() + "/servers.json";
@@ -289,6 +574,8 @@ void ServerTreeList::loadConfig()
     server->user = getJSONString(jsonServer, "user");
     server->password = getJSONString(jsonServer, "password");
     server->default_database = getJSONString(jsonServer, "database");
+    server->readahead = getJSONBool(jsonServer, "readahead");
+    server->mars = getJSONBool(jsonServer, "mars");
   }
 
   cJSON_Delete(json);
@@ -316,6 +603,8 @@ void ServerTreeList::saveConfig() const
     cJSON_AddStringToObject(jsonServer, "user", server.user.text());
     cJSON_AddStringToObject(jsonServer, "password", server.password.text());
     cJSON_AddStringToObject(jsonServer, "database", server.default_database.text());
+    cJSON_AddBoolToObject(jsonServer, "readahead", server.readahead);
+    cJSON_AddBoolToObject(jsonServer, "mars", server.mars);
 
     cJSON_AddItemToArray(json, jsonServer);
   }
@@ -20,44 +20,87 @@
 #include <fx.h>
 #include <list>
 
+#include "MetadataWorker.h"
+#include "ObjectFinder.h"
+#include "ObjectTree.h"
 #include "Server.h"
 
-class ServerTreeList : public FXTreeList {
+// The servers of servers.json, with their databases, objects and columns
+// below them. Lines are painted straight from an ObjectTree, the same way
+// the ResultGrid paints from a GridSource, so only the visible lines cost
+// anything no matter how many objects are expanded.
+class ServerTreeList : public FXScrollArea {
   FXDECLARE(ServerTreeList)
 public:
   explicit ServerTreeList(FXComposite *parent, FXObject *qtTarget);
   virtual ~ServerTreeList();
 
   virtual void create();
+  virtual void layout();
+  virtual FXint getContentWidth();
+  virtual FXint getContentHeight();
+  virtual bool canFocus() const;
+
+  // Ask for an object by name with the ObjectFinder and reveal it in the
+  // tree. Every server is indexed the first time this is used.
+  void FindObject();
 
   enum {
-    ID_REQUEST_TREE = FXTreeList::ID_LAST,
-    ID_NEW,
+    ID_NEW = FXScrollArea::ID_LAST,
     ID_CONNECT,
     ID_DISCONNECT,
     ID_EDIT,
-    ID_DELETE
+    ID_DELETE,
+    ID_METADATA
   };
 
   // Events.
+  long OnPaint(FXObject*, FXSelector, void*);
   long OnCmdTreeLeftClick(FXObject*, FXSelector, void*);
   long OnCmdTreeRightClick(FXObject*, FXSelector, void*);
+  long OnKeyPress(FXObject*, FXSelector, void*);
   long OnAddNewServer(FXObject*, FXSelector, void*);
   long OnEditServer(FXObject*, FXSelector, void*);
   long OnDeleteServer(FXObject*, FXSelector, void*);
   long OnConnectServer(FXObject*, FXSelector, void*);
+  long OnMetadataLoaded(FXObject*, FXSelector, void*);
 private:
   ServerTreeList() = default;
 
   void loadConfig();
   void saveConfig() const;
 
+  // Line at a window position, -1 if none.
+  int rowAt(FXint y) const;
+
+  // Expand or collapse a line, asking the MetadataWorker for what is below
+  // databases and servers as they are opened.
+  void toggle(int row);
+  void select(int row);
+  void updateRow(int row);
+
+  // Server of the selected server line, nullptr if another line is
+  // selected.
+  Server *currentServer() const;
+
   FXObject *queryTool;
 
   // Request tree view icons.
   FXIcon *ico_root;
   FXIcon *ico_server;
-  FXTreeItem *m_root;
+  FXFont *font{nullptr};
+  FXint rowHeight{1};
+
+  // Widest line painted so far.
+  FXint widest{0};
+
+  ObjectTree tree;
+
+  // Loads databases and their objects as they are expanded.
+  MetadataWorker *metadata;
+
+  // Open "Go to object" box, told when the index is rebuilt.
+  ObjectFinder *finder{nullptr};
 
   std::list<Server> ServerList;
 };
@@ -14,6 +14,9 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstring>
 #include <stdexcept>
 #include <langinfo.h>
@@ -26,6 +29,9 @@ namespace tds {
 
 static void (*g_log_func)(int level, const char *msg) = nullptr;
 
+// Longest string, in bytes, sent as NVARCHAR(4000) rather than NVARCHAR(MAX).
+static const size_t MAX_NVARCHAR_BYTES = 4000;
+
 // Sadly, FreeTDS does not seem to check the return value of this message
 // handler.
 extern "C" int
@@ -35,7 +41,11 @@ sql_db_msg_handler(const TDSCONTEXT *context, TDSSOCKET *tds, const TDSMESSAGE *
     return 0;
   }
 
-  auto *conn = static_cast<SqlConnection *>(context->parent);
+  // Sessions share the context, so messages are routed by socket.
+  auto *conn = static_cast<SqlConnection *>(tds != nullptr ? tds->parent : nullptr);
+  if (conn == nullptr) {
+    return 0;
+  }
   return conn->MsgHandler(tds, msg->msgno, msg->state, msg->severity,
   msg->message, msg->server, msg->proc_name, msg->line_number);
 }
@@ -119,7 +129,9 @@ int SqlConnection::MsgHandler(TDSSOCKET *socket, int msgno, int msgstate,
 
   printf("Error: %s", _error.c_str());
 
-  tgt->handle(this, FXSEL(SEL_COMMAND, ID_ERROR), &_error);
+  if (sink != nullptr) {
+    sink->onMessage(msgno, severity, _error);
+  }
 
   return severity > 0;
 }
@@ -153,7 +165,7 @@ void sql_startup(void (*log_func)(int, const char *))
 SqlConnection::SqlConnection(const Server& serverInfo) :
     _serverInfo{serverInfo}
 {
-  context = tds_alloc_context(this);
+  context.reset(tds_alloc_context(nullptr), tds_free_context);
   if (context == nullptr) {
     fprintf(stderr, "context cannot be null\n");
     return;
@@ -166,6 +178,12 @@ SqlConnection::SqlConnection(const Server& serverInfo) :
   context->err_handler = sql_db_err_handler;
 }
 
+SqlConnection::SqlConnection(const SqlConnection& primary, TDSSOCKET *session) :
+    _serverInfo{primary._serverInfo}, context{primary.context}, _tds{session}, session{true}
+{
+  _tds->parent = this;
+}
+
 SqlConnection::~SqlConnection()
 {
   Disconnect();
@@ -191,13 +209,18 @@ bool SqlConnection::Connect()
   tds_set_server(login, _serverInfo.server.text());
   tds_set_port(login, _serverInfo.port);
 
-  _tds = tds_alloc_socket(context, 512);
-  _tds->parent = nullptr;
+  _tds = tds_alloc_socket(context.get(), 512);
+  _tds->parent = this;
 
   TDSLOGIN *connection = tds_read_config_info(_tds, login, context->locale);
   if (!connection)
     return false;
 
+  // Ask for MARS so that OpenSession can run requests side by side over
+  // this login. Servers before 2005 ignore it. It is off unless the server
+  // is set up for it, the SMP code has not been run against many servers.
+  connection->mars = _serverInfo.mars;
+
   // Get existing locale
   char *locale = setlocale(LC_ALL, nullptr);
   const char *charset = nl_langinfo(CODESET);
@@ -233,8 +256,8 @@ bool SqlConnection::Connect()
 
   if (TDS_FAILED(tds_connect_and_login(_tds, connection))) {
     tds_free_socket(_tds);
+    _tds = nullptr;
     tds_free_login(login);
-    tds_free_context(context);
     fprintf(stderr, "There was a problem connecting to the server\n");
     return false;
   }
@@ -244,6 +267,11 @@ bool SqlConnection::Connect()
   }
   tds_free_login(connection);
 
+  // Sessions opened later share the connection and its reader.
+  if (_serverInfo.readahead && TDS_FAILED(tds_start_readahead(_tds->conn))) {
+    fprintf(stderr, "Could not start reading ahead, reading on demand\n");
+  }
+
   return true;
 }
 #if 0
@@ -260,9 +288,28 @@ void SqlConnection::run_initial_query()
 }
 
 #endif
+SqlConnection *SqlConnection::OpenSession()
+{
+#if ENABLE_ODBC_MARS
+  if (!isMars()) {
+    return nullptr;
+  }
+
+  TDSSOCKET *socket = tds_alloc_additional_socket(_tds->conn);
+  if (socket == nullptr) {
+    return nullptr;
+  }
+  return new SqlConnection(*this, socket);
+#else
+  return nullptr;
+#endif
+}
+
 void SqlConnection::Disconnect()
 {
   if (_tds != nullptr) {
+    ClearStatements();
+    tds_release_cursor(&cursor);
     tds_close_socket(_tds);
     tds_free_socket(_tds);
     _tds = nullptr;
@@ -280,10 +327,495 @@ bool SqlConnection::SubmitQuery(const char *sql)
   return true;
 }
 
-void SqlConnection::ProcessResults() {
+bool SqlConnection::EncodeQuery(const char *sql, std::string& encoded)
+{
+  size_t len;
+  const char *converted = tds_convert_string(_tds, _tds->conn->char_convs[client2ucs2], sql,
+      static_cast<int>(strlen(sql)), &len);
+  if (converted == nullptr)
+    return false;
+
+  encoded.assign(converted, len);
+  tds_convert_string_free(sql, converted);
+  return true;
+}
+
+bool SqlConnection::SubmitEncoded(const std::string& encoded)
+{
+  return TDS_SUCCEED(tds_submit_query_ucs2(_tds, encoded.data(), encoded.size()));
+}
+
+TDSPARAMINFO *SqlConnection::BuildParams(const SqlParams& params)
+{
+  TDSPARAMINFO *info = nullptr;
+
+  for (const SqlParams::Param& param : params) {
+    TDSPARAMINFO *grown = tds_alloc_param_result(info);
+    if (grown == nullptr) {
+      tds_free_param_results(info);
+      return nullptr;
+    }
+    info = grown;
+
+    TDSCOLUMN *col = info->columns[info->num_cols - 1];
+    if (!param.name.empty() && !tds_dstr_copy(&col->column_name, param.name.c_str())) {
+      tds_free_param_results(info);
+      return nullptr;
+    }
+
+    TDS_TINYINT bit;
+    TDS_INT i4;
+    TDS_INT8 i8;
+    TDS_FLOAT f8;
+    const void *value = nullptr;
+    size_t len = 0;
+
+    switch (param.type) {
+      case SqlParams::Bit:
+        tds_set_param_type(_tds->conn, col, SYBBIT);
+        bit = param.i != 0;
+        value = &bit;
+        len = sizeof(bit);
+        break;
+      case SqlParams::Int:
+        tds_set_param_type(_tds->conn, col, SYBINT4);
+        i4 = static_cast<TDS_INT>(param.i);
+        value = &i4;
+        len = sizeof(i4);
+        break;
+      case SqlParams::BigInt:
+        tds_set_param_type(_tds->conn, col, SYBINT8);
+        i8 = param.i;
+        value = &i8;
+        len = sizeof(i8);
+        break;
+      case SqlParams::Float:
+        tds_set_param_type(_tds->conn, col, SYBFLT8);
+        f8 = param.f;
+        value = &f8;
+        len = sizeof(f8);
+        break;
+      case SqlParams::NVarChar:
+        value = param.s.data();
+        len = param.s.size();
+        // fall through
+      case SqlParams::Null:
+        // Strings are always declared as NVARCHAR(4000) (or MAX when
+        // longer), never sized to the value, so that runs with different
+        // values share one plan on the server. MAX values are sent in
+        // chunks (PLP); servers before 2005 have no MAX and get NTEXT.
+        if (len > MAX_NVARCHAR_BYTES && IS_TDS72_PLUS(_tds->conn)) {
+          tds_set_param_type(_tds->conn, col, XSYBNVARCHAR);
+          col->column_varint_size = 8;
+          col->column_size = static_cast<TDS_INT>(len);
+        } else if (len > MAX_NVARCHAR_BYTES) {
+          tds_set_param_type(_tds->conn, col, SYBNTEXT);
+        } else {
+          tds_set_param_type(_tds->conn, col, XSYBNVARCHAR);
+          col->on_server.column_size = 8000;
+          col->column_size = len > 0 ? static_cast<TDS_INT>(len) : 1;
+        }
+        break;
+    }
+
+    if (tds_alloc_param_data(col) == nullptr) {
+      tds_free_param_results(info);
+      return nullptr;
+    }
+
+    if (param.type == SqlParams::Null) {
+      col->column_cur_size = -1;
+    } else if (is_blob_col(col)) {
+      auto *blob = reinterpret_cast<TDSBLOB *>(col->column_data);
+      blob->textvalue = static_cast<TDS_CHAR *>(malloc(len));
+      if (blob->textvalue == nullptr) {
+        tds_free_param_results(info);
+        return nullptr;
+      }
+      memcpy(blob->textvalue, value, len);
+      col->column_cur_size = static_cast<TDS_INT>(len);
+    } else {
+      memcpy(col->column_data, value, len);
+      col->column_cur_size = static_cast<TDS_INT>(len);
+    }
+  }
+  return info;
+}
+
+bool SqlConnection::Execute(const char *sql, const SqlParams& params)
+{
+  if (params.empty()) {
+    return SubmitQuery(sql);
+  }
+
+  TDSPARAMINFO *info = BuildParams(params);
+  if (info == nullptr) {
+    return false;
+  }
+
+  TDSRET ret = tds_submit_query_params(_tds, sql, info, nullptr);
+  tds_free_param_results(info);
+  return !TDS_FAILED(ret);
+}
+
+// Cache key of a prepared statement: the statement with runs of whitespace
+// outside of quotes collapsed, followed by the parameter types as declared
+// by BuildParams.
+static std::string StatementKey(const char *sql, const SqlParams& params)
+{
+  std::string key;
+  char quote = '\0';
+
+  for (const char *p = sql; *p != '\0'; p++) {
+    if (quote != '\0') {
+      if (*p == quote)
+        quote = '\0';
+    } else if (*p == '\'' || *p == '"') {
+      quote = *p;
+    } else if (*p == '[') {
+      quote = ']';
+    } else if (isspace(static_cast<unsigned char>(*p))) {
+      while (isspace(static_cast<unsigned char>(p[1])))
+        p++;
+      if (!key.empty() && p[1] != '\0')
+        key += ' ';
+      continue;
+    }
+    key += *p;
+  }
+
+  key += '\0';
+  for (const SqlParams::Param& param : params) {
+    switch (param.type) {
+      case SqlParams::Null: key += 'n'; break;
+      case SqlParams::Bit: key += 'b'; break;
+      case SqlParams::Int: key += 'i'; break;
+      case SqlParams::BigInt: key += 'l'; break;
+      case SqlParams::Float: key += 'f'; break;
+      case SqlParams::NVarChar:
+        key += param.s.size() > MAX_NVARCHAR_BYTES ? 'S' : 's';
+        break;
+    }
+  }
+  return key;
+}
+
+bool SqlConnection::ExecutePrepared(const char *sql, const SqlParams& params)
+{
+  TDSPARAMINFO *info = nullptr;
+  if (!params.empty()) {
+    info = BuildParams(params);
+    if (info == nullptr) {
+      return false;
+    }
+  }
+
+  std::string key = StatementKey(sql, params);
+  TDSDYNAMIC **cached = statements.find(key);
+  if (cached != nullptr && (*cached)->num_id == 0) {
+    // The prepare failed or the server no longer knows the handle.
+    TDSDYNAMIC *dyn = *cached;
+    statements.erase(key);
+    tds_deferred_unprepare(_tds->conn, dyn);
+    tds_release_dynamic(&dyn);
+    cached = nullptr;
+  }
+
+  if (cached != nullptr) {
+    TDSDYNAMIC *dyn = *cached;
+    tds_free_input_params(dyn);
+    dyn->params = info;
+    return !TDS_FAILED(tds_submit_execute(_tds, dyn));
+  }
+
+  TDSDYNAMIC *dyn = nullptr;
+  TDSRET ret = tds71_submit_prepexec(_tds, sql, nullptr, &dyn, info);
+  tds_free_param_results(info);
+  if (TDS_FAILED(ret)) {
+    return false;
+  }
+
+  std::pair<std::string, TDSDYNAMIC *> evicted;
+  if (statements.insert(key, dyn, &evicted)) {
+    // Unprepared by the library as soon as the connection is idle again.
+    tds_deferred_unprepare(_tds->conn, evicted.second);
+    tds_release_dynamic(&evicted.second);
+  }
+  return true;
+}
+
+void SqlConnection::ClearStatements()
+{
+  for (auto& statement : statements) {
+    TDSDYNAMIC *dyn = statement.second;
+    tds_dynamic_deallocated(_tds->conn, dyn);
+    tds_release_dynamic(&dyn);
+  }
+  statements.clear();
+}
+
+bool SqlConnection::ExecuteProc(const char *procName, const SqlParams& params)
+{
+  TDSPARAMINFO *info = nullptr;
+  if (!params.empty()) {
+    info = BuildParams(params);
+    if (info == nullptr) {
+      return false;
+    }
+  }
+
+  TDSRET ret = tds_submit_rpc(_tds, procName, info, nullptr);
+  tds_free_param_results(info);
+  return !TDS_FAILED(ret);
+}
+
+namespace {
+
+struct BulkContext {
+  TDSSOCKET *tds;
+  BulkRowSource *source;
+  // Ordinal of the column last filled, -1 before the first of a row.
+  int lastCol;
+};
+
+// tds_bcp_get_col_data callback, fills a column from the row source.
+TDSRET bulk_get_col_data(TDSBCPINFO *bcpinfo, TDSCOLUMN *col, int)
+{
+  auto *ctx = static_cast<BulkContext *>(bcpinfo->parent);
+
+  // Columns of a row are filled in table order, less those the server
+  // fills itself, so col is the next column or a few further.
+  TDSCOLUMN **columns = bcpinfo->bindinfo->columns;
+  int ordinal = ctx->lastCol + 1;
+  while (columns[ordinal] != col) {
+    ordinal++;
+  }
+
+  ctx->lastCol = ordinal;
+  size_t len = 0;
+  const char *text = ctx->source->value(ctx->lastCol, &len);
+  return tds_bcp_put_text(ctx->tds, col, text, len);
+}
+
+} // namespace
+
+bool SqlConnection::BulkInsert(const char *table, BulkRowSource& source, int *rowsCopied,
+    int batchRows)
+{
+  if (rowsCopied != nullptr) {
+    *rowsCopied = 0;
+  }
+
+  TDSBCPINFO *bcpinfo = tds_alloc_bcpinfo();
+  if (bcpinfo == nullptr) {
+    return false;
+  }
+
+  BulkContext ctx{_tds, &source, -1};
+  bcpinfo->parent = &ctx;
+  bcpinfo->direction = TDS_BCP_IN;
+
+  if (!tds_dstr_copy(&bcpinfo->tablename, table) ||
+      TDS_FAILED(tds_bcp_init(_tds, bcpinfo))) {
+    tds_free_bcpinfo(bcpinfo);
+    return false;
+  }
+
+  bool inBulk = TDS_SUCCEED(tds_bcp_start_copy_in(_tds, bcpinfo));
+  bool ok = inBulk;
+  int row = 0;
+  int inBatch = 0;
+  int copied = 0;
+  while (ok && source.nextRow()) {
+    ctx.lastCol = -1;
+    if (TDS_FAILED(tds_bcp_send_record(_tds, bcpinfo, bulk_get_col_data, nullptr, row))) {
+      // A row that failed before anything was written is skipped, anything
+      // else has dropped the connection.
+      if (!isAlive()) {
+        ok = inBulk = false;
+        break;
+      }
+      source.onRejected(row, ctx.lastCol);
+    } else if (++inBatch == batchRows) {
+      inBulk = false;
+      ok = TDS_SUCCEED(tds_bcp_done(_tds, &copied));
+      if (ok && rowsCopied != nullptr) {
+        *rowsCopied += copied;
+      }
+      ok = inBulk = ok && TDS_SUCCEED(tds_bcp_start(_tds, bcpinfo));
+      inBatch = 0;
+    }
+    row++;
+  }
+
+  if (inBulk) {
+    if (TDS_FAILED(tds_bcp_done(_tds, &copied))) {
+      ok = false;
+    } else if (rowsCopied != nullptr) {
+      *rowsCopied += copied;
+    }
+  }
+
+  tds_free_bcpinfo(bcpinfo);
+  return ok;
+}
+
+bool SqlConnection::OpenCursor(const char *sql, int pageRows)
+{
+  CloseCursor();
+
+  cursor = tds_alloc_cursor(_tds, "", 0, sql, static_cast<TDS_INT>(strlen(sql)));
+  if (cursor == nullptr) {
+    return false;
+  }
+
+  // A dynamic cursor opens without materializing the result set (keyset
+  // and static cursors are populated up front) and still supports relative
+  // fetches.
+  cursor->type = TDS_CUR_TYPE_DYNAMIC;
+  cursor->concurrency = TDS_CUR_CONCUR_READ_ONLY;
+  cursor->cursor_rows = pageRows;
+  cursorRow = -1;
+
+  int send = 0;
+  if (TDS_FAILED(tds_cursor_declare(_tds, cursor, nullptr, &send)) ||
+      TDS_FAILED(tds_cursor_setrows(_tds, cursor, &send)) ||
+      TDS_FAILED(tds_cursor_open(_tds, cursor, nullptr, &send)) ||
+      TDS_FAILED(tds_query_flush_packet(_tds))) {
+    tds_cursor_dealloc(_tds, cursor);
+    tds_release_cursor(&cursor);
+    return false;
+  }
+  return true;
+}
+
+bool SqlConnection::FetchCursor(int firstRow)
+{
+  if (!cursorOpen()) {
+    return false;
+  }
+
+  TDS_CURSOR_FETCH type = TDS_CURSOR_FETCH_RELATIVE;
+  TDS_INT offset = firstRow - cursorRow;
+  if (cursorRow < 0) {
+    if (firstRow == 0) {
+      type = TDS_CURSOR_FETCH_FIRST;
+    } else {
+      // Dynamic cursors can't fetch absolute rows, so go back to the start
+      // and move relative to it.
+      TDS_INT pageRows = cursor->cursor_rows;
+      cursor->cursor_rows = 1;
+      TDSRET ret = tds_cursor_fetch(_tds, cursor, TDS_CURSOR_FETCH_FIRST, 0);
+      cursor->cursor_rows = pageRows;
+      if (TDS_FAILED(ret)) {
+        return false;
+      }
+      DiscardResults();
+      offset = firstRow;
+    }
+  }
+
+  if (TDS_FAILED(tds_cursor_fetch(_tds, cursor, type, offset))) {
+    cursorRow = -1;
+    return false;
+  }
+  cursorRow = firstRow;
+  fetching = true;
+  return true;
+}
+
+void SqlConnection::CloseCursor()
+{
+  if (cursor == nullptr) {
+    return;
+  }
+
+  if (cursorOpen() && isAlive() && TDS_SUCCEED(tds_cursor_close(_tds, cursor))) {
+    DiscardResults();
+  }
+  // Frees the cursor once the server has closed it.
+  tds_cursor_dealloc(_tds, cursor);
+  tds_release_cursor(&cursor);
+  cursorRow = -1;
+}
+
+namespace {
+
+class DiscardSink : public RowSink {
+public:
+  void onResultFormat(const TDSCONTEXT *, const TDSRESULTINFO *) override {}
+  void onRowBatch(std::unique_ptr<ResultSet>&) override {}
+  void onMessage(int, int, const std::string&) override {}
+  void onDone(bool) override {}
+};
+
+} // namespace
+
+void SqlConnection::DiscardResults()
+{
+  DiscardSink discard;
+  ProcessResults(discard);
+}
+
+void SqlConnection::ResetOnNextRequest()
+{
+  if (_tds != nullptr) {
+    _tds->reset_connection = true;
+    // Resetting the session unprepares all of its statements and closes
+    // its cursors.
+    ClearStatements();
+    if (cursor != nullptr) {
+      tds_cursor_deallocated(_tds->conn, cursor);
+      tds_release_cursor(&cursor);
+    }
+  }
+}
+
+void SqlConnection::Cancel()
+{
+  if (_tds != nullptr) {
+    tds_send_cancel(_tds);
+  }
+}
+
+void SqlConnection::IdleHandler(TDSSOCKET *socket)
+{
+  static_cast<SqlConnection *>(socket->parent)->FlushBatch();
+}
+
+void SqlConnection::FlushBatch()
+{
+  _tds->idle_handler = nullptr;
+  if (batch && batch->rowCount() > 0) {
+    sink->onRowBatch(batch);
+    if (batch) {
+      batch->Clear();
+    }
+  }
+}
+
+void SqlConnection::ArmBatchTimer()
+{
+  if (!batch || batch->rowCount() == 0) {
+    _tds->idle_handler = nullptr;
+    return;
+  }
+
+  auto left = std::chrono::milliseconds(batchMs) - (std::chrono::steady_clock::now() - batchStart);
+  _tds->idle_ms = std::max(0, static_cast<int>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(left).count()));
+  _tds->idle_handler = IdleHandler;
+}
+
+void SqlConnection::ProcessResults(RowSink& rowSink) {
+  using clock = std::chrono::steady_clock;
   TDSRET rc;
   TDS_INT resulttype;
   int rows = 0;
+  int totalRows = 0;
+  const bool direct = rowSink.wantsRows();
+
+  sink = &rowSink;
 
   while ((rc = tds_process_tokens(_tds, &resulttype, nullptr, TDS_TOKEN_RESULTS)) == TDS_SUCCESS) {
     const int stop_mask = TDS_STOPAT_ROWFMT | TDS_RETURN_DONE | TDS_RETURN_ROW | TDS_RETURN_COMPUTE;
@@ -295,24 +827,52 @@ void SqlConnection::ProcessResults() {
 #endif
     switch (resulttype) {
       case TDS_ROWFMT_RESULT:
+        batch.reset();
         if (_tds->current_results != nullptr) {
-          tgt->handle(this, FXSEL(SEL_COMMAND, ID_ROW_HEADER), _tds->current_results);
+          rowSink.onResultFormat(context.get(), _tds->current_results);
         }
         break;
       case TDS_COMPUTE_RESULT:
       case TDS_ROW_RESULT:
         rows = 0;
+        // Batches hold on to the packets their values arrived in, so those
+        // values need not be copied out of them. Sinks that take rows one
+        // at a time read them from the row buffer.
+        if (_tds->current_results != nullptr && resulttype == TDS_ROW_RESULT) {
+          tds_set_in_place(_tds->current_results, !direct);
+        }
         while ((rc = tds_process_tokens(_tds, &resulttype, nullptr, stop_mask)) == TDS_SUCCESS) {
           if (resulttype != TDS_ROW_RESULT && resulttype != TDS_COMPUTE_RESULT)
             break;
 
           rows++;
+          totalRows++;
 
-          if (!_tds->current_results)
+          // Compute rows carry their own column layout, which doesn't
+          // match the result set they follow.
+          if (!_tds->current_results || resulttype == TDS_COMPUTE_RESULT)
             continue;
 
-          tgt->handle(this, FXSEL(SEL_COMMAND, ID_ROW_READ), _tds->current_results);
+          if (direct) {
+            rowSink.onRow(_tds->current_results);
+            continue;
+          }
+
+          if (!batch) {
+            batch.reset(new ResultSet(context.get(), _tds->current_results));
+          }
+          if (batch->rowCount() == 0) {
+            batchStart = clock::now();
+          }
+          batch->AddRow(_tds->current_results);
+
+          if (batch->rowCount() >= batchRows ||
+              clock::now() - batchStart >= std::chrono::milliseconds(batchMs)) {
+            FlushBatch();
+          }
+          ArmBatchTimer();
         }
+        FlushBatch();
 
 //        if (!QUIET) printf("(%d row%s affected)\n", rows, rows == 1 ? "" : "s");
         break;
@@ -326,6 +886,19 @@ void SqlConnection::ProcessResults() {
         break;
     }
   }
+
+  batch.reset();
+  sink = nullptr;
+
+  // A fetch past the last row leaves the cursor positioned after the end.
+  if (fetching) {
+    fetching = false;
+    if (totalRows == 0) {
+      cursorRow = -1;
+    }
+  }
+
+  rowSink.onDone(rc == TDS_NO_MORE_RESULTS);
 }
 
 #if 0
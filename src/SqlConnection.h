@@ -17,13 +17,21 @@
 #ifndef TDS_SQLCONNECTION_H
 #define TDS_SQLCONNECTION_H
 
+#include <chrono>
+#include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <fx.h>
 
 #include "tds/include/freetds/tds.h"
 
+#include "BulkRowSource.h"
+#include "LruCache.h"
+#include "ResultSet.h"
+#include "RowSink.h"
 #include "Server.h"
+#include "SqlParams.h"
 
 namespace tds {
 
@@ -33,31 +41,137 @@ public:
 
   ~SqlConnection();
 
-  enum {
-    ID_READ = FXMainWindow::ID_LAST+1100,
-    ID_ROW_HEADER,
-    ID_ROW_READ,
-    ID_ERROR,
-  };
-
   // No move or copy support. I don't want to deal with various pointers.
   SqlConnection(const SqlConnection&) = delete;
   SqlConnection& operator=(const SqlConnection&) = delete;
   SqlConnection(SqlConnection&&) = delete;
   SqlConnection& operator=(SqlConnection&&) = delete;
 
-  void setTarget(FXObject *target) { tgt = target; }
-
   // Executing a stored procedure or query will automatically connect
   // It should not be necessary to call this method directly.
   bool Connect();
 
   void Disconnect();
 
+  // True while logged in and the connection has not been dropped.
+  [[nodiscard]] bool isAlive() const { return _tds != nullptr && !IS_TDSDEAD(_tds); }
+
+#if ENABLE_ODBC_MARS
+  // True if the server accepted MARS at login, see OpenSession.
+  [[nodiscard]] bool isMars() const { return isAlive() && _tds->conn->mars; }
+#else
+  [[nodiscard]] bool isMars() const { return false; }
+#endif
+
+  // Open another session over this login with MARS. The session runs its
+  // own requests and results concurrently with this connection and any
+  // other session, from any thread, without another login. The caller owns
+  // the returned connection; it may outlive this one, the login is closed
+  // with the last of them. Returns nullptr if the server didn't accept MARS.
+  SqlConnection *OpenSession();
+
+  // True for connections made by OpenSession.
+  [[nodiscard]] bool isSession() const { return session; }
+
+  // Have the server clear all session state (temp tables, SET options,
+  // open transactions, current database) before it runs the next request.
+  // This is what makes it safe to hand a connection to someone else.
+  void ResetOnNextRequest();
+
+  [[nodiscard]] const Server& serverInfo() const { return _serverInfo; }
+
+  // Set by ConnectionPool when it hands the connection out, see Release.
+  void setPoolGeneration(unsigned generation) { poolGen = generation; }
+  [[nodiscard]] unsigned poolGeneration() const { return poolGen; }
+
+  // Text of the last error message the server sent.
+  [[nodiscard]] const std::string& lastError() const { return _error; }
+
   bool SubmitQuery(const char *sql);
-  void ProcessResults();
 
-  [[nodiscard]] const TDSCONTEXT* getContext() const { return context; }
+  // Convert sql to the form SubmitQuery sends it in, so the next batch of a
+  // script can be prepared while the current one runs. Safe to call while
+  // results are pending.
+  bool EncodeQuery(const char *sql, std::string& encoded);
+
+  // Submit a query prepared with EncodeQuery. Results are read with
+  // ProcessResults.
+  bool SubmitEncoded(const std::string& encoded);
+
+  // Submit sql through sp_executesql with typed parameters, referenced in
+  // sql either as ? or by @name. Unlike literals pasted into the text, this
+  // lets the server reuse the plan of a statement run over and over.
+  // Results are read with ProcessResults.
+  bool Execute(const char *sql, const SqlParams& params);
+
+  // Convenience form taking the parameter values directly:
+  //   conn->Execute("SELECT * FROM t WHERE id = ? AND name = ?", 42, "abc");
+  template <typename... Args,
+            typename = std::enable_if_t<!(std::is_same_v<std::decay_t<Args>, SqlParams> || ...)>>
+  bool Execute(const char *sql, Args&&... args)
+  {
+    SqlParams params;
+    (params.Add(std::forward<Args>(args)), ...);
+    return Execute(sql, params);
+  }
+
+  // Like Execute, but the statement is prepared on the server the first time
+  // it runs (sp_prepexec) and later runs only send its handle and the new
+  // values (sp_execute). Handles are cached per statement text and parameter
+  // types; placeholders must be written as ?.
+  bool ExecutePrepared(const char *sql, const SqlParams& params);
+
+  template <typename... Args,
+            typename = std::enable_if_t<!(std::is_same_v<std::decay_t<Args>, SqlParams> || ...)>>
+  bool ExecutePrepared(const char *sql, Args&&... args)
+  {
+    SqlParams params;
+    (params.Add(std::forward<Args>(args)), ...);
+    return ExecutePrepared(sql, params);
+  }
+
+  // Call a stored procedure as an RPC. Parameters must be named.
+  bool ExecuteProc(const char *procName, const SqlParams& params);
+
+  // Copy the rows of source into table with the bulk load protocol, which
+  // streams rows in as few packets as possible instead of running one
+  // INSERT per row. Rows are committed every batchRows rows, so a failure
+  // part way keeps the batches already sent. Rows with values that don't
+  // fit their column are reported to the source and skipped. The number of
+  // rows the server stored is returned in rowsCopied.
+  bool BulkInsert(const char *table, BulkRowSource& source, int *rowsCopied = nullptr,
+      int batchRows = 100000);
+
+  // Open a read-only dynamic server cursor over sql for browsing. The
+  // server doesn't run the query to completion; the column layout is read
+  // with ProcessResults and rows are then fetched a page of pageRows at a
+  // time with FetchCursor. A connection has at most one open cursor.
+  bool OpenCursor(const char *sql, int pageRows);
+
+  // Fetch the page of rows starting at row firstRow (0 based) of the open
+  // cursor. The rows are read with ProcessResults.
+  bool FetchCursor(int firstRow);
+
+  // Close the open cursor, if any. The connection must be idle.
+  void CloseCursor();
+
+  [[nodiscard]] bool cursorOpen() const { return cursor != nullptr && cursor->cursor_id != 0; }
+
+  // Ask the server to stop the running query by sending an attention
+  // packet. This may be called from another thread while ProcessResults is
+  // reading; the reading thread is woken and drains the results up to the
+  // server's acknowledgement.
+  void Cancel();
+
+  // Reads all results of the submitted query into sink. Rows are handed
+  // over in batches, flushed once a batch holds batchRows rows or is older
+  // than batchMs milliseconds, also while waiting for a slow server to send
+  // more. Server messages raised while reading go to the sink as well.
+  void ProcessResults(RowSink& sink);
+
+  void setBatchLimits(int rows, int ms) { batchRows = rows; batchMs = ms; }
+
+  [[nodiscard]] const TDSCONTEXT* getContext() const { return context.get(); }
 #if 0
 
   // When a query is executed freetds buffers the results into a
@@ -94,15 +208,54 @@ public:
       int severity, char *msgtext, char *srvname, char *procname, int line);
 
 private:
+  // Session over primary's login, see OpenSession.
+  SqlConnection(const SqlConnection& primary, TDSSOCKET *session);
+
+  // Build the wire form of params. Free with tds_free_param_results.
+  TDSPARAMINFO *BuildParams(const SqlParams& params);
+
+  // Read and drop the results of a request sent internally.
+  void DiscardResults();
+
+  // Hand the rows batched so far to sink, see ProcessResults.
+  void FlushBatch();
+
+  // TDSSOCKET::idle_handler, the server is slow to send the next rows.
+  static void IdleHandler(TDSSOCKET *socket);
+
+  // Have libtds call FlushBatch if the next packet is late, by the time the
+  // pending batch is batchMs old.
+  void ArmBatchTimer();
+
+  // Forget all cached prepared statements, for when the server has
+  // dropped them (connection reset or closed).
+  void ClearStatements();
+
 #if 0
   void run_initial_query();
   static std::string fix_server(const char *str);
 #endif
   const Server& _serverInfo;
-  FXObject *tgt{nullptr};
-  TDSCONTEXT *context{nullptr};
+  RowSink *sink{nullptr};
+  // Shared with the sessions opened over this login.
+  std::shared_ptr<TDSCONTEXT> context;
   TDSSOCKET *_tds{nullptr};
+  bool session{false};
+  unsigned poolGen{0};
   std::string _error;
+  int batchRows{1000};
+  int batchMs{100};
+  std::unique_ptr<ResultSet> batch;
+  std::chrono::steady_clock::time_point batchStart;
+
+  // Prepared statements keyed by normalized text and parameter types.
+  LruCache<std::string, TDSDYNAMIC *> statements{64};
+
+  // Browse cursor and the first row of its last fetch, -1 when the server
+  // side position is unknown (before the first fetch or past the end).
+  TDSCURSOR *cursor{nullptr};
+  int cursorRow{-1};
+  bool fetching{false};
 
 };
 
@@ -0,0 +1,107 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef TDS_SQLPARAMS_H
+#define TDS_SQLPARAMS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tds {
+
+// Typed parameters for a parameterized query or stored procedure call.
+// Values are only kept here; they are turned into a TDSPARAMINFO by
+// SqlConnection when the request is sent, as the wire types depend on the
+// negotiated protocol version.
+class SqlParams {
+public:
+  enum Type {
+    Null,
+    Bit,
+    Int,
+    BigInt,
+    Float,
+    NVarChar
+  };
+
+  struct Param {
+    std::string name;  // "@name", empty for positional parameters
+    Type type;
+    int64_t i;
+    double f;
+    std::string s;
+  };
+
+  SqlParams& Add(std::nullptr_t) { return Add(std::string(), nullptr); }
+  SqlParams& Add(bool value) { return Add(std::string(), value); }
+  SqlParams& Add(int value) { return Add(std::string(), value); }
+  SqlParams& Add(int64_t value) { return Add(std::string(), value); }
+  SqlParams& Add(double value) { return Add(std::string(), value); }
+  SqlParams& Add(const char *value) { return Add(std::string(), value); }
+  SqlParams& Add(const std::string& value) { return Add(std::string(), value); }
+
+  SqlParams& Add(const std::string& name, std::nullptr_t)
+  {
+    params.push_back({name, Null, 0, 0, std::string()});
+    return *this;
+  }
+  SqlParams& Add(const std::string& name, bool value)
+  {
+    params.push_back({name, Bit, value ? 1 : 0, 0, std::string()});
+    return *this;
+  }
+  SqlParams& Add(const std::string& name, int value)
+  {
+    params.push_back({name, Int, value, 0, std::string()});
+    return *this;
+  }
+  SqlParams& Add(const std::string& name, int64_t value)
+  {
+    params.push_back({name, BigInt, value, 0, std::string()});
+    return *this;
+  }
+  SqlParams& Add(const std::string& name, double value)
+  {
+    params.push_back({name, Float, 0, value, std::string()});
+    return *this;
+  }
+  SqlParams& Add(const std::string& name, const char *value)
+  {
+    if (value == nullptr)
+      return Add(name, nullptr);
+    return Add(name, std::string(value));
+  }
+  SqlParams& Add(const std::string& name, const std::string& value)
+  {
+    params.push_back({name, NVarChar, 0, 0, value});
+    return *this;
+  }
+
+  [[nodiscard]] bool empty() const { return params.empty(); }
+  [[nodiscard]] size_t size() const { return params.size(); }
+
+  std::vector<Param>::const_iterator begin() const { return params.begin(); }
+  std::vector<Param>::const_iterator end() const { return params.end(); }
+
+private:
+  std::vector<Param> params;
+};
+
+} // namespace tds
+
+#endif // TDS_SQLPARAMS_H
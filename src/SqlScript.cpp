@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#include <cctype>
+#include <cstdlib>
+
+#include "tds/include/freetds/tds.h"
+
+#include "SqlScript.h"
+
+namespace tds {
+
+static bool IsBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// If the line starting at p is a GO separator, returns true and stores the
+// start of the next line in end and the repeat count in count.
+static bool IsSeparator(const char *p, const char **end, int *count)
+{
+  while (IsBlank(*p))
+    p++;
+
+  if (tolower(static_cast<unsigned char>(p[0])) != 'g' ||
+      tolower(static_cast<unsigned char>(p[1])) != 'o')
+    return false;
+  p += 2;
+
+  *count = 1;
+  if (IsBlank(*p)) {
+    while (IsBlank(*p))
+      p++;
+    if (isdigit(static_cast<unsigned char>(*p))) {
+      char *digitsEnd;
+      long n = strtol(p, &digitsEnd, 10);
+      if (n < 1)
+        return false;
+      *count = n > 0x7fffffff ? 0x7fffffff : static_cast<int>(n);
+      p = digitsEnd;
+      while (IsBlank(*p))
+        p++;
+    }
+  }
+
+  if (p[0] == '-' && p[1] == '-') {
+    while (*p != '\0' && *p != '\n')
+      p++;
+  }
+  if (*p == '\n') {
+    p++;
+  } else if (*p != '\0') {
+    return false;
+  }
+
+  *end = p;
+  return true;
+}
+
+static void AddBatch(std::vector<SqlBatch>& batches, const char *start, const char *end,
+    int line, int count)
+{
+  for (const char *p = start; p < end; p++) {
+    if (!IsBlank(*p) && *p != '\n') {
+      batches.push_back({std::string(start, end), line, count});
+      return;
+    }
+  }
+}
+
+std::vector<SqlBatch> SplitBatches(const char *script)
+{
+  std::vector<SqlBatch> batches;
+  const char *start = script;
+  const char *p = script;
+  int line = 1;
+  int startLine = 1;
+  bool lineStart = true;
+
+  while (*p != '\0') {
+    const char *end;
+    int count;
+
+    if (lineStart) {
+      lineStart = false;
+      if (IsSeparator(p, &end, &count)) {
+        AddBatch(batches, start, p, startLine, count);
+        if (end[-1] == '\n') {
+          line++;
+          lineStart = true;
+        }
+        p = start = end;
+        startLine = line;
+        continue;
+      }
+    }
+
+    switch (*p) {
+      case '\'':
+      case '"':
+      case '[':
+        end = tds_skip_quoted(p);
+        break;
+      case '-':
+      case '/':
+        end = tds_skip_comment(p);
+        break;
+      default:
+        end = p + 1;
+        break;
+    }
+
+    // Quoted text and comments may span lines. A line comment ends with
+    // its line break, so the next line may be a separator.
+    for (; p < end; p++) {
+      if (*p == '\n')
+        line++;
+    }
+    lineStart = end[-1] == '\n';
+  }
+
+  AddBatch(batches, start, p, startLine, 1);
+  return batches;
+}
+
+} // namespace tds
@@ -0,0 +1,42 @@
+//
+// Copyright (c) 2024 Devin Smith <devin@devinsmith.net>
+//
+// Permission to use, copy, modify, and distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+//
+
+
+#ifndef TDS_SQLSCRIPT_H
+#define TDS_SQLSCRIPT_H
+
+#include <string>
+#include <vector>
+
+namespace tds {
+
+// One batch of a script, as sent to the server in a single request.
+struct SqlBatch {
+  std::string sql;
+  int line;        // line of the script the batch starts on, from 1
+  int count;       // times to run the batch, from "GO count"
+};
+
+// Split a script into batches at GO separators, the way sqlcmd and SSMS
+// do. A separator is GO on a line of its own, in any case, optionally
+// followed by a repeat count and a -- comment. GO inside a string, quoted
+// identifier or comment is left alone. Batches holding nothing but white
+// space are dropped.
+std::vector<SqlBatch> SplitBatches(const char *script);
+
+} // namespace tds
+
+#endif // TDS_SQLSCRIPT_H
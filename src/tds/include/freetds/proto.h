@@ -343,6 +343,17 @@ typedef enum tds_packet_type
 	TDS72_SMP = 0x53
 } TDS_PACKET_TYPE;
 
+/**
+ * Status bits of the packet header
+ */
+enum tds_packet_status
+{
+	TDS_STATUS_EOM = 0x01,			/**< last packet of the message */
+	TDS_STATUS_IGNORE = 0x02,		/**< message must be ignored */
+	TDS_STATUS_RESETCONNECTION = 0x08,	/**< reset session state before processing the request (TDS 7.1+) */
+	TDS_STATUS_RESETCONNECTIONSKIPTRAN = 0x10	/**< as above but keep the transaction state */
+};
+
 /** 
  * TDS 7.1 collation informations.
  */
@@ -590,6 +590,7 @@ typedef struct tds_bcpcoldata
 {
 	TDS_UCHAR *data;
 	TDS_INT    datalen;
+	TDS_INT    datasize;	/**< bytes allocated for data */
 	bool       is_null;
 } BCPCOLDATA;
 
@@ -679,6 +680,16 @@ struct tds_column
 
 	unsigned char *column_data;
 	void (*column_data_free)(struct tds_column *column);
+
+	/**
+	 * Value left in the received packet instead of copied to column_data,
+	 * NULL if it was copied. Only set for columns marked with
+	 * tds_set_in_place(), and only valid while column_packet is the input
+	 * buffer or a reference to it is held.
+	 */
+	const unsigned char *column_ref;
+	struct tds_packet *column_packet;
+
 	unsigned char column_nullable:1;
 	unsigned char column_writeable:1;
 	unsigned char column_identity:1;
@@ -687,6 +698,7 @@ struct tds_column
 	unsigned char column_output:1;
 	unsigned char column_timestamp:1;
 	unsigned char column_computed:1;
+	unsigned char column_in_place:1;
 	TDS_UCHAR column_collation[5];
 
 	/* additional fields flags for compute results */
@@ -726,6 +738,23 @@ struct tds_column
 };
 
 
+/** How tds_get_row reads a run of columns */
+typedef enum tds_row_step_kind
+{
+	TDS_STEP_COLUMN,	/**< each through its get_data */
+	TDS_STEP_FIXED,		/**< fixed size values without length, size bytes in all */
+	TDS_STEP_NULLABLE	/**< fixed size values after a one byte length, 0 for NULL */
+} TDS_ROW_STEP_KIND;
+
+/** A run of columns of a result decoded the same way, see tds_get_row */
+typedef struct tds_row_step
+{
+	TDS_TINYINT kind;
+	TDS_USMALLINT first;
+	TDS_USMALLINT count;
+	TDS_UINT size;
+} TDSROWSTEP;
+
 /** Hold information for any results */
 typedef struct tds_result_info
 {
@@ -741,6 +770,11 @@ typedef struct tds_result_info
 
 	TDS_SMALLINT *bycolumns;
 	TDS_USMALLINT by_cols;
+
+	/** how rows are decoded, built with the first one */
+	TDSROWSTEP *row_steps;
+	TDS_USMALLINT num_row_steps;
+
 	bool rows_exist;
 	/* TODO remove ?? used only in dblib */
 	bool more_results;
@@ -954,6 +988,9 @@ typedef struct tds_dynamic
 	 */
 	TDS_TINYINT emulated;
 
+	/** true if dynamic was marked to be closed when connection is idle */
+	bool defer_close;
+
 	/* int dyn_state; */ /* TODO use it */
 	TDSPARAMINFO *res_info;	/**< query results */
 	/**
@@ -1012,6 +1049,12 @@ typedef struct tds_authentication
 	TDSRET (*handle_next)(TDSSOCKET * tds, struct tds_authentication * auth, size_t len);
 } TDSAUTHENTICATION;
 
+/** Number of size classes of the packet cache of a connection */
+#define TDS_PACKET_CLASSES 8
+
+/** Default number of packets cached per size class */
+#define TDS_PACKET_CACHE_DEPTH 8
+
 typedef struct tds_packet
 {
 	struct tds_packet *next;
@@ -1029,9 +1072,58 @@ typedef struct tds_packet
 	 */
 	unsigned data_len;
 	unsigned capacity;
+
+	/**
+	 * References to a received packet. The library holds one while the
+	 * packet is the socket's input buffer, results with values left in
+	 * place hold the others (see tds_retain_packet).
+	 */
+	volatile int refs;
+
+	/**
+	 * Cache the packet goes back to once done with, NULL to free it.
+	 * The packet holds a reference to it.
+	 */
+	struct tds_packet_cache *cache;
+
 	unsigned char buf[1];
 } TDSPACKET;
 
+/** Free packets of one size class */
+typedef struct tds_packet_class
+{
+	TDSPACKET *head;
+	/** packets in head */
+	unsigned count;
+	/** spin lock guarding head and count, see tds_spin_lock */
+	volatile int lock;
+} TDSPACKETCLASS;
+
+/** Counters of the packet cache of a connection */
+typedef struct tds_packet_cache_stats
+{
+	volatile int hits;	/**< packets taken from the cache */
+	volatile int allocs;	/**< packets allocated as the cache had none */
+	volatile int discards;	/**< packets freed as their class was full */
+} TDSPACKETCACHESTATS;
+
+/**
+ * Free packets of a connection by size class, see tds_get_packet.
+ * Packets still held by results when the connection is freed keep the
+ * cache allocated, they are freed instead of cached from then on.
+ */
+typedef struct tds_packet_cache
+{
+	TDSPACKETCLASS classes[TDS_PACKET_CLASSES];
+	/** packets kept per class, see tds_set_packet_cache_depth */
+	unsigned depth;
+	TDSPACKETCACHESTATS stats;
+	/** held by the connection and by every packet of the cache */
+	volatile int refs;
+	/** set when the connection is freed */
+	bool closed;
+} TDSPACKETCACHE;
+
 #if ENABLE_ODBC_MARS
 #define tds_packet_zero_data_start(pkt) do { (pkt)->data_start = 0; } while(0)
 #define tds_packet_get_data_start(pkt) ((pkt)->data_start)
@@ -1056,6 +1148,14 @@ struct tds_connection
 	TDSPOLLWAKEUP wakeup;
 	const TDSCONTEXT *tds_ctx;
 
+	/**
+	 * Data read from s but not consumed yet. Reads take whatever the
+	 * socket has, so several packets usually arrive with one recv.
+	 * recv_buf_pos is the next byte to hand out, recv_buf_len the end.
+	 */
+	unsigned char *recv_buf;
+	unsigned recv_buf_pos, recv_buf_len;
+
 	/** environment is shared between all sessions */
 	TDSENV env;
 
@@ -1069,6 +1169,8 @@ struct tds_connection
 	 * contains only dynamic allocated on the server
 	 */
 	TDSDYNAMIC *dyns;
+	/** counter used to generate ids of dynamic statements */
+	int num_dyn_stmts;
 
 	int char_conv_count;
 	TDSICONV **char_convs;
@@ -1094,11 +1196,21 @@ struct tds_connection
 #define TDSSOCKET_VALID(tds) (((TDS_UINTPTR)(tds)) > 1)
 	struct tds_socket **sessions;
 	unsigned num_sessions;
+	/** number of packets in packets */
+	unsigned num_recv_packets;
+
+	/**
+	 * Socket the readahead thread drives the network with, see
+	 * tds_start_readahead. NULL if sessions read the network themselves.
+	 */
+	struct tds_socket *reader;
+	tds_thread reader_thread;
+	bool reader_stop;
 #endif
 	tds_mutex list_mtx;
 
-	unsigned num_cached_packets;
-	TDSPACKET *packet_cache;
+	/** Free packets, used without list_mtx */
+	TDSPACKETCACHE *packet_cache;
 
 	int spid;
 	int client_spid;
@@ -1120,7 +1232,11 @@ struct tds_connection
  */
 struct tds_socket
 {
+#if ENABLE_ODBC_MARS
+	TDSCONNECTION *conn;
+#else
 	TDSCONNECTION conn[1];
+#endif
 
 	void *parent;
 
@@ -1157,6 +1273,26 @@ struct tds_socket
 	 */
 	TDSPACKET *frozen_packets;
 
+#if ENABLE_ODBC_MARS
+	/** SID of MARS session */
+	uint16_t sid;
+
+	/** this variable is used to wait for a packet */
+	tds_condition packet_cond;
+
+	/** packet we are trying to send to network,
+	 * we are waiting for it to be sent or cancelled */
+	TDSPACKET *sending_packet;
+	/** sequence number of the next packet expected from the server */
+	TDS_UINT recv_seq;
+	/** sequence number of the last packet we sent */
+	TDS_UINT send_seq;
+	/** highest sequence number the server is allowed to send */
+	TDS_UINT recv_wnd;
+	/** highest sequence number we are allowed to send */
+	TDS_UINT send_wnd;
+#endif
+
 	/* packet we received */
 	TDSPACKET *recv_packet;
 	/** packet we are preparing to send */
@@ -1176,6 +1312,7 @@ struct tds_socket
 	bool bulk_query;		/**< true is query sent was a bulk query so we need to switch state to QUERYING */
 	bool has_status; 		/**< true is ret_status is valid */
 	bool in_row;			/**< true if we are getting rows */
+	bool reset_connection;		/**< reset session state with the next request sent, see TDS_STATUS_RESETCONNECTION */
 	volatile 
 	unsigned char in_cancel; 	/**< indicate we are waiting a cancel reply; discard tokens till acknowledge; 
 	1 mean we have to send cancel packet, 2 already sent. */
@@ -1185,6 +1322,15 @@ struct tds_socket
 	TDS_INT query_timeout;
 	TDS_INT8 rows_affected;		/**< rows updated/deleted/inserted/selected, TDS_NO_COUNT if not valid */
 
+	/**
+	 * If set, tds_read_packet calls it when the next packet hasn't come
+	 * in after idle_ms milliseconds, then goes on waiting. Lets the caller
+	 * hand out what it decoded so far while the server is slow.
+	 * Called on the thread reading, at most once per packet.
+	 */
+	void (*idle_handler)(struct tds_socket *tds);
+	int idle_ms;
+
 	TDSDYNAMIC *cur_dyn;		/**< dynamic structure in use */
 
 	TDSLOGIN *login;	/**< config for login stuff. After login this field is NULL */
@@ -1247,6 +1393,7 @@ TDSCOMPUTEINFO **tds_alloc_compute_results(TDSSOCKET * tds, TDS_USMALLINT num_co
 TDSCONTEXT *tds_alloc_context(void * parent);
 void tds_free_context(TDSCONTEXT * locale);
 TDSPARAMINFO *tds_alloc_param_result(TDSPARAMINFO * old_param);
+TDSDYNAMIC *tds_alloc_dynamic(TDSCONNECTION * conn, const char *id);
 void tds_free_input_params(TDSDYNAMIC * dyn);
 void tds_release_dynamic(TDSDYNAMIC ** dyn);
 static inline
@@ -1269,6 +1416,10 @@ TDSCURSOR * tds_alloc_cursor(TDSSOCKET * tds, const char *name, TDS_INT namelen,
 void tds_free_row(TDSRESULTINFO * res_info, unsigned char *row);
 TDSSOCKET *tds_alloc_socket(TDSCONTEXT * context, unsigned int bufsize);
 TDSSOCKET *tds_alloc_additional_socket(TDSCONNECTION *conn);
+#if ENABLE_ODBC_MARS
+TDSSOCKET *tds_alloc_reader_socket(TDSCONNECTION *conn);
+void tds_free_reader_socket(TDSSOCKET *tds);
+#endif
 void tds_set_current_results(TDSSOCKET *tds, TDSRESULTINFO *info);
 void tds_detach_results(TDSRESULTINFO *info);
 void * tds_realloc(void **pp, size_t new_size);
@@ -1280,6 +1431,8 @@ void * tds_realloc(void **pp, size_t new_size);
 TDSPACKET *tds_alloc_packet(void *buf, unsigned len);
 TDSPACKET *tds_realloc_packet(TDSPACKET *packet, unsigned len);
 void tds_free_packets(TDSPACKET *packet);
+void tds_retain_packet(TDSPACKET *packet);
+void tds_release_packet(TDSPACKET *packet);
 TDSBCPINFO *tds_alloc_bcpinfo(void);
 void tds_free_bcpinfo(TDSBCPINFO *bcpinfo);
 void tds_deinit_bcpinfo(TDSBCPINFO *bcpinfo);
@@ -1306,6 +1459,7 @@ void tds_start_query(TDSSOCKET *tds, unsigned char packet_type);
 
 TDSRET tds_submit_query(TDSSOCKET * tds, const char *query);
 TDSRET tds_submit_query_params(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDSHEADERS * head);
+TDSRET tds_submit_query_ucs2(TDSSOCKET * tds, const char *query, size_t len);
 TDSRET tds_submit_queryf(TDSSOCKET * tds, const char *queryf, ...);
 TDSRET tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMIC ** dyn_out, TDSPARAMINFO * params);
 TDSRET tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDSHEADERS * head);
@@ -1337,6 +1491,7 @@ void tds_convert_string_free(const char *original, const char *converted);
 #endif
 TDSRET tds_get_column_declaration(TDSSOCKET * tds, TDSCOLUMN * curcol, char *out);
 
+TDSRET tds_query_flush_packet(TDSSOCKET *tds);
 TDSRET tds_cursor_declare(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, int *send);
 TDSRET tds_cursor_setrows(TDSSOCKET * tds, TDSCURSOR * cursor, int *send);
 TDSRET tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, int *send);
@@ -1362,6 +1517,8 @@ TDSRET tds_process_tokens(TDSSOCKET * tds, /*@out@*/ TDS_INT * result_type, /*@o
 /* data.c */
 void tds_set_param_type(TDSCONNECTION * conn, TDSCOLUMN * curcol, TDS_SERVER_TYPE type);
 void tds_set_column_type(TDSCONNECTION * conn, TDSCOLUMN * curcol, TDS_SERVER_TYPE type);
+void tds_set_in_place(TDSRESULTINFO * info, bool enable);
+TDSRET tds_get_row(TDSSOCKET * tds, TDSRESULTINFO * info);
 #ifdef WORDS_BIGENDIAN
 void tds_swap_datatype(int coltype, void *b);
 #endif
@@ -1456,6 +1613,7 @@ int tds_connection_write(TDSSOCKET *tds, const unsigned char *buf, int buflen, i
 #define TDSSELREAD  POLLIN
 #define TDSSELWRITE POLLOUT
 int tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds);
+int tds_wait_readable(TDSSOCKET * tds, int timeout_ms);
 void tds_connection_close(TDSCONNECTION *conn);
 int tds_goodread(TDSSOCKET * tds, unsigned char *buf, int buflen);
 int tds_goodwrite(TDSSOCKET * tds, const unsigned char *buffer, size_t buflen);
@@ -1464,6 +1622,7 @@ int tds_socket_set_nonblocking(TDS_SYS_SOCKET sock);
 int tds_wakeup_init(TDSPOLLWAKEUP *wakeup);
 void tds_wakeup_close(TDSPOLLWAKEUP *wakeup);
 void tds_wakeup_send(TDSPOLLWAKEUP *wakeup, char cancel);
+int tds_connection_signaled(TDSCONNECTION *conn);
 static inline TDS_SYS_SOCKET tds_wakeup_get_fd(const TDSPOLLWAKEUP *wakeup)
 {
 	return wakeup->s_signaled;
@@ -1475,11 +1634,15 @@ int tds_read_packet(TDSSOCKET * tds);
 TDSRET tds_write_packet(TDSSOCKET * tds, unsigned char final);
 #if ENABLE_ODBC_MARS
 int tds_append_cancel(TDSSOCKET *tds);
+void tds_check_cancel(TDSCONNECTION *conn);
 TDSRET tds_append_syn(TDSSOCKET *tds);
 TDSRET tds_append_fin(TDSSOCKET *tds);
 #else
 int tds_put_cancel(TDSSOCKET * tds);
 #endif
+TDSRET tds_start_readahead(TDSCONNECTION *conn);
+void tds_set_packet_cache_depth(TDSCONNECTION *conn, unsigned depth);
+void tds_stop_readahead(TDSCONNECTION *conn);
 
 typedef struct tds_freeze {
 	/** which socket we refer to */
@@ -1590,6 +1753,7 @@ TDSRET tds_bcp_send_record(TDSSOCKET *tds, TDSBCPINFO *bcpinfo, tds_bcp_get_col_
 TDSRET tds_bcp_done(TDSSOCKET *tds, int *rows_copied);
 TDSRET tds_bcp_start(TDSSOCKET *tds, TDSBCPINFO *bcpinfo);
 TDSRET tds_bcp_start_copy_in(TDSSOCKET *tds, TDSBCPINFO *bcpinfo);
+TDSRET tds_bcp_put_text(TDSSOCKET *tds, TDSCOLUMN *bcpcol, const char *text, size_t len);
 
 TDSRET tds_bcp_fread(TDSSOCKET * tds, TDSICONV * conv, FILE * stream,
 		     const char *terminator, size_t term_len, char **outbuf, size_t * outbytes);
@@ -24,7 +24,9 @@
 
 #include <tds_sysdep_public.h>
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -56,6 +58,10 @@ static inline void tds_raw_mutex_free(tds_raw_mutex *mtx) {
 
 typedef pthread_cond_t tds_condition;
 
+static inline int tds_raw_cond_init(tds_condition *cond) {
+  return pthread_cond_init(cond, NULL);
+}
+
 static inline int tds_raw_cond_destroy(tds_condition *cond) {
   return pthread_cond_destroy(cond);
 }
@@ -68,6 +74,36 @@ static inline int tds_raw_cond_wait(tds_condition *cond, tds_raw_mutex *mtx) {
   return pthread_cond_wait(cond, mtx);
 }
 
+/* Wait at most timeout_sec seconds, forever if timeout_sec <= 0.
+ * Returns ETIMEDOUT if the time elapsed without a signal. */
+static inline int tds_raw_cond_timedwait(tds_condition *cond, tds_raw_mutex *mtx, int timeout_sec) {
+  struct timespec ts;
+
+  if (timeout_sec <= 0)
+    return pthread_cond_wait(cond, mtx);
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeout_sec;
+  return pthread_cond_timedwait(cond, mtx, &ts);
+}
+
+/* Wait at most timeout_ms milliseconds, not at all if timeout_ms <= 0.
+ * Returns ETIMEDOUT if the time elapsed without a signal. */
+static inline int tds_raw_cond_timedwait_ms(tds_condition *cond, tds_raw_mutex *mtx, int timeout_ms) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  if (timeout_ms > 0) {
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+  }
+  return pthread_cond_timedwait(cond, mtx, &ts);
+}
+
 #define TDS_HAVE_MUTEX 1
 
 typedef pthread_t tds_thread;
@@ -103,6 +139,32 @@ static inline int tds_thread_is_current(tds_thread_id th) {
   return pthread_equal(th, pthread_self());
 }
 
+/* Reference counts shared between threads. Returns the new count. */
+static inline int tds_atomic_inc(volatile int *value) {
+  return __atomic_add_fetch(value, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns the new count. */
+static inline int tds_atomic_dec(volatile int *value) {
+  return __atomic_sub_fetch(value, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline int tds_atomic_get(const volatile int *value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+/* Locks held for a few instructions, e.g. to push or pop a list head. */
+static inline void tds_spin_lock(volatile int *lock) {
+  while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+      sched_yield();
+}
+
+static inline void tds_spin_unlock(volatile int *lock) {
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#  define tds_cond_init tds_raw_cond_init
 #  define tds_cond_destroy tds_raw_cond_destroy
 #  define tds_cond_signal tds_raw_cond_signal
 #    define TDS_MUTEX_INITIALIZER TDS_RAW_MUTEX_INITIALIZER
@@ -114,6 +176,8 @@ static inline int tds_thread_is_current(tds_thread_id th) {
 #    define tds_mutex_init tds_raw_mutex_init
 #    define tds_mutex_free tds_raw_mutex_free
 #    define tds_cond_wait tds_raw_cond_wait
+#    define tds_cond_timedwait tds_raw_cond_timedwait
+#    define tds_cond_timedwait_ms tds_raw_cond_timedwait_ms
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,617 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2008-2010  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * \file
+ * \brief Handle bulk copy
+ *
+ * Only the TDS 7+ bulk load (BCP in) is implemented. The table layout is
+ * read with a FMTONLY query, an INSERT BULK statement switches the
+ * connection to bulk state and rows are then streamed as a COLMETADATA
+ * token followed by one ROW token per record, in as few packets as the
+ * packet size allows.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <freetds/tds.h>
+#include <freetds/convert.h>
+#include <freetds/iconv.h>
+#include <freetds/utils/string.h>
+#include <freetds/replacements.h>
+
+/**
+ * Tell if a column is sent in bulk records. Timestamp and computed columns
+ * are filled by the server, identity columns too unless identity insert
+ * was requested.
+ */
+static bool
+tds_bcp_is_sent(const TDSBCPINFO *bcpinfo, const TDSCOLUMN *bcpcol)
+{
+	if (!bcpinfo->identity_insert_on && bcpcol->column_identity)
+		return false;
+	return !bcpcol->column_timestamp && !bcpcol->column_computed;
+}
+
+/**
+ * Quote each part of a dotted table name, so names with spaces, dots or
+ * reserved words can be pasted in the statements sent for the copy.
+ * Parts already in brackets or double quotes are kept as they are, so
+ * quoting twice changes nothing.
+ * \tds
+ * \param tablename table name, replaced by the quoted name
+ * \return TDS_SUCCESS, or TDS_FAIL if out of memory or a quote isn't closed
+ */
+static TDSRET
+tds_bcp_quote_tablename(TDSSOCKET *tds, DSTR *tablename)
+{
+	const char *p = tds_dstr_cstr(tablename), *end;
+	size_t len = tds_dstr_len(tablename);
+	char *quoted, *out;
+	bool ok;
+
+	/* every character doubled, and quotes around up to len + 1 parts */
+	quoted = out = tds_new(char, len * 5 + 3);
+	if (!quoted)
+		return TDS_FAIL;
+
+	for (;;) {
+		if (*p == '[' || *p == '\"') {
+			char close = *p == '[' ? ']' : '\"';
+
+			/* a doubled closing quote stands for itself */
+			for (end = p + 1; *end; ++end) {
+				if (*end != close)
+					continue;
+				if (end[1] != close)
+					break;
+				++end;
+			}
+			if (!*end) {
+				free(quoted);
+				return TDS_FAIL;
+			}
+			++end;
+			memcpy(out, p, end - p);
+			out += end - p;
+		} else {
+			end = p + strcspn(p, ".");
+			/* an empty part is the default schema, as in db..table */
+			if (end > p)
+				out += tds_quote_id(tds, out, p, (int) (end - p));
+		}
+		p = end;
+		if (*p != '.')
+			break;
+		*out++ = *p++;
+	}
+	*out = '\0';
+
+	/* nothing may follow a quoted part but a dot */
+	ok = !*p && tds_dstr_copy(tablename, quoted) != NULL;
+	free(quoted);
+	return ok ? TDS_SUCCESS : TDS_FAIL;
+}
+
+/**
+ * Initialize BCP information.
+ * Query structure of the table to server.
+ * \tds
+ * \param bcpinfo BCP information to initialize. Structure should be allocate
+ *        and table name and direction should be already set. The table
+ *        name is quoted, see tds_bcp_quote_tablename.
+ */
+TDSRET
+tds_bcp_init(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	TDSRESULTINFO *resinfo;
+	TDSRESULTINFO *bindinfo = NULL;
+	TDSCOLUMN *curcol;
+	TDS_INT result_type;
+	int i;
+	TDSRET rc;
+	const char *fmt;
+
+	if (!IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	if (bcpinfo->direction != TDS_BCP_QUERYOUT) {
+		TDS_PROPAGATE(tds_bcp_quote_tablename(tds, &bcpinfo->tablename));
+		fmt = "SET FMTONLY ON select * from %s SET FMTONLY OFF";
+	} else {
+		fmt = "SET FMTONLY ON %s SET FMTONLY OFF";
+	}
+
+	TDS_PROPAGATE(tds_submit_queryf(tds, fmt, tds_dstr_cstr(&bcpinfo->tablename)));
+
+	while ((rc = tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_RESULTS)) == TDS_SUCCESS)
+		continue;
+	if (rc != TDS_NO_MORE_RESULTS)
+		return TDS_FAIL;
+
+	/* copy the results info from the TDS socket */
+	if (!tds->res_info)
+		return TDS_FAIL;
+
+	resinfo = tds->res_info;
+	if ((bindinfo = tds_alloc_results(resinfo->num_cols)) == NULL)
+		return TDS_FAIL;
+
+	bindinfo->row_size = resinfo->row_size;
+
+	/* Copy the column metadata */
+	rc = TDS_FAIL;
+	for (i = 0; i < bindinfo->num_cols; i++) {
+		TDSCOLUMN *src = resinfo->columns[i];
+
+		curcol = bindinfo->columns[i];
+
+		curcol->funcs = src->funcs;
+		curcol->column_type = src->column_type;
+		curcol->column_usertype = src->column_usertype;
+		curcol->column_flags = src->column_flags;
+		curcol->column_size = src->column_size;
+		curcol->column_varint_size = src->column_varint_size;
+		curcol->column_cur_size = curcol->column_varint_size == 0 ? src->column_cur_size : -1;
+		curcol->column_prec = src->column_prec;
+		curcol->column_scale = src->column_scale;
+		curcol->on_server = src->on_server;
+		curcol->char_conv = src->char_conv;
+		if (!tds_dstr_dup(&curcol->column_name, &src->column_name))
+			goto cleanup;
+		if (!tds_dstr_dup(&curcol->table_column_name, &src->table_column_name))
+			goto cleanup;
+		curcol->column_nullable = src->column_nullable;
+		curcol->column_identity = src->column_identity;
+		curcol->column_timestamp = src->column_timestamp;
+		curcol->column_computed = src->column_computed;
+		memcpy(curcol->column_collation, src->column_collation, 5);
+
+		/*
+		 * From MS documentation:
+		 * Note that for INSERT BULK operations, XMLTYPE is to be sent as NVARCHAR(N) or NVARCHAR(MAX)
+		 * data type. An error is produced if XMLTYPE is specified.
+		 */
+		if (curcol->on_server.column_type == SYBMSXML) {
+			curcol->on_server.column_type = XSYBNVARCHAR;
+			curcol->column_type = SYBVARCHAR;
+			memcpy(curcol->column_collation, tds->conn->collation, 5);
+		}
+
+		if (is_numeric_type(curcol->column_type)) {
+			curcol->bcp_column_data = tds_alloc_bcp_column_data(sizeof(TDS_NUMERIC));
+			if (!curcol->bcp_column_data)
+				goto cleanup;
+			((TDS_NUMERIC *) curcol->bcp_column_data->data)->precision = curcol->column_prec;
+			((TDS_NUMERIC *) curcol->bcp_column_data->data)->scale = curcol->column_scale;
+		} else {
+			curcol->bcp_column_data =
+				tds_alloc_bcp_column_data(curcol->column_size > curcol->on_server.column_size ?
+							  curcol->column_size : curcol->on_server.column_size);
+			if (!curcol->bcp_column_data)
+				goto cleanup;
+		}
+	}
+
+	if (bcpinfo->identity_insert_on) {
+		rc = tds_submit_queryf(tds, "set identity_insert %s on", tds_dstr_cstr(&bcpinfo->tablename));
+		if (TDS_FAILED(rc))
+			goto cleanup;
+		rc = tds_process_simple_query(tds);
+		if (TDS_FAILED(rc))
+			goto cleanup;
+	}
+
+	tds_free_results(bcpinfo->bindinfo);
+	bcpinfo->bindinfo = bindinfo;
+	bcpinfo->bind_count = 0;
+	return TDS_SUCCESS;
+
+cleanup:
+	tds_free_results(bindinfo);
+	return rc;
+}
+
+/**
+ * Append the declaration of a column to the column list of INSERT BULK.
+ * \tds
+ * \param clause     column list so far, reallocated as needed
+ * \param clause_len length of the column list
+ * \param bcpcol     column to declare
+ * \param first      true for the first column of the list
+ * \return false on unknown type or out of memory
+ */
+static bool
+tds7_build_bulk_insert_stmt(TDSSOCKET * tds, char **clause, size_t *clause_len, TDSCOLUMN * bcpcol, bool first)
+{
+	char column_type[40];
+	const char *name = tds_dstr_cstr(&bcpcol->column_name);
+	int name_len = (int) tds_dstr_len(&bcpcol->column_name);
+	size_t len;
+	char *p;
+
+	if (TDS_FAILED(tds_get_column_declaration(tds, bcpcol, column_type))) {
+		tdsdump_log(TDS_DBG_FUNC, "error: cannot build bulk insert statement. unrecognized server datatype %d\n",
+			    bcpcol->on_server.column_type);
+		return false;
+	}
+
+	len = *clause_len + (first ? 0 : 2) + tds_quote_id(tds, NULL, name, name_len) + 1 + strlen(column_type);
+	p = (char *) realloc(*clause, len + 1);
+	if (!p)
+		return false;
+	*clause = p;
+
+	p += *clause_len;
+	if (!first) {
+		memcpy(p, ", ", 2);
+		p += 2;
+	}
+	p += tds_quote_id(tds, p, name, name_len);
+	*p++ = ' ';
+	strcpy(p, column_type);
+	*clause_len = len;
+	return true;
+}
+
+/**
+ * Build the INSERT BULK statement for bcpinfo and store it in
+ * bcpinfo->insert_stmt.
+ */
+static TDSRET
+tds_bcp_start_insert_stmt(TDSSOCKET * tds, TDSBCPINFO * bcpinfo)
+{
+	char *colclause = NULL;
+	size_t colclause_len = 0;
+	char *query = NULL;
+	bool first = true;
+	int i, erc;
+
+	for (i = 0; i < bcpinfo->bindinfo->num_cols; i++) {
+		TDSCOLUMN *bcpcol = bcpinfo->bindinfo->columns[i];
+
+		if (!tds_bcp_is_sent(bcpinfo, bcpcol))
+			continue;
+		if (!tds7_build_bulk_insert_stmt(tds, &colclause, &colclause_len, bcpcol, first)) {
+			free(colclause);
+			return TDS_FAIL;
+		}
+		first = false;
+	}
+	if (!colclause)
+		return TDS_FAIL;
+
+	if (bcpinfo->hint)
+		erc = asprintf(&query, "insert bulk %s (%s) with (%s)", tds_dstr_cstr(&bcpinfo->tablename),
+			       colclause, bcpinfo->hint);
+	else
+		erc = asprintf(&query, "insert bulk %s (%s)", tds_dstr_cstr(&bcpinfo->tablename), colclause);
+	free(colclause);
+	if (erc < 0)
+		return TDS_FAIL;
+
+	free(bcpinfo->insert_stmt);
+	bcpinfo->insert_stmt = query;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Send a name as UCS-2, preceded by its length in characters.
+ * \tds
+ * \param name     name to send
+ * \param size_len bytes of the length prefix
+ */
+static void
+tds7_put_bcp_name(TDSSOCKET *tds, const DSTR *name, unsigned size_len)
+{
+	TDSFREEZE outer;
+
+	tds_freeze(tds, &outer, size_len);
+	tds_put_string(tds, tds_dstr_cstr(name), (int) tds_dstr_len(name));
+	/* UTF-16 length is always size / 2 even for 4 byte letters (yes, 1 letter of length 2) */
+	tds_freeze_close_len(&outer, (int32_t) (tds_freeze_written(&outer) - size_len) / 2);
+}
+
+/**
+ * Send the COLMETADATA token that starts the bulk records.
+ */
+static TDSRET
+tds7_bcp_send_colmetadata(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	TDSCOLUMN *bcpcol;
+	int i, num_cols;
+
+	assert(tds && bcpinfo);
+
+	if (tds->out_flag != TDS_BULK || tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	tds_put_byte(tds, TDS7_RESULT_TOKEN);	/* 0x81 */
+
+	num_cols = 0;
+	for (i = 0; i < bcpinfo->bindinfo->num_cols; i++) {
+		if (tds_bcp_is_sent(bcpinfo, bcpinfo->bindinfo->columns[i]))
+			num_cols++;
+	}
+
+	tds_put_smallint(tds, num_cols);
+
+	for (i = 0; i < bcpinfo->bindinfo->num_cols; i++) {
+		bcpcol = bcpinfo->bindinfo->columns[i];
+		if (!tds_bcp_is_sent(bcpinfo, bcpcol))
+			continue;
+
+		if (IS_TDS72_PLUS(tds->conn))
+			tds_put_int(tds, bcpcol->column_usertype);
+		else
+			tds_put_smallint(tds, bcpcol->column_usertype);
+		tds_put_smallint(tds, bcpcol->column_flags);
+		tds_put_byte(tds, bcpcol->on_server.column_type);
+
+		assert(bcpcol->funcs);
+		bcpcol->funcs->put_info(tds, bcpcol);
+
+		/* blobs are followed by the name of their table */
+		if (is_blob_type(bcpcol->on_server.column_type))
+			tds7_put_bcp_name(tds, &bcpinfo->tablename, 2);
+
+		tds7_put_bcp_name(tds, &bcpcol->column_name, 1);
+	}
+
+	tds_set_state(tds, TDS_SENDING);
+	return TDS_SUCCESS;
+}
+
+/**
+ * Start sending BCP data to server.
+ * Initialize stream to accept data.
+ * \tds
+ * \param bcpinfo BCP information already prepared
+ */
+TDSRET
+tds_bcp_start(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	if (!IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	TDS_PROPAGATE(tds_submit_query(tds, bcpinfo->insert_stmt));
+
+	/* set we want to switch to bulk state */
+	tds->bulk_query = true;
+
+	TDS_PROPAGATE(tds_process_simple_query(tds));
+
+	tds->out_flag = TDS_BULK;
+	if (tds_set_state(tds, TDS_SENDING) != TDS_SENDING)
+		return TDS_FAIL;
+
+	return tds7_bcp_send_colmetadata(tds, bcpinfo);
+}
+
+/**
+ * Start bulk copy to server.
+ * \tds
+ * \param bcpinfo BCP information already prepared
+ */
+TDSRET
+tds_bcp_start_copy_in(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	TDS_PROPAGATE(tds_bcp_start_insert_stmt(tds, bcpinfo));
+
+	return tds_bcp_start(tds, bcpinfo);
+}
+
+/**
+ * Send one row of data to server.
+ *
+ * All the values of the row are gathered before anything is written, so a
+ * row that fails conversion or has a NULL in a NOT NULL column is skipped
+ * without leaving a partial record in the stream.
+ * \tds
+ * \param bcpinfo BCP information
+ * \param get_col_data function to call to retrieve data to be sent
+ * \param null_error   function to call if we try to send NULL if not allowed
+ * \param offset       passed to get_col_data and null_error to specify the row to get
+ * \return TDS_SUCCESS, TDS_FAIL if the row was skipped (the copy can go on)
+ *         or a fatal error.
+ */
+TDSRET
+tds_bcp_send_record(TDSSOCKET *tds, TDSBCPINFO *bcpinfo,
+		    tds_bcp_get_col_data get_col_data, tds_bcp_null_error null_error, int offset)
+{
+	TDSCOLUMN *bindcol;
+	int i;
+	TDSRET rc;
+
+	if (tds->out_flag != TDS_BULK || tds->state != TDS_SENDING)
+		return TDS_FAIL;
+
+	for (i = 0; i < bcpinfo->bindinfo->num_cols; i++) {
+		bindcol = bcpinfo->bindinfo->columns[i];
+		if (!tds_bcp_is_sent(bcpinfo, bindcol))
+			continue;
+
+		rc = get_col_data(bcpinfo, bindcol, offset);
+		if (TDS_FAILED(rc)) {
+			tdsdump_log(TDS_DBG_INFO1, "get_col_data (column %d) failed\n", i + 1);
+			return TDS_FAIL;
+		}
+		if (bindcol->bcp_column_data->is_null && !bindcol->column_nullable) {
+			if (null_error)
+				null_error(bcpinfo, i, offset);
+			return TDS_FAIL;
+		}
+	}
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	tds_put_byte(tds, TDS_ROW_TOKEN);	/* 0xd1 */
+	for (i = 0; i < bcpinfo->bindinfo->num_cols; i++) {
+		TDS_INT save_size;
+		unsigned char *save_data;
+		TDSBLOB blob;
+
+		bindcol = bcpinfo->bindinfo->columns[i];
+		if (!tds_bcp_is_sent(bcpinfo, bindcol))
+			continue;
+
+		save_size = bindcol->column_cur_size;
+		save_data = bindcol->column_data;
+		assert(bindcol->column_data == NULL);
+		if (bindcol->bcp_column_data->is_null) {
+			bindcol->column_cur_size = -1;
+		} else if (is_blob_col(bindcol)) {
+			bindcol->column_cur_size = bindcol->bcp_column_data->datalen;
+			memset(&blob, 0, sizeof(blob));
+			blob.textvalue = (TDS_CHAR *) bindcol->bcp_column_data->data;
+			bindcol->column_data = (unsigned char *) &blob;
+		} else {
+			bindcol->column_cur_size = bindcol->bcp_column_data->datalen;
+			bindcol->column_data = bindcol->bcp_column_data->data;
+		}
+		rc = bindcol->funcs->put_data(tds, bindcol, 1);
+		bindcol->column_cur_size = save_size;
+		bindcol->column_data = save_data;
+
+		if (TDS_FAILED(rc)) {
+			/* the stream holds a partial record, nothing can follow it */
+			tds_connection_close(tds->conn);
+			return TDS_FAIL;
+		}
+	}
+
+	tds_set_state(tds, TDS_SENDING);
+	return TDS_SUCCESS;
+}
+
+/**
+ * Make sure the buffer of a bulk column can hold len bytes.
+ */
+static bool
+tds_bcp_reserve(BCPCOLDATA *coldata, TDS_INT len)
+{
+	TDS_UCHAR *data;
+
+	if (len <= coldata->datasize)
+		return true;
+
+	data = (TDS_UCHAR *) realloc(coldata->data, len);
+	if (!data)
+		return false;
+	coldata->data = data;
+	coldata->datasize = len;
+	return true;
+}
+
+/**
+ * Store a value given as text (in the client charset) into the bulk data
+ * of a column, converting it to the type of the column on the server.
+ * Meant to be called from a tds_bcp_get_col_data callback.
+ * \tds
+ * \param bcpcol column to fill
+ * \param text   value, NULL for NULL
+ * \param len    length of text in bytes
+ * \return TDS_FAIL if the text can't be converted to the column type
+ */
+TDSRET
+tds_bcp_put_text(TDSSOCKET *tds, TDSCOLUMN *bcpcol, const char *text, size_t len)
+{
+	BCPCOLDATA *coldata = bcpcol->bcp_column_data;
+	TDS_SERVER_TYPE desttype;
+	CONV_RESULT cr;
+	TDS_INT res;
+
+	coldata->is_null = (text == NULL);
+	coldata->datalen = 0;
+	if (text == NULL)
+		return TDS_SUCCESS;
+
+	if (is_char_type(bcpcol->on_server.column_type)) {
+		/* bulk records are sent in the server encoding */
+		const char *converted = text;
+		size_t converted_len = len;
+
+		if (bcpcol->char_conv && bcpcol->char_conv->flags != TDS_ENCODING_MEMCPY) {
+			converted = tds_convert_string(tds, bcpcol->char_conv, text, (int) len, &converted_len);
+			if (!converted)
+				return TDS_FAIL;
+		}
+		if (!tds_bcp_reserve(coldata, (TDS_INT) converted_len)) {
+			tds_convert_string_free(text, converted);
+			return TDS_FAIL;
+		}
+		memcpy(coldata->data, converted, converted_len);
+		coldata->datalen = (TDS_INT) converted_len;
+		tds_convert_string_free(text, converted);
+		return TDS_SUCCESS;
+	}
+
+	desttype = tds_get_conversion_type(bcpcol->column_type, bcpcol->column_size);
+	if (is_numeric_type(desttype)) {
+		cr.n.precision = bcpcol->column_prec;
+		cr.n.scale = bcpcol->column_scale;
+	}
+
+	res = tds_convert(tds_get_ctx(tds), SYBVARCHAR, text, (TDS_UINT) len, desttype, &cr);
+	if (res < 0)
+		return TDS_FAIL;
+
+	if (is_binary_type(desttype)) {
+		if (!tds_bcp_reserve(coldata, res)) {
+			free(cr.ib);
+			return TDS_FAIL;
+		}
+		memcpy(coldata->data, cr.ib, res);
+		free(cr.ib);
+	} else {
+		if (!tds_bcp_reserve(coldata, res))
+			return TDS_FAIL;
+		memcpy(coldata->data, &cr, res);
+	}
+	coldata->datalen = res;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Tell we finished sending BCP data to server
+ * \tds
+ * \param[out] rows_copied number of rows copied to server
+ */
+TDSRET
+tds_bcp_done(TDSSOCKET *tds, int *rows_copied)
+{
+	if (tds->out_flag != TDS_BULK || tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	tds_flush_packet(tds);
+
+	tds_set_state(tds, TDS_PENDING);
+
+	TDS_PROPAGATE(tds_process_simple_query(tds));
+
+	if (rows_copied)
+		*rows_copied = (int) tds->rows_affected;
+
+	return TDS_SUCCESS;
+}
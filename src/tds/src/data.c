@@ -690,6 +690,65 @@ error_memory:
 	return TDS_FAIL;
 }
 
+/**
+ * Let the rows of a result leave character and binary values in the
+ * received packet, pointed to by column_ref, instead of copying them to
+ * the row buffer. Values that need converting or padding, or that do not
+ * fit in one packet, are still copied.
+ * A caller that keeps column_ref past the current row must hold a
+ * reference to column_packet, see tds_retain_packet().
+ * \param info  result to change
+ * \param enable  whether values may be left in place
+ */
+void
+tds_set_in_place(TDSRESULTINFO * info, bool enable)
+{
+	TDS_USMALLINT i;
+
+	for (i = 0; i < info->num_cols; i++) {
+		TDSCOLUMN *col = info->columns[i];
+
+		col->column_in_place = enable && col->funcs->get_data == tds_generic_get
+			&& !is_blob_col(col) && col->column_varint_size != 8
+			&& (is_char_type(col->column_type) || is_binary_type(col->column_type));
+		col->column_ref = NULL;
+	}
+}
+
+/**
+ * Check whether a value can be left in the input buffer.
+ * \param tds     state information for the socket and the TDS protocol
+ * \param curcol  column the value belongs to
+ * \param colsize size of the value on the wire
+ */
+static bool
+tds_value_in_place(TDSSOCKET * tds, TDSCOLUMN * curcol, int colsize)
+{
+	/* all of it must be in this packet */
+	if (colsize > curcol->column_size || colsize > (int) (tds->in_len - tds->in_pos))
+		return false;
+
+	if (USE_ICONV && curcol->char_conv && !(curcol->char_conv->flags & TDS_ENCODING_MEMCPY))
+		return false;
+
+	/* fixed (UNI)CHAR and BINARY shorter than the column are padded */
+	if (colsize == curcol->column_size)
+		return true;
+	switch (curcol->column_type) {
+	case SYBLONGBINARY:
+		if (curcol->column_usertype != USER_UNICHAR_TYPE)
+			return true;
+	case SYBCHAR:
+	case XSYBCHAR:
+		return curcol->column_size != curcol->on_server.column_size;
+	case SYBBINARY:
+	case XSYBBINARY:
+		return false;
+	default:
+		return true;
+	}
+}
+
 /**
  * Read a data from wire
  * \param tds state information for the socket and the TDS protocol
@@ -705,6 +764,7 @@ tds_generic_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 	TDSBLOB *blob = NULL;
 
 	tdsdump_log(TDS_DBG_INFO1, "tds_get_data: type %d, varint size %d\n", curcol->column_type, curcol->column_varint_size);
+	curcol->column_ref = NULL;
 	switch (curcol->column_varint_size) {
 	case 4:
 		/* It's a BLOB... */
@@ -799,6 +859,14 @@ tds_generic_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 
 	/* non-numeric and non-blob */
 
+	if (curcol->column_in_place && tds_value_in_place(tds, curcol, colsize)) {
+		curcol->column_ref = tds->in_buf + tds->in_pos;
+		curcol->column_packet = tds->recv_packet;
+		curcol->column_cur_size = colsize;
+		tds->in_pos += colsize;
+		return TDS_SUCCESS;
+	}
+
 	if (USE_ICONV && curcol->char_conv) {
 		if (TDS_FAILED(tds_get_char_data(tds, (char *) dest, colsize, curcol)))
 			return TDS_FAIL;
@@ -849,6 +917,179 @@ tds_generic_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 	return TDS_SUCCESS;
 }
 
+/**
+ * Tell how tds_get_row can read a column.
+ * Values tds_generic_get would just copy, neither converted, padded nor
+ * left in place, are read without calling it.
+ */
+static TDS_ROW_STEP_KIND
+tds_row_step_kind(const TDSCOLUMN * col)
+{
+#ifdef WORDS_BIGENDIAN
+	/* values are swapped as they are read */
+	return TDS_STEP_COLUMN;
+#else
+	if (col->funcs->get_data != tds_generic_get || col->char_conv || is_blob_col(col)
+	    || is_char_type(col->column_type) || is_binary_type(col->column_type))
+		return TDS_STEP_COLUMN;
+
+	switch (col->column_varint_size) {
+	case 0:
+		if (col->column_size > 0 && col->column_size == tds_get_size_by_type(col->column_type))
+			return TDS_STEP_FIXED;
+		break;
+	case 1:
+		if (col->column_size > 0 && col->column_size <= 255)
+			return TDS_STEP_NULLABLE;
+		break;
+	}
+	return TDS_STEP_COLUMN;
+#endif
+}
+
+/**
+ * Split the columns of a result in runs read the same way.
+ * \return false if out of memory
+ */
+static bool
+tds_build_row_steps(TDSRESULTINFO * info)
+{
+	TDSROWSTEP *steps;
+	TDS_USMALLINT i, n = 0;
+
+	steps = tds_new(TDSROWSTEP, info->num_cols);
+	if (!steps)
+		return false;
+
+	for (i = 0; i < info->num_cols; i++) {
+		TDSCOLUMN *col = info->columns[i];
+		TDS_ROW_STEP_KIND kind = tds_row_step_kind(col);
+
+		if (n == 0 || steps[n - 1].kind != kind) {
+			steps[n].kind = kind;
+			steps[n].first = i;
+			steps[n].count = 0;
+			steps[n].size = 0;
+			++n;
+		}
+		++steps[n - 1].count;
+		if (kind == TDS_STEP_FIXED)
+			steps[n - 1].size += col->column_size;
+	}
+
+	info->row_steps = steps;
+	info->num_row_steps = n;
+	return true;
+}
+
+/* copy a fixed size value, with constant sizes for the usual widths */
+static inline void
+tds_copy_fixed(unsigned char *dest, const unsigned char *src, int size)
+{
+	switch (size) {
+	case 1:
+		*dest = *src;
+		break;
+	case 2:
+		memcpy(dest, src, 2);
+		break;
+	case 4:
+		memcpy(dest, src, 4);
+		break;
+	case 8:
+		memcpy(dest, src, 8);
+		break;
+	default:
+		memcpy(dest, src, size);
+		break;
+	}
+}
+
+/**
+ * Read a row from the wire into the columns of info.
+ * Runs of fixed size values (int, bigint, float, datetime and the like)
+ * are copied straight from the input buffer, checking once that the whole
+ * run is there, and so are nullable ones with their length byte. Other
+ * columns go through their get_data as usual, as does any value split
+ * between packets.
+ * \param tds  state information for the socket and the TDS protocol
+ * \param info result the row belongs to
+ * \return TDS_SUCCESS or TDS_FAIL
+ */
+TDSRET
+tds_get_row(TDSSOCKET * tds, TDSRESULTINFO * info)
+{
+	TDSCOLUMN **col, **end;
+	const TDSROWSTEP *step, *steps_end;
+
+	if (!info->row_steps && !tds_build_row_steps(info)) {
+		/* no plan, read them one by one */
+		for (col = info->columns, end = col + info->num_cols; col < end; ++col)
+			TDS_PROPAGATE((*col)->funcs->get_data(tds, *col));
+		return TDS_SUCCESS;
+	}
+
+	for (step = info->row_steps, steps_end = step + info->num_row_steps; step < steps_end; ++step) {
+		col = info->columns + step->first;
+		end = col + step->count;
+
+		switch (step->kind) {
+		case TDS_STEP_FIXED:
+			if (tds->in_len - tds->in_pos >= step->size) {
+				const unsigned char *src = tds->in_buf + tds->in_pos;
+
+				for (; col < end; ++col) {
+					TDSCOLUMN *curcol = *col;
+
+					tds_copy_fixed(curcol->column_data, src, curcol->column_size);
+					curcol->column_cur_size = curcol->column_size;
+					src += curcol->column_size;
+				}
+				tds->in_pos += step->size;
+				break;
+			}
+			/* split between packets */
+			for (; col < end; ++col) {
+				TDSCOLUMN *curcol = *col;
+
+				if (!tds_get_n(tds, curcol->column_data, curcol->column_size))
+					return TDS_FAIL;
+				curcol->column_cur_size = curcol->column_size;
+			}
+			break;
+
+		case TDS_STEP_NULLABLE:
+			for (; col < end; ++col) {
+				TDSCOLUMN *curcol = *col;
+				unsigned len;
+
+				/* length and value must be in this packet */
+				if (tds->in_pos >= tds->in_len
+				    || (len = tds->in_buf[tds->in_pos]) > (unsigned) curcol->column_size
+				    || len >= tds->in_len - tds->in_pos) {
+					TDS_PROPAGATE(curcol->funcs->get_data(tds, curcol));
+					continue;
+				}
+				++tds->in_pos;
+				if (len == 0) {
+					curcol->column_cur_size = -1;
+					continue;
+				}
+				tds_copy_fixed(curcol->column_data, tds->in_buf + tds->in_pos, len);
+				curcol->column_cur_size = len;
+				tds->in_pos += len;
+			}
+			break;
+
+		default:
+			for (; col < end; ++col)
+				TDS_PROPAGATE((*col)->funcs->get_data(tds, *col));
+			break;
+		}
+	}
+	return TDS_SUCCESS;
+}
+
 /**
  * Put data information to wire
  * \param tds   state information for the socket and the TDS protocol
@@ -422,10 +422,10 @@ reroute:
 	if (IS_TDS72_PLUS(tds->conn) && login->mars) {
 		TDS72_SMP_HEADER *p;
 
-		tds_extra_assert(tds->sid == 0);
-		tds_extra_assert(tds->conn->sessions[0] == tds);
-		tds_extra_assert(tds->send_packet != NULL);
-		tds_extra_assert(!tds->send_packet->next);
+		assert(tds->sid == 0);
+		assert(tds->conn->sessions[0] == tds);
+		assert(tds->send_packet != NULL);
+		assert(!tds->send_packet->next);
 
 		tds->conn->mars = 1;
 
@@ -882,7 +882,7 @@ tds71_do_login(TDSSOCKET * tds, TDSLOGIN* login)
 	tds_put_int(tds, getpid());
 	/* MARS (1 enabled) */
 	if (IS_TDS72_PLUS(tds->conn))
-		tds_put_byte(tds, 0);
+		tds_put_byte(tds, login->mars);
 	ret = tds_flush_packet(tds);
 	if (TDS_FAILED(ret))
 		return ret;
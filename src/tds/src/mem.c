@@ -97,6 +97,56 @@ tds_free_column(TDSCOLUMN *col)
 	free(col);
 }
 
+/**
+ * \fn TDSDYNAMIC *tds_alloc_dynamic(TDSCONNECTION *conn, const char *id)
+ * \brief Allocate a dynamic statement.
+ * \param conn the connection within which to allocate the statement.
+ * \param id a character label identifying the statement.
+ *        NULL to have a unique one generated.
+ * \return a pointer to the allocated structure (NULL on failure).
+ *
+ * The returned statement is referenced twice: once by the connection list
+ * and once by the caller, who should call tds_release_dynamic when done.
+ */
+TDSDYNAMIC *
+tds_alloc_dynamic(TDSCONNECTION * conn, const char *id)
+{
+	TDSDYNAMIC *dyn;
+	char tmp_id[30];
+
+	if (id) {
+		/* check to see if id already exists (shouldn't) */
+		if (tds_lookup_dynamic(conn, id))
+			return NULL;
+	} else {
+		unsigned int n;
+		id = tmp_id;
+
+		for (n = 0;;) {
+			sprintf(tmp_id, "dyn%lx_%d", (long) (TDS_INTPTR) conn, conn->num_dyn_stmts++);
+			if (!tds_lookup_dynamic(conn, tmp_id))
+				break;
+			if (++n == 256)
+				return NULL;
+		}
+	}
+
+	dyn = tds_new0(TDSDYNAMIC, 1);
+	if (!dyn)
+		return NULL;
+
+	/* take into account pointer in list */
+	dyn->ref_count = 2;
+
+	/* insert into list */
+	dyn->next = conn->dyns;
+	conn->dyns = dyn;
+
+	strlcpy(dyn->id, id, TDS_MAX_DYNID_LEN);
+
+	return dyn;
+}
+
 /**
  * \fn void tds_free_input_params(TDSDYNAMIC *dyn)
  * \brief Frees all allocated input parameters of a dynamic statement.
@@ -546,6 +596,7 @@ tds_free_results(TDSRESULTINFO * res_info)
 	}
 
 	free(res_info->bycolumns);
+	free(res_info->row_steps);
 
 	free(res_info);
 }
@@ -727,6 +778,51 @@ tds_init_login(TDSLOGIN *login, TDSLOCALE * locale)
 	return login;
 }
 
+/**
+ * Allocate a cursor and add it to the connection list.
+ * \param tds      connection the cursor belongs to
+ * \param name     name of the cursor
+ * \param namelen  length of name
+ * \param query    query of the cursor
+ * \param querylen length of query
+ * \return the cursor, referenced by both the connection and the caller,
+ *         or NULL on failure. Release with tds_release_cursor.
+ */
+TDSCURSOR *
+tds_alloc_cursor(TDSSOCKET *tds, const char *name, TDS_INT namelen, const char *query, TDS_INT querylen)
+{
+	TDSCURSOR *cursor;
+	TDSCURSOR *pcursor;
+
+	TEST_MALLOC(cursor, TDSCURSOR);
+	cursor->ref_count = 1;
+
+	cursor->type = TDS_CUR_TYPE_KEYSET;
+	cursor->concurrency = TDS_CUR_CONCUR_OPTIMISTIC;
+
+	TEST_CALLOC(cursor->cursor_name, char, namelen + 1);
+	memcpy(cursor->cursor_name, name, namelen);
+
+	TEST_CALLOC(cursor->query, char, querylen + 1);
+	memcpy(cursor->query, query, querylen);
+
+	if (tds->conn->cursors == NULL) {
+		tds->conn->cursors = cursor;
+	} else {
+		for (pcursor = tds->conn->cursors; pcursor->next; pcursor = pcursor->next)
+			continue;
+		pcursor->next = cursor;
+	}
+	/* take into account reference in connection list */
+	++cursor->ref_count;
+
+	return cursor;
+
+      Cleanup:
+	tds_release_cursor(&cursor);
+	return NULL;
+}
+
 /*
  * Called when cursor got deallocated from server
  */
@@ -882,6 +978,8 @@ tds_alloc_packet(void *buf, unsigned len)
 		packet->capacity = len;
 		packet->sid = 0;
 		packet->next = NULL;
+		packet->refs = 1;
+		packet->cache = NULL;
 		if (buf) {
 			memcpy(packet->buf, buf, len);
 			packet->data_len = len;
@@ -901,16 +999,71 @@ tds_realloc_packet(TDSPACKET *packet, unsigned len)
 	return packet;
 }
 
+static void
+tds_unref_packet_cache(TDSPACKETCACHE *cache)
+{
+	if (tds_atomic_dec(&cache->refs) == 0)
+		free(cache);
+}
+
 void
 tds_free_packets(TDSPACKET *packet)
 {
 	TDSPACKET *next;
+	TDSPACKETCACHE *cache;
+
 	for (; packet; packet = next) {
 		next = packet->next;
+		cache = packet->cache;
 		free(packet);
+		if (cache)
+			tds_unref_packet_cache(cache);
 	}
 }
 
+static TDSPACKETCACHE *
+tds_alloc_packet_cache(void)
+{
+	TDSPACKETCACHE *cache = tds_new0(TDSPACKETCACHE, 1);
+
+	if (TDS_UNLIKELY(!cache))
+		return NULL;
+	cache->depth = TDS_PACKET_CACHE_DEPTH;
+	cache->refs = 1;
+	return cache;
+}
+
+/*
+ * Free the cached packets and drop the connection's reference. Packets
+ * coming back later see the cache closed and are freed, the last one
+ * frees the cache.
+ */
+static void
+tds_free_packet_cache(TDSPACKETCACHE *cache)
+{
+	TDSPACKET *packets;
+	unsigned n;
+
+	if (!cache)
+		return;
+
+	tdsdump_log(TDS_DBG_INFO1, "packet cache: %d hits, %d allocations, %d discards\n",
+		    cache->stats.hits, cache->stats.allocs, cache->stats.discards);
+
+	cache->closed = true;
+	for (n = 0; n < TDS_PACKET_CLASSES; n++) {
+		TDSPACKETCLASS *cls = &cache->classes[n];
+
+		tds_spin_lock(&cls->lock);
+		packets = cls->head;
+		cls->head = NULL;
+		cls->count = 0;
+		tds_spin_unlock(&cls->lock);
+		tds_free_packets(packets);
+	}
+	tds_unref_packet_cache(cache);
+}
+
 static void
 tds_deinit_connection(TDSCONNECTION *conn)
 {
@@ -929,7 +1082,7 @@ tds_deinit_connection(TDSCONNECTION *conn)
 	free(conn->product_name);
 	free(conn->server);
 	tds_free_env(conn);
-	tds_free_packets(conn->packet_cache);
+	free(conn->recv_buf);
 	tds_mutex_free(&conn->list_mtx);
 #if ENABLE_ODBC_MARS
 	tds_free_packets(conn->packets);
@@ -937,6 +1090,7 @@ tds_deinit_connection(TDSCONNECTION *conn)
 	tds_free_packets(conn->send_packets);
 	free(conn->sessions);
 #endif
+	tds_free_packet_cache(conn->packet_cache);
 }
 
 static TDSCONNECTION *
@@ -947,6 +1101,9 @@ tds_init_connection(TDSCONNECTION *conn, TDSCONTEXT *context, unsigned int bufsi
 	conn->use_iconv = 1;
 	conn->tds_ctx = context;
 
+	if (TDS_UNLIKELY(!(conn->packet_cache = tds_alloc_packet_cache())))
+		goto Cleanup;
+
 	if (tds_wakeup_init(&conn->wakeup))
 		goto Cleanup;
 
@@ -956,6 +1113,11 @@ tds_init_connection(TDSCONNECTION *conn, TDSCONTEXT *context, unsigned int bufsi
 	if (tds_mutex_init(&conn->list_mtx))
 		goto Cleanup;
 
+#if ENABLE_ODBC_MARS
+	if (TDS_UNLIKELY(!(conn->sessions = tds_new0(TDSSOCKET*, 64))))
+		goto Cleanup;
+	conn->num_sessions = 64;
+#endif
 	return conn;
 
 Cleanup:
@@ -971,6 +1133,13 @@ tds_init_socket(TDSSOCKET * tds_socket, unsigned int bufsize)
 
 	tds_socket->parent = NULL;
 
+#if ENABLE_ODBC_MARS
+	if (tds_cond_init(&tds_socket->packet_cond))
+		goto Cleanup;
+	/* the server allows 4 packets till it acknowledges */
+	tds_socket->send_wnd = 4;
+#endif
+
 	tds_socket->recv_packet = tds_alloc_packet(NULL, bufsize);
 	if (!tds_socket->recv_packet)
 		goto Cleanup;
@@ -998,6 +1167,164 @@ tds_init_socket(TDSSOCKET * tds_socket, unsigned int bufsize)
 }
 
 
+#if ENABLE_ODBC_MARS
+static void
+tds_free_connection(TDSCONNECTION *conn)
+{
+	if (!conn)
+		return;
+	tds_stop_readahead(conn);
+	assert(!conn->in_net_tds);
+	tds_deinit_connection(conn);
+	free(conn);
+}
+
+static TDSCONNECTION *
+tds_alloc_connection(TDSCONTEXT *context, unsigned int bufsize)
+{
+	TDSCONNECTION *conn;
+
+	TEST_MALLOC(conn, TDSCONNECTION);
+	if (!tds_init_connection(conn, context, bufsize))
+		goto Cleanup;
+	return conn;
+
+      Cleanup:
+	tds_free_connection(conn);
+	return NULL;
+}
+
+static TDSSOCKET *
+tds_alloc_socket_base(unsigned int bufsize)
+{
+	TDSSOCKET *tds_socket;
+
+	TEST_MALLOC(tds_socket, TDSSOCKET);
+	if (!tds_init_socket(tds_socket, bufsize))
+		goto Cleanup;
+	return tds_socket;
+
+      Cleanup:
+	tds_free_socket(tds_socket);
+	return NULL;
+}
+
+TDSSOCKET *
+tds_alloc_socket(TDSCONTEXT * context, unsigned int bufsize)
+{
+	TDSCONNECTION *conn = tds_alloc_connection(context, bufsize);
+	TDSSOCKET *tds;
+
+	if (!conn)
+		return NULL;
+
+	tds = tds_alloc_socket_base(bufsize);
+	if (tds) {
+		conn->sessions[0] = tds;
+		tds->conn = conn;
+		return tds;
+	}
+	tds_free_connection(conn);
+	return NULL;
+}
+
+static bool
+tds_alloc_new_sid(TDSSOCKET *tds)
+{
+	uint16_t sid;
+	TDSCONNECTION *conn = tds->conn;
+
+	tds_mutex_lock(&conn->list_mtx);
+	for (sid = 1; sid < conn->num_sessions; ++sid)
+		if (!conn->sessions[sid])
+			break;
+	if (sid == conn->num_sessions) {
+		/* extend array, sid is a 16 bit number */
+		if (sid > 0xffff - 64 || !TDS_RESIZE(conn->sessions, sid + 64))
+			goto error;
+		memset(conn->sessions + sid, 0, sizeof(*conn->sessions) * 64);
+		conn->num_sessions += 64;
+	}
+	conn->sessions[sid] = tds;
+	tds->sid = sid;
+error:
+	tds_mutex_unlock(&conn->list_mtx);
+	return tds->sid != 0;
+}
+
+/**
+ * Open another session over the connection of a MARS login.
+ * The new socket shares the connection with the others and can run its own
+ * request at the same time. It is freed with tds_free_socket, the
+ * connection is closed when its last session is freed.
+ * @return the new session or NULL if the connection doesn't use MARS
+ */
+TDSSOCKET *
+tds_alloc_additional_socket(TDSCONNECTION *conn)
+{
+	TDSSOCKET *tds;
+
+	if (!IS_TDS72_PLUS(conn) || !conn->mars)
+		return NULL;
+
+	tds = tds_alloc_socket_base(sizeof(TDS72_SMP_HEADER) + conn->env.block_size);
+	if (!tds)
+		return NULL;
+	tds->send_packet->data_start = sizeof(TDS72_SMP_HEADER);
+	tds->out_buf = tds->send_packet->buf + sizeof(TDS72_SMP_HEADER);
+	tds->out_buf_max -= sizeof(TDS72_SMP_HEADER);
+
+	tds->conn = conn;
+	if (!tds_alloc_new_sid(tds))
+		goto Cleanup;
+
+	tds->state = TDS_IDLE;
+	if (TDS_FAILED(tds_append_syn(tds)))
+		goto Cleanup;
+
+	return tds;
+
+      Cleanup:
+	tds_free_socket(tds);
+	return NULL;
+}
+
+/**
+ * Allocate the socket the readahead thread of a connection drives the
+ * network with. It is not a session: the server does not know about it and
+ * it never sends a request of its own.
+ * Free it with tds_free_reader_socket.
+ */
+TDSSOCKET *
+tds_alloc_reader_socket(TDSCONNECTION *conn)
+{
+	TDSSOCKET *tds;
+
+	tds = tds_alloc_socket_base(512);
+	if (!tds)
+		return NULL;
+
+	tds->conn = conn;
+	/* above any sid tds_alloc_new_sid gives out */
+	tds->sid = 0xffff;
+	tds->state = TDS_IDLE;
+	return tds;
+}
+
+void
+tds_free_reader_socket(TDSSOCKET *tds)
+{
+	if (!tds)
+		return;
+
+	/* unlike tds_free_socket leave the connection alone */
+	tds_cond_destroy(&tds->packet_cond);
+	tds_mutex_free(&tds->wire_mtx);
+	tds_release_packet(tds->recv_packet);
+	tds_free_packets(tds->send_packet);
+	free(tds);
+}
+#else
 TDSSOCKET *
 tds_alloc_socket(TDSCONTEXT * context, unsigned int bufsize)
 {
@@ -1014,6 +1341,7 @@ tds_alloc_socket(TDSCONTEXT * context, unsigned int bufsize)
 	tds_free_socket(tds_socket);
 	return NULL;
 }
+#endif
 
 TDSSOCKET *
 tds_realloc_socket(TDSSOCKET * tds, size_t bufsize)
@@ -1054,16 +1382,23 @@ static void
 tds_connection_remove_socket(TDSCONNECTION *conn, TDSSOCKET *tds)
 {
 	unsigned n;
-	bool must_free_connection = true;
+	bool must_free_connection = true, ended = true;
+
+	if (!conn)
+		return;
+
 	tds_mutex_lock(&conn->list_mtx);
-	if (tds->sid < conn->num_sessions)
+	/* still registered if tds_close_socket did not end it already */
+	if (tds->sid < conn->num_sessions && conn->sessions[tds->sid] == tds) {
 		conn->sessions[tds->sid] = NULL;
+		ended = false;
+	}
 	for (n = 0; n < conn->num_sessions; ++n)
 		if (TDSSOCKET_VALID(conn->sessions[n])) {
 			must_free_connection = false;
 			break;
 		}
-	if (!must_free_connection) {
+	if (!must_free_connection && !ended) {
 		/* tds use connection member so must be valid */
 		tds_append_fin(tds);
 	}
@@ -1116,7 +1451,8 @@ tds_free_socket(TDSSOCKET * tds)
 #endif
 
 	tds_connection_remove_socket(tds->conn, tds);
-	tds_free_packets(tds->recv_packet);
+	if (tds->recv_packet)
+		tds_release_packet(tds->recv_packet);
 	if (tds->frozen_packets)
 		tds_free_packets(tds->frozen_packets);
 	else
@@ -1500,6 +1836,7 @@ tds_alloc_bcp_column_data(unsigned int column_size)
 	if (column_size > 4 * 1024)
 		column_size = 4 * 1024;
 	TEST_CALLOC(coldata->data, unsigned char, column_size);
+	coldata->datasize = column_size;
 
 	return coldata;
 Cleanup:
@@ -108,6 +108,9 @@ tds_socket_done(void)
 #undef SO_NOSIGPIPE
 #endif
 
+#undef MIN
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
 /**
  * Set socket to non-blocking
  * @param sock socket to set
@@ -316,6 +319,56 @@ typedef struct {
 	unsigned retry_count;
 } retry_addr;
 
+/** Delay between starting connection attempts to successive addresses (ms), see RFC 8305 */
+#define TDS_CONNECT_ATTEMPT_DELAY 250
+
+/**
+ * Reorder addresses so that address families alternate, keeping the
+ * resolver order within each family (RFC 8305, section 4).
+ * This way a broken IPv6 route can't delay IPv4 attempts (or vice versa).
+ */
+static void
+tds_interleave_addresses(retry_addr *addresses, int len)
+{
+	int i, j;
+
+	for (i = 1; i < len; ++i) {
+		retry_addr found;
+
+		if (addresses[i].addr->ai_family != addresses[i - 1].addr->ai_family)
+			continue;
+		for (j = i + 1; j < len; ++j)
+			if (addresses[j].addr->ai_family != addresses[i - 1].addr->ai_family)
+				break;
+		if (j >= len)
+			break;
+		found = addresses[j];
+		memmove(&addresses[i + 1], &addresses[i], (j - i) * sizeof(*addresses));
+		addresses[i] = found;
+	}
+}
+
+/**
+ * An attempt failed, start the next address waiting for its turn
+ * right away instead of waiting for the attempt delay to expire.
+ */
+static void
+tds_start_next_attempt(retry_addr *addresses, const struct pollfd *fds, int len, unsigned curr_time)
+{
+	int i, next = -1;
+
+	for (i = 0; i < len; ++i) {
+		if (!TDS_IS_SOCKET_INVALID(fds[i].fd) || addresses[i].retry_count != 0)
+			continue;
+		if ((int) (addresses[i].next_retry_time - curr_time) <= 0)
+			continue;
+		if (next < 0 || (int) (addresses[i].next_retry_time - addresses[next].next_retry_time) < 0)
+			next = i;
+	}
+	if (next >= 0)
+		addresses[next].next_retry_time = curr_time;
+}
+
 TDSERRNO
 tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int timeout, int *p_oserr)
 {
@@ -355,11 +408,21 @@ tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int ti
 	for (len = 0, curr_addr = addr; curr_addr != NULL; curr_addr = curr_addr->ai_next) {
 		fds[len].fd = INVALID_SOCKET;
 		addresses[len].addr = curr_addr;
-		addresses[len].next_retry_time = curr_time;
 		addresses[len].retry_count = 0;
 		++len;
 	}
 
+	/*
+	 * Race the addresses happy eyeballs style: start one attempt every
+	 * TDS_CONNECT_ATTEMPT_DELAY ms without waiting for the previous ones to
+	 * complete, first connected socket wins. A host with a single address
+	 * (or a multi-subnet listener answering on the first one) doesn't
+	 * flood the other addresses with SYNs.
+	 */
+	tds_interleave_addresses(addresses, len);
+	for (i = 0; i < len; ++i)
+		addresses[i].next_retry_time = curr_time + i * TDS_CONNECT_ATTEMPT_DELAY;
+
 	/* if we have only one address means that availability groups feature is not
 	 * present, avoid to check the addresses multiple times */
 	if (len == 1)
@@ -412,7 +475,9 @@ tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int ti
 					--len;
 					fds[i] = fds[len];
 					addresses[i] = addresses[len];
-					--i;
+					tds_start_next_attempt(addresses, fds, len, curr_time);
+					/* rescan, the address started may be before this one */
+					i = -1;
 					continue;
 				}
 			} else {
@@ -453,6 +518,7 @@ tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int ti
 				CLOSESOCKET(fds[i].fd);
 				fds[i].fd = INVALID_SOCKET;
 				addresses[i].next_retry_time = curr_time + 1000;
+				tds_start_next_attempt(addresses, fds, len, curr_time);
 				if (++addresses[i].retry_count >= MAX_RETRY || len == 1) {
 					--len;
 					fds[i] = fds[len];
@@ -497,10 +563,27 @@ void
 tds_close_socket(TDSSOCKET * tds)
 {
 	if (!IS_TDSDEAD(tds)) {
+#if ENABLE_ODBC_MARS
+		TDSCONNECTION *conn = tds->conn;
+		unsigned n, count = 0;
+
+		/* other sessions still use the connection, just end ours */
+		tds_mutex_lock(&conn->list_mtx);
+		for (n = 0; n < conn->num_sessions; ++n)
+			if (TDSSOCKET_VALID(conn->sessions[n]))
+				++count;
+		if (count > 1)
+			tds_append_fin(tds);
+		tds_mutex_unlock(&conn->list_mtx);
+		if (count > 1)
+			return;
+		tds_stop_readahead(conn);
+#endif
 		tds_disconnect(tds);
 		if (!TDS_IS_SOCKET_INVALID(tds_get_s(tds)) && CLOSESOCKET(tds_get_s(tds)) == -1)
 			tdserror(tds_get_ctx(tds), tds,  TDSECLOS, sock_errno);
 		tds_set_s(tds, INVALID_SOCKET);
+		tds->conn->recv_buf_pos = tds->conn->recv_buf_len = 0;
 		tds_set_state(tds, TDS_DEAD);
 	}
 }
@@ -508,13 +591,57 @@ tds_close_socket(TDSSOCKET * tds)
 void
 tds_connection_close(TDSCONNECTION *conn)
 {
-  if (!TDS_IS_SOCKET_INVALID(conn->s)) {
+#if ENABLE_ODBC_MARS
+	unsigned n;
+#endif
+
+	if (!TDS_IS_SOCKET_INVALID(conn->s)) {
 		/* TODO check error ?? how to return it ?? */
 		CLOSESOCKET(conn->s);
 		conn->s = INVALID_SOCKET;
 	}
+	conn->recv_buf_pos = conn->recv_buf_len = 0;
+
+#if ENABLE_ODBC_MARS
+	/* every session goes down with the connection */
+	tds_mutex_lock(&conn->list_mtx);
+	for (n = 0; n < conn->num_sessions; ++n)
+		if (TDSSOCKET_VALID(conn->sessions[n])) {
+			tds_set_state(conn->sessions[n], TDS_DEAD);
+			tds_cond_signal(&conn->sessions[n]->packet_cond);
+		}
+	tds_mutex_unlock(&conn->list_mtx);
+#else
+	tds_set_state((TDSSOCKET* ) conn, TDS_DEAD);
+#endif
+}
+
+/**
+ * Wait at most timeout_ms milliseconds for something to read on the
+ * socket, or for a wakeup. Unlike tds_select nothing is consumed and the
+ * interrupt handler is not called.
+ * \return >0 something to read, 0 timeout, <0 error (cf. errno)
+ */
+int
+tds_wait_readable(TDSSOCKET * tds, int timeout_ms)
+{
+	struct pollfd fds[2];
+
+	if (TDS_IS_SOCKET_INVALID(tds_get_s(tds)))
+		return -1;
 
-  tds_set_state((TDSSOCKET* ) conn, TDS_DEAD);
+	if (tds->conn->tls_session && tds_ssl_pending(tds->conn))
+		return POLLIN;
+	if (tds->conn->recv_buf_pos < tds->conn->recv_buf_len)
+		return POLLIN;
+
+	fds[0].fd = tds_get_s(tds);
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	fds[1].fd = tds_wakeup_get_fd(&tds->conn->wakeup);
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+	return poll(fds, 2, timeout_ms > 0 ? timeout_ms : 0);
 }
 
 /**
@@ -560,6 +687,10 @@ tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
 		if ((tds_sel & TDSSELREAD) != 0 && tds->conn->tls_session && tds_ssl_pending(tds->conn))
 			return POLLIN;
 
+		/* the socket may be empty with data still in our buffer */
+		if ((tds_sel & TDSSELREAD) != 0 && tds->conn->recv_buf_pos < tds->conn->recv_buf_len)
+			return POLLIN;
+
 		fds[0].fd = tds_get_s(tds);
 		fds[0].events = tds_sel;
 		fds[0].revents = 0;
@@ -635,6 +766,9 @@ tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
 	return 0;
 }
 
+/* Bytes read from the socket at once, 64 packets of the default size. */
+#define TDS_RECV_BUF_SIZE (256 * 1024)
+
 /**
  * Read from an OS socket
  * @TODO remove tds, save error somewhere, report error in another way
@@ -656,10 +790,32 @@ tds_socket_read(TDSCONNECTION * conn, TDSSOCKET *tds, unsigned char *buf, int bu
 	}
 #endif
 
-	/* read directly from socket*/
-	len = READSOCKET(conn->s, buf, buflen);
-	if (len > 0)
+	/* hand out what the last read left over first */
+	if (conn->recv_buf_pos < conn->recv_buf_len) {
+		len = MIN(buflen, (int) (conn->recv_buf_len - conn->recv_buf_pos));
+		memcpy(buf, conn->recv_buf + conn->recv_buf_pos, len);
+		conn->recv_buf_pos += len;
 		return len;
+	}
+
+	if (!conn->recv_buf && buflen < TDS_RECV_BUF_SIZE)
+		conn->recv_buf = tds_new(unsigned char, TDS_RECV_BUF_SIZE);
+
+	if (conn->recv_buf && buflen < TDS_RECV_BUF_SIZE) {
+		/* take all the socket has, the rest is for the next reads */
+		len = READSOCKET(conn->s, conn->recv_buf, TDS_RECV_BUF_SIZE);
+		if (len > 0) {
+			conn->recv_buf_len = len;
+			conn->recv_buf_pos = MIN(buflen, len);
+			memcpy(buf, conn->recv_buf, conn->recv_buf_pos);
+			return conn->recv_buf_pos;
+		}
+	} else {
+		/* read directly from socket */
+		len = READSOCKET(conn->s, buf, buflen);
+		if (len > 0)
+			return len;
+	}
 
 	err = sock_errno;
 	if (len < 0 && TDSSOCK_WOULDBLOCK(err))
@@ -769,7 +925,7 @@ tds_wakeup_send(TDSPOLLWAKEUP *wakeup, char cancel)
 	send(wakeup->s_signal, &cancel, sizeof(cancel), 0);
 }
 
-static int
+int
 tds_connection_signaled(TDSCONNECTION *conn)
 {
 	int len;
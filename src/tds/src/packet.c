@@ -33,65 +33,203 @@
 #include <freetds/replacements.h>
 #include <freetds/tls.h>
 
+#if ENABLE_ODBC_MARS
+/*
+ * Packets the server may send a session ahead of it, enough to fill the
+ * connection's receive buffer with default sized packets.
+ */
+#define TDS_MARS_RECV_WND 64
+
+/*
+ * Received packets the readahead thread queues before it stops reading
+ * and waits for the sessions to catch up.
+ */
+#define TDS_READAHEAD_PACKETS 256
+
 static TDSRET tds_update_recv_wnd(TDSSOCKET *tds, TDS_UINT new_recv_wnd);
 static int tds_packet_write(TDSCONNECTION *conn);
+static void tds_connection_network(TDSCONNECTION *conn, TDSSOCKET *tds);
+static TDSRET tds_connection_put_packet(TDSSOCKET *tds, TDSPACKET *packet);
+#endif
+
+/*
+ * Size of the packets of a cache class. The slack above the power of two
+ * leaves room for the SMP header and TDS_ADDITIONAL_SPACE, so packets of a
+ * block size fall in the class of that size.
+ */
+#define TDS_PACKET_CLASS_SIZE(c) ((512u << (c)) + 64u)
+
+/* class of the smallest packets holding len bytes, TDS_PACKET_CLASSES if none */
+static inline unsigned
+tds_packet_class_for(unsigned len)
+{
+	unsigned c = 0;
+
+	while (c < TDS_PACKET_CLASSES && TDS_PACKET_CLASS_SIZE(c) < len)
+		++c;
+	return c;
+}
+
+/* class a packet of this capacity is cached in, -1 if too small for all */
+static inline int
+tds_packet_class_of(unsigned capacity)
+{
+	int c = TDS_PACKET_CLASSES - 1;
 
-/* get packet from the cache */
+	while (c >= 0 && TDS_PACKET_CLASS_SIZE(c) > capacity)
+		--c;
+	return c;
+}
+
+/*
+ * Take a packet from a class.
+ * The class is locked only to unlink the head, a plain compare and swap
+ * could unlink a packet that was popped and pushed back meanwhile (the
+ * ABA problem).
+ */
 static TDSPACKET *
-tds_get_packet(TDSCONNECTION *conn, unsigned len)
+tds_packet_class_pop(TDSPACKETCLASS *cls)
 {
-	TDSPACKET *packet, *to_free = NULL;
+	TDSPACKET *packet;
 
-	tds_mutex_lock(&conn->list_mtx);
-	while ((packet = conn->packet_cache) != NULL) {
-		--conn->num_cached_packets;
-		conn->packet_cache = packet->next;
+	tds_spin_lock(&cls->lock);
+	packet = cls->head;
+	if (packet) {
+		cls->head = packet->next;
+		--cls->count;
+	}
+	tds_spin_unlock(&cls->lock);
+	return packet;
+}
 
-		/* return it */
-		if (packet->capacity >= len) {
-			packet->next = NULL;
-			tds_packet_zero_data_start(packet);
-			packet->data_len = 0;
-			packet->sid = 0;
-			break;
+/*
+ * Put a packet of cache back in its class, or free it if the class is
+ * full or the connection was freed.
+ */
+static void
+tds_packet_cache_put(TDSPACKETCACHE *cache, TDSPACKET *packet)
+{
+	int c = tds_packet_class_of(packet->capacity);
+	TDSPACKETCLASS *cls;
+
+	if (c >= 0) {
+		cls = &cache->classes[c];
+		tds_spin_lock(&cls->lock);
+		if (!cache->closed && cls->count < cache->depth) {
+			packet->next = cls->head;
+			cls->head = packet;
+			++cls->count;
+			tds_spin_unlock(&cls->lock);
+			return;
 		}
-
-		/* discard packet if too small */
-		packet->next = to_free;
-		to_free = packet;
+		tds_spin_unlock(&cls->lock);
 	}
-	tds_mutex_unlock(&conn->list_mtx);
 
-	if (to_free)
-		tds_free_packets(to_free);
+	tds_atomic_inc(&cache->stats.discards);
+	packet->next = NULL;
+	tds_free_packets(packet);
+}
 
-	if (!packet)
-		packet = tds_alloc_packet(NULL, len);
+/*
+ * Get a packet of at least len bytes from the cache, or allocate one the
+ * size of its class so it can be reused for the same requests later.
+ * Does not need the lock.
+ */
+static TDSPACKET *
+tds_get_packet(TDSCONNECTION *conn, unsigned len)
+{
+	TDSPACKETCACHE *cache = conn->packet_cache;
+	unsigned c = tds_packet_class_for(len);
+	TDSPACKET *packet = NULL;
+
+	if (c < TDS_PACKET_CLASSES)
+		packet = tds_packet_class_pop(&cache->classes[c]);
+
+	if (!packet) {
+		tds_atomic_inc(&cache->stats.allocs);
+		packet = tds_alloc_packet(NULL, c < TDS_PACKET_CLASSES ? TDS_PACKET_CLASS_SIZE(c) : len);
+		if (packet) {
+			packet->cache = cache;
+			tds_atomic_inc(&cache->refs);
+		}
+		return packet;
+	}
 
+	tds_atomic_inc(&cache->stats.hits);
+	packet->next = NULL;
+	tds_packet_zero_data_start(packet);
+	packet->data_len = 0;
+	packet->sid = 0;
+	packet->refs = 1;
 	return packet;
 }
 
-/* append packets in cached list. must have the lock! */
+/* give a list of packets back to the cache. Does not need the lock */
 static void
 tds_packet_cache_add(TDSCONNECTION *conn, TDSPACKET *packet)
 {
-	TDSPACKET *last;
-	unsigned count = 1;
+	TDSPACKET *next;
 
 	assert(conn && packet);
-	tds_mutex_check_owned(&conn->list_mtx);
 
-	if (conn->num_cached_packets >= 8) {
-		tds_free_packets(packet);
-		return;
+	for (; packet; packet = next) {
+		next = packet->next;
+		/* packets allocated elsewhere join the cache */
+		if (!packet->cache) {
+			packet->cache = conn->packet_cache;
+			tds_atomic_inc(&conn->packet_cache->refs);
+		}
+		tds_packet_cache_put(packet->cache, packet);
 	}
+}
 
-	for (last = packet; last->next; last = last->next)
-		++count;
+/**
+ * Set how many free packets of each size class the connection keeps.
+ * Packets above the new depth are freed as they come back.
+ */
+void
+tds_set_packet_cache_depth(TDSCONNECTION *conn, unsigned depth)
+{
+	conn->packet_cache->depth = depth;
+}
 
-	last->next = conn->packet_cache;
-	conn->packet_cache = packet;
-	conn->num_cached_packets += count;
+/*
+ * Done with a received packet: cache it, unless a result still refers to
+ * it, in which case the last tds_release_packet caches it.
+ */
+static void
+tds_packet_cache_release(TDSCONNECTION *conn, TDSPACKET *packet)
+{
+	if (tds_atomic_dec(&packet->refs) == 0)
+		tds_packet_cache_add(conn, packet);
+}
+
+/**
+ * Keep a received packet after the socket moves on to the next one, for
+ * values referred to with TDSCOLUMN::column_ref.
+ * May only be called by the thread reading the socket.
+ */
+void
+tds_retain_packet(TDSPACKET *packet)
+{
+	tds_atomic_inc(&packet->refs);
+}
+
+/**
+ * Drop a reference to a packet, from any thread. The last one puts it
+ * back in the cache it came from, or frees it if it has none.
+ */
+void
+tds_release_packet(TDSPACKET *packet)
+{
+	if (tds_atomic_dec(&packet->refs) != 0)
+		return;
+
+	if (packet->cache) {
+		tds_packet_cache_put(packet->cache, packet);
+	} else {
+		free(packet);
+	}
 }
 
 static void
@@ -113,6 +251,86 @@ int
 tds_read_packet(TDSSOCKET * tds)
 {
 #if ENABLE_ODBC_MARS
+	TDSCONNECTION *conn = tds->conn;
+	bool idle_checked = false;
+
+	tds_mutex_lock(&conn->list_mtx);
+
+	for (;;) {
+		int wait_res;
+		TDSPACKET **p_packet;
+
+		if (IS_TDSDEAD(tds)) {
+			tdsdump_log(TDS_DBG_NETWORK, "Read attempt when state is TDS_DEAD");
+			break;
+		}
+
+		/* if there is a packet for me return it */
+		for (p_packet = &conn->packets; *p_packet; p_packet = &(*p_packet)->next)
+			if ((*p_packet)->sid == tds->sid)
+				break;
+
+		if (*p_packet) {
+			/* remove our packet from list */
+			TDSPACKET *packet = *p_packet;
+			*p_packet = packet->next;
+			tds_packet_cache_release(conn, tds->recv_packet);
+			/* the readahead thread waits for room in the queue */
+			if (conn->num_recv_packets-- == TDS_READAHEAD_PACKETS && conn->reader)
+				tds_wakeup_send(&conn->wakeup, 0);
+			tds_mutex_unlock(&conn->list_mtx);
+
+			packet->next = NULL;
+			tds->recv_packet = packet;
+
+			tds->in_buf = packet->buf + packet->data_start;
+			tds->in_len = packet->data_len;
+			tds->in_pos = 8;
+			tds->in_flag = tds->in_buf[0];
+
+			/* let the server send more before it runs out of window */
+			if ((int32_t) (tds->recv_seq + TDS_MARS_RECV_WND / 2 - tds->recv_wnd) >= 0)
+				tds_update_recv_wnd(tds, tds->recv_seq + TDS_MARS_RECV_WND);
+
+			return tds->in_len;
+		}
+
+		/* nothing for us yet, see if it comes in time */
+		if (tds->idle_handler && !idle_checked) {
+			idle_checked = true;
+			if (!conn->in_net_tds) {
+				tds_mutex_unlock(&conn->list_mtx);
+				wait_res = tds_wait_readable(tds, tds->idle_ms) == 0 ? ETIMEDOUT : 0;
+				tds_mutex_lock(&conn->list_mtx);
+			} else {
+				wait_res = tds_cond_timedwait_ms(&tds->packet_cond, &conn->list_mtx, tds->idle_ms);
+			}
+			if (wait_res == ETIMEDOUT) {
+				tds_mutex_unlock(&conn->list_mtx);
+				tds->idle_handler(tds);
+				tds_mutex_lock(&conn->list_mtx);
+			}
+			continue;
+		}
+
+		/* nobody is reading the network, do it ourselves */
+		if (!conn->in_net_tds) {
+			tds_connection_network(conn, tds);
+			continue;
+		}
+
+		/* another session is reading, wait for it to hand us a packet */
+		wait_res = tds_cond_timedwait(&tds->packet_cond, &conn->list_mtx, tds->query_timeout);
+		if (wait_res == ETIMEDOUT
+		    && tdserror(tds_get_ctx(tds), tds, TDSETIME, ETIMEDOUT) != TDS_INT_CONTINUE) {
+			tds_mutex_unlock(&conn->list_mtx);
+			tds_close_socket(tds);
+			return -1;
+		}
+	}
+
+	tds_mutex_unlock(&conn->list_mtx);
+	return -1;
 #else /* !ENABLE_ODBC_MARS */
 	unsigned char *pkt = tds->in_buf, *p, *end;
 
@@ -121,6 +339,22 @@ tds_read_packet(TDSSOCKET * tds)
 		return -1;
 	}
 
+	/* a result still refers to the last packet, don't overwrite it */
+	if (TDS_UNLIKELY(tds_atomic_get(&tds->recv_packet->refs) > 1)) {
+		TDSPACKET *packet = tds_get_packet(tds->conn, tds->recv_packet->capacity);
+		if (TDS_UNLIKELY(!packet)) {
+			tds_close_socket(tds);
+			return -1;
+		}
+		tds_release_packet(tds->recv_packet);
+		tds->recv_packet = packet;
+		tds->in_buf = pkt = packet->buf;
+	}
+
+	/* nothing to read yet, see if it comes in time */
+	if (tds->idle_handler && tds_wait_readable(tds, tds->idle_ms) == 0)
+		tds->idle_handler(tds);
+
 	tds->in_len = 0;
 	tds->in_pos = 0;
 	for (p = pkt, end = p+8; p < end;) {
@@ -193,6 +427,9 @@ tds_update_recv_wnd(TDSSOCKET *tds, TDS_UINT new_recv_wnd)
 
 	tds_mutex_lock(&tds->conn->list_mtx);
 	tds_append_packet(&tds->conn->send_packets, packet);
+	/* the server stalls without it, get it sent */
+	if (tds->conn->in_net_tds && tds->conn->in_net_tds != tds)
+		tds_wakeup_send(&tds->conn->wakeup, 0);
 	tds_mutex_unlock(&tds->conn->list_mtx);
 
 	return TDS_SUCCESS;
@@ -212,7 +449,7 @@ tds_append_fin_syn(TDSSOCKET *tds, uint8_t type)
 	TDS_PUT_A2LE(&mars.sid, tds->sid);
 	mars.size = TDS_HOST4LE(16);
 	TDS_PUT_A4LE(&mars.seq, tds->send_seq);
-	tds->recv_wnd = tds->recv_seq + 4;
+	tds->recv_wnd = tds->recv_seq + TDS_MARS_RECV_WND;
 	TDS_PUT_A4LE(&mars.wnd, tds->recv_wnd);
 
 	/* do not use tds_get_packet as it require no lock ! */
@@ -256,6 +493,464 @@ tds_append_syn(TDSSOCKET *tds)
 	tds_mutex_unlock(&tds->conn->list_mtx);
 	return ret;
 }
+
+/**
+ * Append a cancel packet for the session.
+ * Unlike sending it with tds_flush_packet this does not touch the output
+ * buffer so it can be called while another thread is using the session.
+ * tds->conn->list_mtx must be unlocked.
+ */
+int
+tds_append_cancel(TDSSOCKET *tds)
+{
+	TDSCONNECTION *conn = tds->conn;
+	unsigned start = conn->mars ? sizeof(TDS72_SMP_HEADER) : 0;
+	TDSPACKET *packet;
+
+	packet = tds_get_packet(conn, start + 8);
+	if (!packet)
+		return TDS_FAIL;
+
+	packet->sid = tds->sid;
+	packet->data_start = start;
+	packet->data_len = 8;
+	packet->buf[start + 0] = TDS_CANCEL;
+	packet->buf[start + 1] = 1;
+	TDS_PUT_A2BE(packet->buf + start + 2, 8);
+	TDS_PUT_A4(packet->buf + start + 4, 0);
+	if (IS_TDS7_PLUS(conn) && !tds->login)
+		packet->buf[start + 6] = 0x01;
+
+	tds_mutex_lock(&conn->list_mtx);
+	if (conn->mars) {
+		TDS72_SMP_HEADER *mars = (TDS72_SMP_HEADER *) packet->buf;
+
+		mars->signature = TDS72_SMP;
+		mars->type = TDS_SMP_DATA;
+		TDS_PUT_A2LE(&mars->sid, tds->sid);
+		TDS_PUT_A4LE(&mars->size, start + 8);
+		TDS_PUT_A4LE(&mars->seq, ++tds->send_seq);
+		TDS_PUT_A4LE(&mars->wnd, tds->recv_wnd);
+	}
+	tds_append_packet(&conn->send_packets, packet);
+	tds_mutex_unlock(&conn->list_mtx);
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Send the cancel requests left by other threads.
+ * Called by the thread reading the network when it gets woken up.
+ */
+void
+tds_check_cancel(TDSCONNECTION *conn)
+{
+	TDSSOCKET *tds;
+	unsigned n;
+
+	if (!tds_connection_signaled(conn))
+		return;
+
+	tds_mutex_lock(&conn->list_mtx);
+	for (n = 0; n < conn->num_sessions; ++n) {
+		tds = conn->sessions[n];
+		if (!TDSSOCKET_VALID(tds) || tds->in_cancel != 1)
+			continue;
+		tds->in_cancel = 2;
+		tds_mutex_unlock(&conn->list_mtx);
+		if (TDS_FAILED(tds_append_cancel(tds))) {
+			tds_connection_close(conn);
+			return;
+		}
+		tds_mutex_lock(&conn->list_mtx);
+	}
+	tds_mutex_unlock(&conn->list_mtx);
+}
+
+/**
+ * Read whatever is available of the packet being received.
+ * @return the packet once it is complete, NULL if more data is needed or
+ * on error, in which case the connection is closed.
+ */
+static TDSPACKET *
+tds_packet_read(TDSCONNECTION *conn, TDSSOCKET *tds)
+{
+	TDSPACKET *packet = conn->recv_packet;
+	unsigned header = conn->mars ? sizeof(TDS72_SMP_HEADER) : 8;
+	unsigned size = header;
+	int len;
+
+	if (!packet) {
+		packet = tds_get_packet(conn, header + conn->env.block_size);
+		if (!packet)
+			goto Severe_Error;
+		conn->recv_packet = packet;
+		conn->recv_pos = 0;
+	}
+
+	/* once the header is in we know how much to read */
+	if (conn->recv_pos >= header) {
+		if (conn->mars)
+			size = TDS_GET_A4LE(packet->buf + 4);
+		else
+			size = TDS_GET_A2BE(packet->buf + 2);
+	}
+
+	len = tds_connection_read(tds, packet->buf + conn->recv_pos, size - conn->recv_pos);
+	if (len < 0)
+		goto Severe_Error;
+	conn->recv_pos += len;
+	if (conn->recv_pos < header)
+		return NULL;
+
+	if (size == header) {
+		if (conn->mars) {
+			if (packet->buf[0] != TDS72_SMP)
+				goto Severe_Error;
+			size = TDS_GET_A4LE(packet->buf + 4);
+			/* DATA must carry at least a TDS header */
+			if (size < header || size > header + 0xffff
+			    || (packet->buf[1] == TDS_SMP_DATA && size < header + 8))
+				goto Severe_Error;
+		} else {
+			size = TDS_GET_A2BE(packet->buf + 2);
+			if (size < header)
+				goto Severe_Error;
+		}
+		if (size > packet->capacity) {
+			TDSPACKET *p = tds_realloc_packet(packet, size);
+			if (!p)
+				goto Severe_Error;
+			conn->recv_packet = packet = p;
+		}
+	}
+	if (conn->recv_pos < size)
+		return NULL;
+
+	conn->recv_packet = NULL;
+	conn->recv_pos = 0;
+	packet->data_start = conn->mars ? header : 0;
+	packet->data_len = size - packet->data_start;
+	tdsdump_dump_buf(TDS_DBG_NETWORK, "Received packet", packet->buf, size);
+	return packet;
+
+Severe_Error:
+	tdsdump_log(TDS_DBG_ERROR, "Invalid or unreadable packet, closing connection\n");
+	tds_connection_close(conn);
+	return NULL;
+}
+
+/**
+ * Give a received packet to its session.
+ * conn->list_mtx must be locked.
+ * @return sid of the session the packet was for, -1 if none
+ */
+static int
+tds_packet_dispatch(TDSCONNECTION *conn, TDSPACKET *packet)
+{
+	TDS72_SMP_HEADER *mars = (TDS72_SMP_HEADER *) packet->buf;
+	TDSSOCKET *tds;
+	uint16_t sid;
+
+	/* without SMP everything belongs to the only session */
+	if (!conn->mars) {
+		packet->sid = 0;
+		tds_append_packet(&conn->packets, packet);
+		++conn->num_recv_packets;
+		if (TDSSOCKET_VALID(conn->sessions[0]))
+			tds_cond_signal(&conn->sessions[0]->packet_cond);
+		return 0;
+	}
+
+	sid = TDS_GET_A2LE(&mars->sid);
+	tds = sid < conn->num_sessions ? conn->sessions[sid] : NULL;
+
+	/* session we closed, the server acknowledges with a FIN */
+	if (tds == BUSY_SOCKET) {
+		if (mars->type == TDS_SMP_FIN)
+			conn->sessions[sid] = NULL;
+		tds_packet_cache_add(conn, packet);
+		return -1;
+	}
+	if (!tds) {
+		tdsdump_log(TDS_DBG_ERROR, "Received MARS packet for unknown session %u\n", sid);
+		tds_packet_cache_add(conn, packet);
+		return -1;
+	}
+
+	tds->send_wnd = TDS_GET_A4LE(&mars->wnd);
+	switch (mars->type) {
+	case TDS_SMP_DATA:
+		tds->recv_seq = TDS_GET_A4LE(&mars->seq);
+		packet->sid = sid;
+		tds_append_packet(&conn->packets, packet);
+		++conn->num_recv_packets;
+		break;
+	case TDS_SMP_FIN:
+		/* the server ended the session */
+		tdsdump_log(TDS_DBG_ERROR, "Server closed MARS session %u\n", sid);
+		tds_set_state(tds, TDS_DEAD);
+		tds_packet_cache_add(conn, packet);
+		break;
+	default:
+		/* ACK, just the window update */
+		tds_packet_cache_add(conn, packet);
+		break;
+	}
+	tds_cond_signal(&tds->packet_cond);
+	return sid;
+}
+
+/**
+ * Read and write the network for all sessions of the connection.
+ * Queued packets are sent and received packets are handed to their
+ * sessions until something happens for tds: one of its packets was
+ * sent or one arrived for it, or the connection failed.
+ * For the readahead thread it goes on until tds_stop_readahead.
+ * conn->list_mtx must be locked, it is released while waiting.
+ */
+static void
+tds_connection_network(TDSCONNECTION *conn, TDSSOCKET *tds)
+{
+	unsigned n;
+	int rc = 0;
+
+	assert(!conn->in_net_tds);
+	conn->in_net_tds = tds;
+	tds_mutex_unlock(&conn->list_mtx);
+
+	for (;;) {
+		TDSPACKET *packet;
+		unsigned sel = TDSSELREAD;
+		int sid;
+
+		if (tds == conn->reader) {
+			bool stop, full;
+
+			tds_mutex_lock(&conn->list_mtx);
+			stop = conn->reader_stop;
+			full = conn->num_recv_packets >= TDS_READAHEAD_PACKETS;
+			tds_mutex_unlock(&conn->list_mtx);
+			if (stop)
+				break;
+			/* leave data in the socket till the sessions catch up,
+			 * unless the server hung up and only the rest is left */
+			if (full && !(rc & POLLHUP))
+				sel = 0;
+		}
+		if (conn->send_packets)
+			sel |= TDSSELWRITE;
+
+		rc = tds_select(tds, sel, tds->query_timeout);
+		if (rc < 0) {
+			tds_connection_close(conn);
+			break;
+		}
+
+		if (rc == 0) {
+			/* the reader has no query of its own to time out and must
+			 * never close a session, sessions time out waiting for it */
+			if (tds == conn->reader)
+				continue;
+			if (tdserror(tds_get_ctx(tds), tds, TDSETIME, sock_errno) == TDS_INT_CONTINUE)
+				continue;
+			/* give up on this session only */
+			tds_close_socket(tds);
+			break;
+		}
+
+		/* write first so write errors are reported as such */
+		if (conn->send_packets && (rc & POLLOUT) != 0) {
+			sid = tds_packet_write(conn);
+			if (TDS_IS_SOCKET_INVALID(conn->s))
+				break;
+			if (sid == tds->sid)
+				break;
+			if (sid >= 0) {
+				tds_mutex_lock(&conn->list_mtx);
+				if (sid < conn->num_sessions && TDSSOCKET_VALID(conn->sessions[sid]))
+					tds_cond_signal(&conn->sessions[sid]->packet_cond);
+				tds_mutex_unlock(&conn->list_mtx);
+			}
+			continue;
+		}
+
+		if (rc & POLLIN) {
+			packet = tds_packet_read(conn, tds);
+			if (!packet) {
+				if (TDS_IS_SOCKET_INVALID(conn->s))
+					break;
+				continue;
+			}
+			tds_mutex_lock(&conn->list_mtx);
+			sid = tds_packet_dispatch(conn, packet);
+			tds_mutex_unlock(&conn->list_mtx);
+			if (sid == tds->sid)
+				break;
+		}
+	}
+
+	tds_mutex_lock(&conn->list_mtx);
+	conn->in_net_tds = NULL;
+
+	/* let a waiting session or the readahead thread take over the network */
+	for (n = 0; n < conn->num_sessions; ++n)
+		if (TDSSOCKET_VALID(conn->sessions[n]) && conn->sessions[n] != tds)
+			tds_cond_signal(&conn->sessions[n]->packet_cond);
+	if (conn->reader && conn->reader != tds)
+		tds_cond_signal(&conn->reader->packet_cond);
+}
+
+static TDS_THREAD_PROC_DECLARE(tds_readahead_proc, arg)
+{
+	TDSSOCKET *tds = (TDSSOCKET *) arg;
+	TDSCONNECTION *conn = tds->conn;
+
+	tds_mutex_lock(&conn->list_mtx);
+	/* a session may still be using the network */
+	while (conn->in_net_tds && !conn->reader_stop)
+		tds_cond_wait(&tds->packet_cond, &conn->list_mtx);
+	if (!conn->reader_stop)
+		tds_connection_network(conn, tds);
+	tds_mutex_unlock(&conn->list_mtx);
+
+	return TDS_THREAD_RESULT(0);
+}
+
+/**
+ * Start a thread that reads the network for all sessions of the connection.
+ * Packets are received while the sessions are busy decoding the previous
+ * ones, up to TDS_READAHEAD_PACKETS waiting, and the sessions only wait for
+ * the thread instead of reading the socket themselves. This hides the round
+ * trip of each read on high latency links.
+ * The thread runs till tds_stop_readahead, which is also called when the
+ * connection is closed. The packet cache is deepened to hold what the
+ * thread may queue, or every burst would go through malloc and free.
+ */
+TDSRET
+tds_start_readahead(TDSCONNECTION *conn)
+{
+	TDSSOCKET *reader;
+
+	if (conn->reader)
+		return TDS_SUCCESS;
+
+	reader = tds_alloc_reader_socket(conn);
+	if (!reader)
+		return TDS_FAIL;
+
+	if (conn->packet_cache->depth < TDS_READAHEAD_PACKETS)
+		tds_set_packet_cache_depth(conn, TDS_READAHEAD_PACKETS);
+
+	tds_mutex_lock(&conn->list_mtx);
+	conn->reader = reader;
+	conn->reader_stop = false;
+	if (tds_thread_create(&conn->reader_thread, tds_readahead_proc, reader)) {
+		conn->reader = NULL;
+		tds_mutex_unlock(&conn->list_mtx);
+		tds_free_reader_socket(reader);
+		return TDS_FAIL;
+	}
+	tds_mutex_unlock(&conn->list_mtx);
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Stop the readahead thread, if any, and wait for it to end.
+ * Sessions go back to reading the network themselves.
+ */
+void
+tds_stop_readahead(TDSCONNECTION *conn)
+{
+	TDSSOCKET *reader = conn->reader;
+
+	if (!reader || tds_thread_is_current(conn->reader_thread))
+		return;
+
+	tds_mutex_lock(&conn->list_mtx);
+	conn->reader_stop = true;
+	tds_cond_signal(&reader->packet_cond);
+	tds_mutex_unlock(&conn->list_mtx);
+	tds_wakeup_send(&conn->wakeup, 0);
+
+	tds_thread_join(conn->reader_thread, NULL);
+
+	tds_mutex_lock(&conn->list_mtx);
+	conn->reader = NULL;
+	tds_mutex_unlock(&conn->list_mtx);
+	tds_free_reader_socket(reader);
+}
+
+/**
+ * Queue a packet to be sent and wait till it is written.
+ * The packet is owned by the connection afterwards.
+ */
+static TDSRET
+tds_connection_put_packet(TDSSOCKET *tds, TDSPACKET *packet)
+{
+	TDSCONNECTION *conn = tds->conn;
+
+	packet->sid = tds->sid;
+
+	tds_mutex_lock(&conn->list_mtx);
+	tds->sending_packet = packet;
+	while (tds->sending_packet) {
+		int wait_res;
+
+		if (IS_TDSDEAD(tds)) {
+			tdsdump_log(TDS_DBG_NETWORK, "Write attempt when state is TDS_DEAD");
+			break;
+		}
+
+		/* queue it once the server window allows */
+		if (packet && (int32_t) (tds->send_seq - tds->send_wnd) < 0) {
+			if (conn->mars) {
+				TDS72_SMP_HEADER *mars = (TDS72_SMP_HEADER *) packet->buf;
+
+				mars->signature = TDS72_SMP;
+				mars->type = TDS_SMP_DATA;
+				TDS_PUT_A2LE(&mars->sid, tds->sid);
+				TDS_PUT_A4LE(&mars->size, packet->data_start + packet->data_len);
+				TDS_PUT_A4LE(&mars->seq, ++tds->send_seq);
+				/* acknowledge what we read so far */
+				tds->recv_wnd = tds->recv_seq + TDS_MARS_RECV_WND;
+				TDS_PUT_A4LE(&mars->wnd, tds->recv_wnd);
+			}
+			tds_append_packet(&conn->send_packets, packet);
+			packet = NULL;
+		}
+
+		/* nobody is handling the network, do it ourselves */
+		if (!conn->in_net_tds) {
+			tds_connection_network(conn, tds);
+			continue;
+		}
+
+		/* have the session reading the network send our packet */
+		tds_wakeup_send(&conn->wakeup, 0);
+
+		wait_res = tds_cond_timedwait(&tds->packet_cond, &conn->list_mtx, tds->query_timeout);
+		if (wait_res == ETIMEDOUT
+		    && tdserror(tds_get_ctx(tds), tds, TDSETIME, ETIMEDOUT) != TDS_INT_CONTINUE) {
+			tds->sending_packet = NULL;
+			tds_mutex_unlock(&conn->list_mtx);
+			tds_free_packets(packet);
+			tds_close_socket(tds);
+			return TDS_FAIL;
+		}
+	}
+	tds->sending_packet = NULL;
+	tds_mutex_unlock(&conn->list_mtx);
+
+	if (TDS_UNLIKELY(packet)) {
+		tds_free_packets(packet);
+		return TDS_FAIL;
+	}
+	if (IS_TDSDEAD(tds))
+		return TDS_FAIL;
+	return TDS_SUCCESS;
+}
 #endif /* ENABLE_ODBC_MARS */
 
 
@@ -292,6 +987,12 @@ tds_write_packet(TDSSOCKET * tds, unsigned char final)
 	 */
 	tds->out_buf[0] = tds->out_flag;
 	tds->out_buf[1] = final;
+	/* the reset applies to the whole request, so flag only its first packet */
+	if (tds->reset_connection) {
+		if (IS_TDS71_PLUS(tds->conn))
+			tds->out_buf[1] |= TDS_STATUS_RESETCONNECTION;
+		tds->reset_connection = false;
+	}
 	TDS_PUT_A2BE(tds->out_buf+2, tds->out_pos);
 	TDS_PUT_A2BE(tds->out_buf+4, tds->conn->client_spid);
 	TDS_PUT_A2(tds->out_buf+6, 0);
@@ -305,6 +1006,15 @@ tds_write_packet(TDSSOCKET * tds, unsigned char final)
 		return TDS_SUCCESS;
 	}
 
+#if ENABLE_ODBC_MARS
+	/* hand the packet over to the connection and continue in the next */
+	pkt->next = NULL;
+	pkt->data_len = tds->out_pos;
+	tds_set_current_send_packet(tds, pkt_next);
+	tds->out_pos = left + 8;
+
+	res = tds_connection_put_packet(tds, pkt);
+#else
 	tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet", tds->out_buf, tds->out_pos);
 
 	/* GW added in check for write() returning <0 and SIGPIPE checking */
@@ -314,6 +1024,7 @@ tds_write_packet(TDSSOCKET * tds, unsigned char final)
 	memcpy(tds->out_buf + 8, tds->out_buf + tds->out_buf_max, left);
 
 	tds->out_pos = left + 8;
+#endif
 
 	if (TDS_UNLIKELY(tds->conn->encrypt_single_packet)) {
 		tds->conn->encrypt_single_packet = 0;
@@ -348,6 +1059,18 @@ tds_put_cancel(TDSSOCKET * tds)
 	/* GW added in check for write() returning <0 and SIGPIPE checking */
 	return sent <= 0 ? TDS_FAIL : TDS_SUCCESS;
 }
+
+/* without MARS the only session reads the network itself */
+TDSRET
+tds_start_readahead(TDSCONNECTION *conn)
+{
+	return TDS_FAIL;
+}
+
+void
+tds_stop_readahead(TDSCONNECTION *conn)
+{
+}
 #endif /* !ENABLE_ODBC_MARS */
 
 
@@ -394,8 +1117,8 @@ tds_packet_write(TDSCONNECTION *conn)
 			tds->sending_packet = NULL;
 		conn->send_packets = packet->next;
 		packet->next = NULL;
-		tds_packet_cache_add(conn, packet);
 		tds_mutex_unlock(&conn->list_mtx);
+		tds_packet_cache_add(conn, packet);
 		conn->send_pos = 0;
 		return sid;
 	}
@@ -470,9 +1193,7 @@ tds_freeze_abort(TDSFREEZE *freeze)
 	TDSPACKET *pkt = freeze->pkt;
 
 	if (pkt->next) {
-		tds_mutex_lock(&tds->conn->list_mtx);
 		tds_packet_cache_add(tds->conn, pkt->next);
-		tds_mutex_unlock(&tds->conn->list_mtx);
 		pkt->next = NULL;
 
 		tds_set_current_send_packet(tds, pkt);
@@ -552,21 +1273,24 @@ tds_freeze_close_len(TDSFREEZE *freeze, int32_t size)
 		TDSPACKET *next = pkt->next;
 		TDSRET rc;
 #if ENABLE_ODBC_MARS
+		/* the connection owns the packet from now on */
+		pkt->next = NULL;
+		freeze->pkt = next;
+		rc = tds_connection_put_packet(tds, pkt);
 #else
 		rc = tds_connection_write(tds, pkt->buf, pkt->data_len, 0) <= 0 ?
 			TDS_FAIL : TDS_SUCCESS;
 		last_pkt_sent = pkt;
 #endif
 		if (TDS_UNLIKELY(TDS_FAILED(rc))) {
-			while (next->next) {
-				pkt = next;
-				next = pkt->next;
+			/* give back the packets not sent, but the one still in use */
+			pkt = freeze->pkt;
+			if (pkt->next) {
+				while (pkt->next->next)
+					pkt = pkt->next;
+				pkt->next = NULL;
+				tds_packet_cache_add(tds->conn, freeze->pkt);
 			}
-
-			pkt->next = NULL;
-			tds_mutex_lock(&tds->conn->list_mtx);
-			tds_packet_cache_add(tds->conn, freeze->pkt);
-			tds_mutex_unlock(&tds->conn->list_mtx);
 			return rc;
 		}
 		pkt = next;
@@ -574,9 +1298,7 @@ tds_freeze_close_len(TDSFREEZE *freeze, int32_t size)
 
   if (last_pkt_sent) {
 		last_pkt_sent->next = NULL;
-		tds_mutex_lock(&tds->conn->list_mtx);
 		tds_packet_cache_add(tds->conn, freeze->pkt);
-		tds_mutex_unlock(&tds->conn->list_mtx);
 	}
 
 	/* keep final packet so we can continue to add data */
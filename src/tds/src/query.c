@@ -42,6 +42,7 @@ static TDSRET tds7_write_param_def_from_params(TDSSOCKET * tds, const char* quer
 					       TDSPARAMINFO * params);
 
 static int tds_count_placeholders_ucs2le(const char *query, const char *query_end);
+static bool tds_cursor_check_allocated(TDSCONNECTION * conn, TDSCURSOR * cursor);
 
 #define TDS_PUT_DATA_USE_NAME 1
 #define TDS_PUT_DATA_PREFIX_NAME 2
@@ -157,7 +158,7 @@ tds_convert_string_free(const char *original, const char *converted)
  * This also changes the state to TDS_PENDING.
  * \tds
  */
-static TDSRET
+TDSRET
 tds_query_flush_packet(TDSSOCKET *tds)
 {
 	TDSRET ret = tds_flush_packet(tds);
@@ -356,6 +357,29 @@ tds_submit_query_params(TDSSOCKET * tds, const char *query, TDSPARAMINFO * param
 	return tds_query_flush_packet(tds);
 }
 
+/**
+ * Sends a language query that has already been converted to ucs2le, as
+ * tds_submit_query would send it. This lets a caller prepare its next
+ * query while the results of the current one are still being read.
+ * \tds
+ * \param query language query in ucs2le encoding
+ * \param len   query length in bytes
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_submit_query_ucs2(TDSSOCKET * tds, const char *query, size_t len)
+{
+	if (!query)
+		return TDS_FAIL;
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	tds_start_query(tds, TDS_QUERY);
+	tds_put_n(tds, query, len);
+	return tds_query_flush_packet(tds);
+}
+
 /**
  * Format and submit a query
  * \tds
@@ -378,6 +402,404 @@ tds_submit_queryf(TDSSOCKET * tds, const char *queryf, ...)
 	return rc;
 }
 
+/**
+ * Calls a RPC from server. Output parameters will be stored in tds->param_info.
+ * \tds
+ * \param rpc_name name of RPC
+ * \param params   parameters informations. NULL for no parameters
+ * \param head     extra information to put in a TDS7 header
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params, TDSHEADERS * head)
+{
+	TDSCOLUMN *param;
+	int rpc_name_len, i;
+	int num_params = params ? params->num_cols : 0;
+	const char *converted_name;
+	size_t converted_name_len;
+
+	assert(tds);
+	assert(rpc_name);
+
+	/* only the TDS 7+ RPC request is supported by this library */
+	if (!IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	/* distinguish from dynamic query  */
+	tds_release_cur_dyn(tds);
+
+	rpc_name_len = (int)strlen(rpc_name);
+
+	/* procedure name */
+	converted_name = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], rpc_name, rpc_name_len, &converted_name_len);
+	if (!converted_name) {
+		tds_set_state(tds, TDS_IDLE);
+		return TDS_FAIL;
+	}
+
+	if (tds_start_query_head(tds, TDS_RPC, head) != TDS_SUCCESS) {
+		tds_convert_string_free(rpc_name, converted_name);
+		return TDS_FAIL;
+	}
+	TDS_PUT_SMALLINT(tds, converted_name_len / 2);
+	tds_put_n(tds, converted_name, (int)converted_name_len);
+	tds_convert_string_free(rpc_name, converted_name);
+
+	/*
+	 * TODO support flags
+	 * bit 0 (1 as flag) in TDS7 is "recompile"
+	 * bit 1 (2 as flag) in TDS7+ is "no metadata" bit this will prevent sending of column infos
+	 */
+	tds_put_smallint(tds, 0);
+
+	for (i = 0; i < num_params; i++) {
+		param = params->columns[i];
+		TDS_PROPAGATE(tds_put_data_info(tds, param, TDS_PUT_DATA_USE_NAME));
+		TDS_PROPAGATE(tds_put_data(tds, param));
+	}
+
+	return tds_query_flush_packet(tds);
+}
+
+/**
+ * Write the prepared statement handle of dyn as an input parameter
+ * \tds
+ * \param dyn  dynamic statement prepared on the server
+ */
+static void
+tds7_put_dynamic_handle(TDSSOCKET * tds, TDSDYNAMIC * dyn)
+{
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 4);
+	tds_put_int(tds, dyn->num_id);
+}
+
+/**
+ * Write the common head of sp_prepare and sp_prepexec: procedure, output
+ * handle, parameter declarations and statement.
+ * \tds
+ * \param proc   TDS_SP_PREPARE or TDS_SP_PREPEXEC
+ * \param query  query to prepare, using ? as placeholders
+ * \param params parameters, used to declare placeholder types
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+static TDSRET
+tds7_put_prepare(TDSSOCKET * tds, int proc, const char *query, TDSPARAMINFO * params)
+{
+	size_t converted_query_len;
+	const char *converted_query;
+	TDSFREEZE outer;
+	TDSRET rc;
+
+	converted_query = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], query, (int)strlen(query), &converted_query_len);
+	if (!converted_query)
+		return TDS_FAIL;
+
+	tds_freeze(tds, &outer, 0);
+	tds_start_query(tds, TDS_RPC);
+	/* procedure name */
+	if (IS_TDS71_PLUS(tds->conn)) {
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, proc);
+	} else if (proc == TDS_SP_PREPEXEC) {
+		TDS_PUT_N_AS_UCS2(tds, "sp_prepexec");
+	} else {
+		TDS_PUT_N_AS_UCS2(tds, "sp_prepare");
+	}
+	tds_put_smallint(tds, 0);
+
+	/* return param handle (int) */
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, 1);	/* result */
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 0);
+
+	rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
+	tds7_put_query_params(tds, converted_query, converted_query_len);
+	tds_convert_string_free(query, converted_query);
+	if (TDS_FAILED(rc)) {
+		tds_freeze_abort(&outer);
+		return rc;
+	}
+	tds_freeze_close(&outer);
+	return TDS_SUCCESS;
+}
+
+/**
+ * Prepare a query with parameters (sp_prepare). The handle of the
+ * statement is stored in the dynamic when results are processed.
+ * \tds
+ * \param query  query to prepare, using ? as placeholders
+ * \param id     id of query, NULL to have one generated
+ * \param dyn_out store dynamic here, release with tds_release_dynamic
+ * \param params parameters to use, used to declare placeholder types. NULL if none
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMIC ** dyn_out, TDSPARAMINFO * params)
+{
+	TDSRET rc = TDS_FAIL;
+	TDSDYNAMIC *dyn;
+
+	if (!query || !dyn_out || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	if (tds->state != TDS_IDLE)
+		return TDS_FAIL;
+
+	/* allocate a structure for this thing */
+	dyn = tds_alloc_dynamic(tds->conn, id);
+	if (!dyn)
+		return TDS_FAIL;
+	tds_release_dynamic(dyn_out);
+	*dyn_out = dyn;
+	tds_release_cur_dyn(tds);
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		goto failure_nostate;
+
+	tds_set_cur_dyn(tds, dyn);
+
+	rc = tds7_put_prepare(tds, TDS_SP_PREPARE, query, params);
+	if (TDS_FAILED(rc))
+		goto failure;
+
+	/* options, 1 == RETURN_METADATA */
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 4);
+	tds_put_int(tds, 1);
+
+	tds->current_op = TDS_OP_PREPARE;
+
+	rc = tds_query_flush_packet(tds);
+	if (TDS_SUCCEED(rc))
+		return rc;
+
+failure:
+	/* TODO correct if writing fail ?? */
+	tds_set_state(tds, TDS_IDLE);
+
+failure_nostate:
+	tds_release_dynamic(dyn_out);
+	tds_dynamic_deallocated(tds->conn, dyn);
+	return rc;
+}
+
+/**
+ * Prepare and execute a query in a single round trip (sp_prepexec).
+ * Later executions can use tds_submit_execute with the returned dynamic.
+ * \tds
+ * \param query  query to prepare, using ? as placeholders
+ * \param id     id of query, NULL to have one generated
+ * \param dyn_out store dynamic here, release with tds_release_dynamic
+ * \param params parameters to use. NULL if none
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMIC ** dyn_out, TDSPARAMINFO * params)
+{
+	TDSRET rc = TDS_FAIL;
+	TDSDYNAMIC *dyn;
+	int i;
+
+	if (!query || !dyn_out || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	/* allocate a structure for this thing */
+	dyn = tds_alloc_dynamic(tds->conn, id);
+	if (!dyn)
+		return TDS_FAIL;
+	tds_release_dynamic(dyn_out);
+	*dyn_out = dyn;
+
+	tds_set_cur_dyn(tds, dyn);
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		goto failure_nostate;
+
+	rc = tds7_put_prepare(tds, TDS_SP_PREPEXEC, query, params);
+	if (TDS_FAILED(rc))
+		goto failure;
+
+	for (i = 0; params && i < params->num_cols; i++) {
+		TDSCOLUMN *param = params->columns[i];
+
+		rc = tds_put_data_info(tds, param, 0);
+		if (TDS_SUCCEED(rc))
+			rc = tds_put_data(tds, param);
+		if (TDS_FAILED(rc))
+			goto failure;
+	}
+
+	tds->current_op = TDS_OP_PREPEXEC;
+
+	rc = tds_query_flush_packet(tds);
+	if (TDS_SUCCEED(rc))
+		return rc;
+
+failure:
+	/* TODO correct if writing fail ?? */
+	tds_set_state(tds, TDS_IDLE);
+
+failure_nostate:
+	tds_release_dynamic(dyn_out);
+	tds_dynamic_deallocated(tds->conn, dyn);
+	return rc;
+}
+
+/**
+ * Execute a prepared query (sp_execute), sending the parameters
+ * stored in dyn->params.
+ * \tds
+ * \param dyn  dynamic proc to execute. Must have been prepared.
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_submit_execute(TDSSOCKET * tds, TDSDYNAMIC * dyn)
+{
+	TDSPARAMINFO *info;
+	TDSRET rc = TDS_SUCCESS;
+	int i;
+
+	tdsdump_log(TDS_DBG_FUNC, "tds_submit_execute()\n");
+
+	/* check proper id */
+	if (!IS_TDS7_PLUS(tds->conn) || dyn->num_id == 0)
+		return TDS_FAIL;
+
+	/* ensure dynamic is not freed passing it to functions */
+	++dyn->ref_count;
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING) {
+		tds_release_dynamic(&dyn);
+		return TDS_FAIL;
+	}
+	tds_set_cur_dyn(tds, dyn);
+
+	/* RPC on sp_execute */
+	tds_start_query(tds, TDS_RPC);
+
+	if (IS_TDS71_PLUS(tds->conn)) {
+		/* save some byte for mssql2k */
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_EXECUTE);
+	} else {
+		TDS_PUT_N_AS_UCS2(tds, "sp_execute");
+	}
+	tds_put_smallint(tds, 0);	/* flags */
+
+	/* id of prepared statement */
+	tds7_put_dynamic_handle(tds, dyn);
+
+	info = dyn->params;
+	for (i = 0; info && i < info->num_cols && TDS_SUCCEED(rc); i++) {
+		TDSCOLUMN *param = info->columns[i];
+
+		rc = tds_put_data_info(tds, param, 0);
+		if (TDS_SUCCEED(rc))
+			rc = tds_put_data(tds, param);
+	}
+
+	tds->current_op = TDS_OP_EXECUTE;
+	if (TDS_SUCCEED(rc))
+		rc = tds_query_flush_packet(tds);
+	else
+		tds_set_state(tds, TDS_IDLE);
+	tds_release_dynamic(&dyn);
+	return rc;
+}
+
+/**
+ * Check if dynamic request must be unprepared.
+ * Depending on status and protocol version request should be unprepared
+ * or not.
+ * \param conn connection
+ * \param dyn  dynamic request to check
+ */
+int
+tds_needs_unprepare(TDSCONNECTION * conn, TDSDYNAMIC * dyn)
+{
+	/* check if statement is prepared */
+	if (IS_TDS7_PLUS(conn) && !dyn->num_id)
+		return 0;
+
+	if (dyn->emulated || !dyn->id[0])
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Unprepare dynamic on idle.
+ * This let libTDS close the prepared statement when possible.
+ * \param conn connection
+ * \param dyn  dynamic request to close
+ */
+TDSRET
+tds_deferred_unprepare(TDSCONNECTION * conn, TDSDYNAMIC * dyn)
+{
+	if (!tds_needs_unprepare(conn, dyn)) {
+		tds_dynamic_deallocated(conn, dyn);
+		return TDS_SUCCESS;
+	}
+
+	dyn->defer_close = true;
+	conn->pending_close = 1;
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Send a unprepare request for a prepared query (sp_unprepare)
+ * \tds
+ * \param dyn  dynamic query
+ * \result TDS_SUCCESS or TDS_FAIL
+ */
+TDSRET
+tds_submit_unprepare(TDSSOCKET * tds, TDSDYNAMIC * dyn)
+{
+	if (!dyn || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	tdsdump_log(TDS_DBG_FUNC, "tds_submit_unprepare() %s\n", dyn->id);
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	/* TODO check if dynamic is in conn->dyns ?? */
+	tds_set_cur_dyn(tds, dyn);
+
+	/* RPC on sp_unprepare */
+	tds_start_query(tds, TDS_RPC);
+
+	/* procedure name */
+	if (IS_TDS71_PLUS(tds->conn)) {
+		/* save some byte for mssql2k */
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_UNPREPARE);
+	} else {
+		TDS_PUT_N_AS_UCS2(tds, "sp_unprepare");
+	}
+	tds_put_smallint(tds, 0);	/* flags */
+
+	/* id of prepared statement */
+	tds7_put_dynamic_handle(tds, dyn);
+
+	tds->current_op = TDS_OP_UNPREPARE;
+	return tds_query_flush_packet(tds);
+}
+
 /**
  * Skip a comment in a query
  * \param s    start of the string (or part of it)
@@ -1108,8 +1530,6 @@ TDSRET
 tds_send_cancel(TDSSOCKET * tds)
 {
 #if ENABLE_ODBC_MARS
-	CHECK_TDS_EXTRA(tds);
-
 	tdsdump_log(TDS_DBG_FUNC, "tds_send_cancel: %sin_cancel and %sidle\n", 
 				(tds->in_cancel? "":"not "), (tds->state == TDS_IDLE? "":"not "));
 
@@ -1118,47 +1538,18 @@ tds_send_cancel(TDSSOCKET * tds)
 		return TDS_SUCCESS;
 	}
 
-	tds->in_cancel = 1;
-
-	if (tds_mutex_trylock(&tds->conn->list_mtx)) {
-		/* TODO check */
-		/* signal other socket */
-		tds_wakeup_send(&tds->conn->wakeup, 1);
-		return TDS_SUCCESS;
-	}
-	if (tds->conn->in_net_tds) {
-		tds_mutex_unlock(&tds->conn->list_mtx);
-		/* TODO check */
-		/* signal other socket */
-		tds_wakeup_send(&tds->conn->wakeup, 1);
-		return TDS_SUCCESS;
-	}
-	tds_mutex_unlock(&tds->conn->list_mtx);
-
 	/*
-	problem: if we are in in_net and we got a signal ??
-	on timeout we and a cancel, directly in in_net
-	if we hold the lock and we get a signal lock create a death lock
-
-	if we use a recursive mutex and we can get the lock there are 2 cases
-	- same thread, we could add a packet and signal, no try ok
-	- first thread locking, we could add a packet but are we sure it get processed ??, no try ok
-	if recursive mutex and we can't get another thread, wait
-
-	if mutex is not recursive and we get the lock (try)
-	- nobody locked, if in_net it could be same or another
-	if mutex is not recursive and we can't get the lock
-	- another thread is locking, sending signal require not exiting and global list (not protected by list_mtx)
-	- same thread have lock, we can't wait nothing without deathlock, setting a flag in tds and signaling could help
-
-	if a tds is waiting for data or is waiting for a condition or for a signal in poll
-	pass cancel request on socket ??
+	 * The session may be in use by another thread so leave its output
+	 * buffer alone: queue a separate cancel packet and wake up whoever
+	 * is handling the network. If nobody is, the next session reading
+	 * or writing sends it.
 	 */
-
-	tds->out_flag = TDS_CANCEL;
-	tds->out_pos = 8;
- 	tdsdump_log(TDS_DBG_FUNC, "tds_send_cancel: sending cancel packet\n");
-	return tds_flush_packet(tds);
+	tds->in_cancel = 2;
+	tdsdump_log(TDS_DBG_FUNC, "tds_send_cancel: queueing cancel packet\n");
+	if (TDS_FAILED(tds_append_cancel(tds)))
+		return TDS_FAIL;
+	tds_wakeup_send(&tds->conn->wakeup, 0);
+	return TDS_SUCCESS;
 #else
 	TDSRET rc;
 
@@ -1293,6 +1684,282 @@ tds_set_cur_cursor(TDSSOCKET *tds, TDSCURSOR *cursor)
 	tds->cur_cursor = cursor;
 }
 
+/**
+ * Declare a cursor. For TDS 7+ nothing is sent, the declaration is part
+ * of sp_cursoropen.
+ * \tds
+ * \param cursor  cursor to declare
+ * \param params  parameters of cursor query, unused
+ * \param send    set to 1 if something must be flushed to the server
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_cursor_declare(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, int *send)
+{
+	if (!cursor || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	tdsdump_log(TDS_DBG_INFO1, "tds_cursor_declare() cursor id = %d\n", cursor->cursor_id);
+
+	cursor->srv_status |= TDS_CUR_ISTAT_DECLARED;
+	cursor->srv_status |= TDS_CUR_ISTAT_CLOSED;
+	cursor->srv_status |= TDS_CUR_ISTAT_RDONLY;
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Set the number of rows returned by each fetch. For TDS 7+ this is only
+ * recorded, cursor_rows is sent with every sp_cursorfetch.
+ * \tds
+ * \param cursor  cursor
+ * \param send    set to 1 if something must be flushed to the server
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_cursor_setrows(TDSSOCKET * tds, TDSCURSOR * cursor, int *send)
+{
+	if (!cursor || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	tdsdump_log(TDS_DBG_INFO1, "tds_cursor_setrows() cursor id = %d\n", cursor->cursor_id);
+
+	cursor->srv_status &= ~TDS_CUR_ISTAT_DECLARED;
+	cursor->srv_status |= TDS_CUR_ISTAT_CLOSED;
+	cursor->srv_status |= TDS_CUR_ISTAT_ROWCNT;
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Write an int input parameter of a RPC, NULL if not present.
+ * \tds
+ * \param value    value to write
+ * \param present  false to write a NULL
+ */
+static void
+tds7_put_int_param(TDSSOCKET * tds, TDS_INT value, bool present)
+{
+	tds_put_byte(tds, 0);	/* no parameter name */
+	tds_put_byte(tds, 0);	/* input parameter  */
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	if (present) {
+		tds_put_byte(tds, 4);
+		tds_put_int(tds, value);
+	} else {
+		tds_put_byte(tds, 0);
+	}
+}
+
+/**
+ * Open a cursor (sp_cursoropen) using cursor->type and cursor->concurrency.
+ * The packet is not flushed, the caller must call tds_query_flush_packet
+ * if send is set on return.
+ * \tds
+ * \param cursor  cursor to open
+ * \param params  parameters of the query, using ? as placeholders. NULL if none
+ * \param send    set to 1 if something must be flushed to the server
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, int *send)
+{
+	const char *converted_query;
+	size_t converted_query_len;
+	int num_params = params ? params->num_cols : 0;
+	TDSFREEZE outer;
+	TDSRET rc = TDS_SUCCESS;
+
+	if (!cursor || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	tdsdump_log(TDS_DBG_INFO1, "tds_cursor_open() cursor id = %d\n", cursor->cursor_id);
+
+	if (!*send) {
+		if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+			return TDS_FAIL;
+	}
+
+	tds_set_cur_cursor(tds, cursor);
+
+	/* cursor statement */
+	converted_query = tds_convert_string(tds, tds->conn->char_convs[client2ucs2],
+					     cursor->query, (int)strlen(cursor->query), &converted_query_len);
+	if (!converted_query) {
+		if (!*send)
+			tds_set_state(tds, TDS_IDLE);
+		return TDS_FAIL;
+	}
+
+	tds_freeze(tds, &outer, 0);
+
+	/* RPC call to sp_cursoropen */
+	tds_start_query(tds, TDS_RPC);
+
+	/* procedure identifier by number */
+	if (IS_TDS71_PLUS(tds->conn)) {
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_CURSOROPEN);
+	} else {
+		TDS_PUT_N_AS_UCS2(tds, "sp_cursoropen");
+	}
+
+	tds_put_smallint(tds, 0);	/* flags */
+
+	/* return cursor handle (int) */
+	tds_put_byte(tds, 0);	/* no parameter name */
+	tds_put_byte(tds, 1);	/* output parameter  */
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 0);
+
+	if (num_params) {
+		tds7_put_query_params(tds, converted_query, converted_query_len);
+	} else {
+		tds_put_byte(tds, 0);
+		tds_put_byte(tds, 0);
+		tds_put_byte(tds, SYBNTEXT);	/* must be Ntype */
+		TDS_PUT_INT(tds, converted_query_len);
+		if (IS_TDS71_PLUS(tds->conn))
+			tds_put_n(tds, tds->conn->collation, 5);
+		TDS_PUT_INT(tds, converted_query_len);
+		tds_put_n(tds, converted_query, (int)converted_query_len);
+	}
+
+	/* type */
+	tds_put_byte(tds, 0);	/* no parameter name */
+	tds_put_byte(tds, 1);	/* output parameter  */
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 4);
+	tds_put_int(tds, num_params ? cursor->type | TDS_CUR_TYPE_PARAMETERIZED : cursor->type);
+
+	/* concurrency */
+	tds_put_byte(tds, 0);	/* no parameter name */
+	tds_put_byte(tds, 1);	/* output parameter  */
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 4);
+	tds_put_int(tds, cursor->concurrency);
+
+	/* row count */
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, 1);	/* output parameter  */
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 4);
+	tds_put_int(tds, 0);
+
+	if (num_params) {
+		int i;
+
+		rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
+
+		for (i = 0; i < num_params && TDS_SUCCEED(rc); i++) {
+			TDSCOLUMN *param = params->columns[i];
+
+			rc = tds_put_data_info(tds, param, 0);
+			if (TDS_SUCCEED(rc))
+				rc = tds_put_data(tds, param);
+		}
+	}
+	tds_convert_string_free(cursor->query, converted_query);
+	if (TDS_FAILED(rc)) {
+		tds_freeze_abort(&outer);
+		if (!*send)
+			tds_set_state(tds, TDS_IDLE);
+		return rc;
+	}
+	tds_freeze_close(&outer);
+
+	*send = 1;
+	tds->current_op = TDS_OP_CURSOROPEN;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Fetch cursor->cursor_rows rows from a cursor (sp_cursorfetch).
+ * Rows are returned using the metadata received when the cursor was opened.
+ * \tds
+ * \param cursor      cursor to fetch from
+ * \param fetch_type  fetch direction
+ * \param i_row       row number for TDS_CURSOR_FETCH_ABSOLUTE, offset from
+ *                    the first row of the last fetch for TDS_CURSOR_FETCH_RELATIVE
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_cursor_fetch(TDSSOCKET * tds, TDSCURSOR * cursor, TDS_CURSOR_FETCH fetch_type, TDS_INT i_row)
+{
+	static const unsigned char mssql_fetch[7] = {
+		0,
+		2,    /* TDS_CURSOR_FETCH_NEXT */
+		4,    /* TDS_CURSOR_FETCH_PREV */
+		1,    /* TDS_CURSOR_FETCH_FIRST */
+		8,    /* TDS_CURSOR_FETCH_LAST */
+		0x10, /* TDS_CURSOR_FETCH_ABSOLUTE */
+		0x20  /* TDS_CURSOR_FETCH_RELATIVE */
+	};
+
+	if (!cursor || !IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	tdsdump_log(TDS_DBG_INFO1, "tds_cursor_fetch() cursor id = %d\n", cursor->cursor_id);
+
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	tds_set_cur_cursor(tds, cursor);
+
+	/* RPC call to sp_cursorfetch */
+	tds_start_query(tds, TDS_RPC);
+
+	if (IS_TDS71_PLUS(tds->conn)) {
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_CURSORFETCH);
+	} else {
+		TDS_PUT_N_AS_UCS2(tds, "sp_cursorfetch");
+	}
+
+	/* This flag tells the SP only to */
+	/* output a dummy metadata token  */
+
+	tds_put_smallint(tds, 2);
+
+	/* input cursor handle (int) */
+	tds7_put_int_param(tds, cursor->cursor_id, true);
+
+	/* fetch type */
+	tds7_put_int_param(tds, mssql_fetch[fetch_type], true);
+
+	/* row number */
+	tds7_put_int_param(tds, i_row, fetch_type == TDS_CURSOR_FETCH_ABSOLUTE || fetch_type == TDS_CURSOR_FETCH_RELATIVE);
+
+	/* number of rows to fetch */
+	tds7_put_int_param(tds, cursor->cursor_rows, true);
+
+	tds->current_op = TDS_OP_CURSORFETCH;
+	return tds_query_flush_packet(tds);
+}
+
+/**
+ * Close and deallocate a cursor once the connection is idle.
+ * \param conn    connection
+ * \param cursor  cursor to close
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_deferred_cursor_dealloc(TDSCONNECTION *conn, TDSCURSOR * cursor)
+{
+	if (!tds_cursor_check_allocated(conn, cursor))
+		return TDS_SUCCESS;
+
+	cursor->defer_close = true;
+	conn->pending_close = 1;
+
+	return TDS_SUCCESS;
+}
+
 TDSRET
 tds_cursor_close(TDSSOCKET * tds, TDSCURSOR * cursor)
 {
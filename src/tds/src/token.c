@@ -1860,20 +1860,13 @@ tds_process_compute(TDSSOCKET * tds)
 static TDSRET
 tds_process_row(TDSSOCKET * tds)
 {
-	unsigned int i;
-	TDSCOLUMN *curcol;
 	TDSRESULTINFO *info;
 
 	info = tds->current_results;
 	if (!info || info->num_cols <= 0)
 		return TDS_FAIL;
 
-	for (i = 0; i < info->num_cols; i++) {
-		tdsdump_log(TDS_DBG_INFO1, "tds_process_row(): reading column %d \n", i);
-		curcol = info->columns[i];
-		TDS_PROPAGATE(curcol->funcs->get_data(tds, curcol));
-	}
-	return TDS_SUCCESS;
+	return tds_get_row(tds, info);
 }
 
 /**
@@ -1968,6 +1961,14 @@ tds_process_pending_closes(TDSSOCKET *tds)
 		if (next_dyn)
 			++next_dyn->ref_count;
 
+		if (dyn->defer_close) {
+			if (TDS_FAILED(tds_submit_unprepare(tds, dyn))
+			    || TDS_FAILED(tds_process_simple_query(tds))) {
+				all_closed = 0;
+			} else {
+				dyn->defer_close = false;
+			}
+		}
 		tds_release_dynamic(&dyn);
 	}
 
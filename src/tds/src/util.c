@@ -130,7 +130,9 @@ tds_set_state(TDSSOCKET * tds, TDS_STATE state)
 			freeze.size_len = 0;
 			tds_freeze_abort(&freeze);
 
-			tds_connection_close(tds->conn);
+			/* not if we got here closing the connection */
+			if (!TDS_IS_SOCKET_INVALID(tds_get_s(tds)))
+				tds_connection_close(tds->conn);
 		}
 		break;
 	case TDS_WRITING: